@@ -0,0 +1,321 @@
+/*
+ * nslora-bench.cc
+ *
+ * Fixed performance benchmark of the nslora-sim scenarios.
+ *
+ * Usage: nslora-bench [--sim=<nslora-sim>] [--out=<report.json>]
+ *                     [--baseline=<report.json>] [--threshold=<share>]
+ *                     [--time=<s>] [--filter=<text>] [-- <nslora-sim options>]
+ *
+ * Runs every scenario of the matrix, 1k, 10k and 100k end devices times
+ * 1, 7, 19 and 37 gateways times 10 s and 60 s periods, all with seed 1
+ * and the gateways on hexagonal rings (--hexGrid=1, which the list layout
+ * only has seven places for), each in its own nslora-sim process
+ * (--runDevices), so that the peak resident set of a scenario is its own.
+ * The runs do not write the device map.  The wall time and the peak RSS
+ * are measured here around the process; the events and the setup and run
+ * split come from the profile the process prints.  Options after -- are
+ * passed to every run, to benchmark --compact=1 or --scheduler=bucket.
+ *
+ * The report is one JSON object with a row per scenario.  Given the report
+ * of an earlier run as a baseline, every scenario whose wall time or peak
+ * RSS grew, or whose event rate fell, by more than the threshold (10% by
+ * default) is flagged in the report and on stderr, and the exit status is
+ * 1.  Run from the ns-3 root inside ./waf shell, so that nslora-sim finds
+ * the ns-3 libraries; nslora-bench itself does not link them.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <sys/resource.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+struct BenchScenario
+{
+  int nDevices;
+  int rings;
+  int period;
+};
+
+struct BenchResult
+{
+  std::string name;
+  BenchScenario scenario;
+  bool ok;
+  double wallSeconds;
+  double setupSeconds;
+  double runSeconds;
+  double events;
+  double eventsPerSecond;
+  long peakRssKb;
+};
+
+static std::string
+GetName (const BenchScenario &s)
+{
+  std::ostringstream oss;
+  oss << "ed" << s.nDevices << "-gw" << 3*s.rings*s.rings-3*s.rings+1 << "-p" << s.period;
+  return oss.str ();
+}
+
+/* The number after "key": in json, from pos on; NaN if there is none */
+static double
+FindNumber (const std::string &json, const std::string &key, size_t pos = 0)
+{
+  size_t at = json.find ("\"" + key + "\":", pos);
+  if (at == std::string::npos)
+    {
+      return NAN;
+    }
+  return strtod (json.c_str () + at + key.size () + 3, 0);
+}
+
+/* Run one scenario in its own nslora-sim process */
+static BenchResult
+RunScenario (const std::string &sim, const BenchScenario &s, double time,
+             const std::vector<std::string> &extra)
+{
+  BenchResult r;
+  r.name = GetName (s);
+  r.scenario = s;
+  r.ok = false;
+  r.wallSeconds = r.setupSeconds = r.runSeconds = r.events = r.eventsPerSecond = 0;
+  r.peakRssKb = 0;
+
+  std::vector<std::string> args;
+  args.push_back (sim);
+  std::ostringstream oss;
+  oss << "--runDevices=" << s.nDevices;
+  args.push_back (oss.str ());
+  oss.str ("");
+  oss << "--runRings=" << s.rings;
+  args.push_back (oss.str ());
+  oss.str ("");
+  oss << "--runPeriod=" << s.period;
+  args.push_back (oss.str ());
+  oss.str ("");
+  oss << "--runTime=" << time;
+  args.push_back (oss.str ());
+  args.push_back ("--runSeed=1");
+  args.insert (args.end (), extra.begin (), extra.end ());
+  // Last, so no option passed through can put 19 or 37 gateways on the
+  // seven places of the list layout, or time the writing of a device map
+  args.push_back ("--hexGrid=1");
+  args.push_back ("--printdev=0");
+  std::vector<char *> argv;
+  for (size_t i = 0; i < args.size (); i++)
+    {
+      argv.push_back (const_cast<char *> (args[i].c_str ()));
+    }
+  argv.push_back (0);
+
+  int fds[2];
+  if (pipe (fds) != 0)
+    {
+      return r;
+    }
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now ();
+  pid_t pid = fork ();
+  if (pid == 0)
+    {
+      // The profile comes on stdout; the log stays on stderr
+      dup2 (fds[1], STDOUT_FILENO);
+      close (fds[0]);
+      close (fds[1]);
+      execv (argv[0], &argv[0]);
+      perror (argv[0]);
+      _exit (127);
+    }
+  close (fds[1]);
+  if (pid < 0)
+    {
+      close (fds[0]);
+      return r;
+    }
+  std::string json;
+  char buffer[4096];
+  ssize_t n;
+  while ((n = read (fds[0], buffer, sizeof (buffer))) > 0)
+    {
+      json.append (buffer, n);
+    }
+  close (fds[0]);
+  int status = 0;
+  struct rusage usage;
+  memset (&usage, 0, sizeof (usage));
+  wait4 (pid, &status, 0, &usage);
+  r.wallSeconds = std::chrono::duration<double> (std::chrono::steady_clock::now () - start).count ();
+  // Kilobytes on Linux
+  r.peakRssKb = usage.ru_maxrss;
+
+  r.events = FindNumber (json, "events");
+  r.setupSeconds = FindNumber (json, "setupSeconds");
+  r.runSeconds = FindNumber (json, "runSeconds");
+  r.eventsPerSecond = FindNumber (json, "eventsPerSecond");
+  r.ok = WIFEXITED (status) && WEXITSTATUS (status) == 0 && r.events == r.events;
+  return r;
+}
+
+/* Relative change from base to value, 0 without a base */
+static double
+GetChange (double value, double base)
+{
+  return base > 0 && base == base ? value / base - 1 : 0;
+}
+
+int main (int argc, char *argv[])
+{
+  std::string sim = "build/scratch/nslora-sim";
+  std::string out = "dat/bench.json";
+  std::string baseline;
+  std::string filter;
+  double threshold = 0.1;
+  double time = 150;
+  std::vector<std::string> extra;
+  for (int i = 1; i < argc; i++)
+    {
+      std::string arg = argv[i];
+      size_t eq = arg.find ('=');
+      std::string key = arg.substr (0, eq);
+      std::string value = eq == std::string::npos ? "" : arg.substr (eq + 1);
+      if (arg == "--")
+        {
+          extra.assign (argv + i + 1, argv + argc);
+          break;
+        }
+      else if (key == "--sim")
+        {
+          sim = value;
+        }
+      else if (key == "--out")
+        {
+          out = value;
+        }
+      else if (key == "--baseline")
+        {
+          baseline = value;
+        }
+      else if (key == "--threshold")
+        {
+          threshold = atof (value.c_str ());
+        }
+      else if (key == "--time")
+        {
+          time = atof (value.c_str ());
+        }
+      else if (key == "--filter")
+        {
+          filter = value;
+        }
+      else
+        {
+          std::cerr << "usage: " << argv[0] << " [--sim=<nslora-sim>] [--out=<report.json>] [--baseline=<report.json>]"
+                    << " [--threshold=<share>] [--time=<s>] [--filter=<text>] [-- <nslora-sim options>]" << std::endl;
+          return 2;
+        }
+    }
+
+  std::string base;
+  if (!baseline.empty ())
+    {
+      std::ifstream fd (baseline.c_str ());
+      if (!fd)
+        {
+          std::cerr << baseline << ": cannot read the baseline" << std::endl;
+          return 2;
+        }
+      std::ostringstream oss;
+      oss << fd.rdbuf ();
+      base = oss.str ();
+    }
+
+  static const int devices[3] = { 1000, 10000, 100000 };
+  static const int rings[4] = { 1, 2, 3, 4 };
+  static const int periods[2] = { 10, 60 };
+  std::vector<BenchScenario> scenarios;
+  for (int d = 0; d < 3; d++)
+    {
+      for (int g = 0; g < 4; g++)
+        {
+          for (int p = 0; p < 2; p++)
+            {
+              BenchScenario s = { devices[d], rings[g], periods[p] };
+              if (GetName (s).find (filter) != std::string::npos)
+                {
+                  scenarios.push_back (s);
+                }
+            }
+        }
+    }
+
+  std::ostringstream report;
+  report << "{\n  \"simulationTime\": " << time << ", \"seed\": 1, \"layout\": \"hex\", \"threshold\": " << threshold
+         << ",\n  \"options\": \"";
+  for (size_t i = 0; i < extra.size (); i++)
+    {
+      report << (i ? " " : "") << extra[i];
+    }
+  report << "\",\n  \"scenarios\": [";
+
+  unsigned failed = 0;
+  unsigned regressed = 0;
+  for (size_t i = 0; i < scenarios.size (); i++)
+    {
+      BenchResult r = RunScenario (sim, scenarios[i], time, extra);
+      failed += !r.ok;
+      std::cerr << r.name << ": " << (r.ok ? "" : "FAILED, ") << r.wallSeconds << " s, " << r.eventsPerSecond
+                << " events/s, " << r.peakRssKb << " kB" << std::endl;
+
+      report << (i ? ",\n    " : "\n    ")
+             << "{\"name\": \"" << r.name << "\", \"nDevices\": " << r.scenario.nDevices
+             << ", \"nGateways\": " << 3*r.scenario.rings*r.scenario.rings-3*r.scenario.rings+1
+             << ", \"period\": " << r.scenario.period << ", \"ok\": " << (r.ok ? "true" : "false")
+             << ", \"wallSeconds\": " << r.wallSeconds << ", \"setupSeconds\": " << (r.ok ? r.setupSeconds : 0)
+             << ", \"runSeconds\": " << (r.ok ? r.runSeconds : 0) << ", \"events\": " << (r.ok ? r.events : 0)
+             << ", \"eventsPerSecond\": " << (r.ok ? r.eventsPerSecond : 0) << ", \"peakRssKb\": " << r.peakRssKb;
+
+      // The baseline row of the same scenario
+      size_t at = base.find ("\"name\": \"" + r.name + "\"");
+      if (r.ok && at != std::string::npos && base.compare (base.find ("\"ok\": ", at) + 6, 4, "true") == 0)
+        {
+          double wall = GetChange (r.wallSeconds, FindNumber (base, "wallSeconds", at));
+          double rate = GetChange (r.eventsPerSecond, FindNumber (base, "eventsPerSecond", at));
+          double rss = GetChange (r.peakRssKb, FindNumber (base, "peakRssKb", at));
+          bool worse = wall > threshold || -rate > threshold || rss > threshold;
+          regressed += worse;
+          report << ", \"wallChange\": " << wall << ", \"eventsPerSecondChange\": " << rate
+                 << ", \"peakRssChange\": " << rss << ", \"regressed\": " << (worse ? "true" : "false");
+          if (worse)
+            {
+              std::cerr << r.name << ": REGRESSED, wall time " << 100 * wall << "%, events/s " << 100 * rate
+                        << "%, peak RSS " << 100 * rss << "%" << std::endl;
+            }
+        }
+      report << "}";
+    }
+  report << "\n  ],\n  \"failed\": " << failed << ", \"regressed\": " << regressed << "\n}" << std::endl;
+
+  std::ofstream fd (out.c_str ());
+  fd << report.str ();
+  fd.close ();
+  if (!fd)
+    {
+      std::cerr << out << ": cannot write the report" << std::endl;
+      return 2;
+    }
+  std::cerr << scenarios.size () << " scenarios, " << failed << " failed, " << regressed << " regressed" << std::endl;
+  return failed > 0 || regressed > 0 ? 1 : 0;
+}
@@ -0,0 +1,236 @@
+/*
+ * nslora-cached-loss.h
+ *
+ * A propagation loss decorator that precomputes the path loss between
+ * every end device and every gateway of a static topology.
+ *
+ * Both the channel and LoraMacHelper::SetSpreadingFactorsUp go through the
+ * loss model, so once Cache has filled the matrix every ED-gateway lookup
+ * is an aggregate lookup of the receiving node, a load from a table
+ * indexed by node id and a float load, instead of two position queries
+ * and a log10.  The sender's slot is kept across the deliveries of one
+ * transmission.  Pairs outside the matrix (ED to ED, mobility models without a
+ * node, or any node that has moved since Cache) are passed to the
+ * wrapped model.
+ *
+ * The wrapped model must be reciprocal and its loss independent of the
+ * transmission power, as the distance-based ns-3 models are.  Losses are
+ * stored as float, which is exact to a few micro-dB at LoRa path losses.
+ */
+
+#ifndef NSLORA_CACHED_LOSS_H
+#define NSLORA_CACHED_LOSS_H
+
+#include "ns3/propagation-loss-model.h"
+#include "ns3/mobility-model.h"
+#include "ns3/node-container.h"
+
+#include <algorithm>
+#include <vector>
+
+namespace ns3 {
+
+class CachedPropagationLossModel : public PropagationLossModel
+{
+public:
+  static TypeId GetTypeId (void);
+
+  CachedPropagationLossModel ();
+  CachedPropagationLossModel (Ptr<PropagationLossModel> inner);
+
+  void SetInner (Ptr<PropagationLossModel> inner);
+
+  /**
+   * Compute the loss of every ED-gateway pair with the wrapped model,
+   * replacing any earlier matrix.  Nodes must have their final positions;
+   * a later course change of any of them takes that node out of the
+   * cache.
+   */
+  void Cache (NodeContainer endDevices, NodeContainer gateways);
+
+  /* Forget the matrix; every lookup goes to the wrapped model again */
+  void Invalidate (void);
+
+  /* Number of lookups served from the matrix */
+  uint64_t GetHits (void) const;
+
+private:
+  static const uint32_t NONE = 0xffffffff;
+  static const uint32_t GATEWAY = 0x80000000;  //!< set in the slots of gateways
+
+  virtual double DoCalcRxPower (double txPowerDbm, Ptr<MobilityModel> a, Ptr<MobilityModel> b) const;
+  virtual int64_t DoAssignStreams (int64_t stream);
+
+  void CourseChanged (Ptr<const MobilityModel> mobility);
+  /* Row of an end device, GATEWAY | column of a gateway, or NONE */
+  uint32_t GetSlot (const MobilityModel *mobility) const;
+
+  Ptr<PropagationLossModel> m_inner;
+  std::vector<uint32_t> m_slot;         //!< by node id
+  std::vector<Ptr<MobilityModel> > m_watched;  //!< course changes connected
+  std::vector<float> m_loss;            //!< nEndDevices rows of nGateways losses, dB
+  uint32_t m_nGateways;
+  mutable const MobilityModel *m_lastSender;
+  mutable uint32_t m_lastSlot;          //!< of m_lastSender
+  mutable uint64_t m_hits;
+};
+
+NS_OBJECT_ENSURE_REGISTERED (CachedPropagationLossModel);
+
+inline TypeId
+CachedPropagationLossModel::GetTypeId (void)
+{
+  static TypeId tid = TypeId ("ns3::CachedPropagationLossModel")
+    .SetParent<PropagationLossModel> ()
+    .SetGroupName ("Propagation")
+    .AddConstructor<CachedPropagationLossModel> ();
+  return tid;
+}
+
+inline
+CachedPropagationLossModel::CachedPropagationLossModel ()
+  : m_nGateways (0),
+    m_lastSender (0),
+    m_lastSlot (NONE),
+    m_hits (0)
+{
+}
+
+inline
+CachedPropagationLossModel::CachedPropagationLossModel (Ptr<PropagationLossModel> inner)
+  : m_inner (inner),
+    m_nGateways (0),
+    m_lastSender (0),
+    m_lastSlot (NONE),
+    m_hits (0)
+{
+}
+
+inline void
+CachedPropagationLossModel::SetInner (Ptr<PropagationLossModel> inner)
+{
+  m_inner = inner;
+  Invalidate ();
+}
+
+inline void
+CachedPropagationLossModel::Cache (NodeContainer endDevices, NodeContainer gateways)
+{
+  Invalidate ();
+  m_nGateways = gateways.GetN ();
+  m_loss.resize (size_t (endDevices.GetN ()) * m_nGateways);
+
+  uint32_t maxId = 0;
+  for (uint32_t g = 0; g < gateways.GetN (); g++)
+    {
+      maxId = std::max (maxId, gateways.Get (g)->GetId ());
+    }
+  for (uint32_t e = 0; e < endDevices.GetN (); e++)
+    {
+      maxId = std::max (maxId, endDevices.Get (e)->GetId ());
+    }
+  m_slot.assign (size_t (maxId) + 1, uint32_t (NONE));
+
+  std::vector<Ptr<MobilityModel> > gwMobility;
+  for (uint32_t g = 0; g < gateways.GetN (); g++)
+    {
+      Ptr<MobilityModel> mob = gateways.Get (g)->GetObject<MobilityModel> ();
+      m_slot[gateways.Get (g)->GetId ()] = GATEWAY | g;
+      mob->TraceConnectWithoutContext ("CourseChange",
+                                       MakeCallback (&CachedPropagationLossModel::CourseChanged, this));
+      m_watched.push_back (mob);
+      gwMobility.push_back (mob);
+    }
+  for (uint32_t e = 0; e < endDevices.GetN (); e++)
+    {
+      Ptr<MobilityModel> mob = endDevices.Get (e)->GetObject<MobilityModel> ();
+      m_slot[endDevices.Get (e)->GetId ()] = e;
+      mob->TraceConnectWithoutContext ("CourseChange",
+                                       MakeCallback (&CachedPropagationLossModel::CourseChanged, this));
+      m_watched.push_back (mob);
+      float *row = &m_loss[size_t (e) * m_nGateways];
+      for (uint32_t g = 0; g < m_nGateways; g++)
+        {
+          row[g] = float (-m_inner->CalcRxPower (0, mob, gwMobility[g]));
+        }
+    }
+}
+
+inline void
+CachedPropagationLossModel::Invalidate (void)
+{
+  // A second Cache would otherwise hear every course change twice
+  for (size_t i = 0; i < m_watched.size (); i++)
+    {
+      m_watched[i]->TraceDisconnectWithoutContext ("CourseChange",
+                                                   MakeCallback (&CachedPropagationLossModel::CourseChanged, this));
+    }
+  m_watched.clear ();
+  m_slot.clear ();
+  m_loss.clear ();
+  m_nGateways = 0;
+  m_lastSender = 0;
+}
+
+inline uint64_t
+CachedPropagationLossModel::GetHits (void) const
+{
+  return m_hits;
+}
+
+inline uint32_t
+CachedPropagationLossModel::GetSlot (const MobilityModel *mobility) const
+{
+  Ptr<Node> node = mobility->GetObject<Node> ();
+  if (node == 0 || node->GetId () >= m_slot.size ())
+    {
+      return NONE;
+    }
+  return m_slot[node->GetId ()];
+}
+
+inline void
+CachedPropagationLossModel::CourseChanged (Ptr<const MobilityModel> mobility)
+{
+  Ptr<Node> node = mobility->GetObject<Node> ();
+  if (node != 0 && node->GetId () < m_slot.size ())
+    {
+      m_slot[node->GetId ()] = NONE;
+    }
+  m_lastSender = 0;
+}
+
+inline double
+CachedPropagationLossModel::DoCalcRxPower (double txPowerDbm, Ptr<MobilityModel> a, Ptr<MobilityModel> b) const
+{
+  if (!m_slot.empty ())
+    {
+      // The channel asks for every receiver of a transmission in turn
+      if (PeekPointer (a) != m_lastSender)
+        {
+          m_lastSender = PeekPointer (a);
+          m_lastSlot = GetSlot (m_lastSender);
+        }
+      uint32_t sa = m_lastSlot;
+      uint32_t sb = GetSlot (PeekPointer (b));
+      // One end device and one gateway, both still where Cache saw them
+      if (sa != NONE && sb != NONE && ((sa ^ sb) & GATEWAY))
+        {
+          uint32_t ed = sa & GATEWAY ? sb : sa;
+          uint32_t gw = (sa & GATEWAY ? sa : sb) & ~GATEWAY;
+          m_hits++;
+          return txPowerDbm - m_loss[size_t (ed) * m_nGateways + gw];
+        }
+    }
+  return m_inner->CalcRxPower (txPowerDbm, a, b);
+}
+
+inline int64_t
+CachedPropagationLossModel::DoAssignStreams (int64_t stream)
+{
+  return m_inner->AssignStreams (stream);
+}
+
+} // namespace ns3
+
+#endif /* NSLORA_CACHED_LOSS_H */
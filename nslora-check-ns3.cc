@@ -0,0 +1,257 @@
+/*
+ * nslora-check-ns3.cc
+ *
+ * Self-checks of the data structures of the drivers built on ns-3 types.
+ *
+ * Usage: nslora-check-ns3
+ *
+ * Checks the hex grid layout against its ring arithmetic and GetNearest
+ * against a search of every site, for points inside and outside the
+ * layout.  Checks that BucketScheduler hands out events in the order of
+ * ns3::MapScheduler, through ties, cancellations, laps of its buckets and
+ * resizes both ways.  Prints every failed check, and exits with status 1
+ * if there is one.  Builds in scratch/ like nslora-sim; nslora-check
+ * covers the structures that do not need ns-3.
+ */
+
+#include "ns3/core-module.h"
+#include "ns3/map-scheduler.h"
+
+#include "nslora-hex-grid.h"
+#include "nslora-scheduler.h"
+
+#include <stdint.h>
+
+#include <iostream>
+#include <map>
+#include <random>
+#include <vector>
+
+using namespace ns3;
+
+static unsigned failures = 0;
+
+#define CHECK(cond)                                                     \
+  do                                                                    \
+    {                                                                   \
+      if (!(cond))                                                      \
+        {                                                               \
+          std::cerr << __FILE__ << ":" << __LINE__ << ": " #cond << std::endl; \
+          failures++;                                                   \
+        }                                                               \
+    }                                                                   \
+  while (0)
+
+static double
+GetDistance (const Vector &a, double x, double y)
+{
+  return std::sqrt ((a.x - x) * (a.x - x) + (a.y - y) * (a.y - y));
+}
+
+static void
+CheckHexGridLayout (void)
+{
+  for (uint32_t rings = 1; rings <= 6; rings++)
+    {
+      Ptr<HexGridPositionAllocator> grid = CreateObject<HexGridPositionAllocator> ();
+      grid->SetRings (rings);
+      grid->SetDistance (1000);
+      CHECK (grid->GetN () == 3 * rings * rings - 3 * rings + 1);
+      CHECK (GetDistance (grid->GetPosition (0), 0, 0) < 1e-9);
+
+      for (uint32_t i = 0; i < grid->GetN (); i++)
+        {
+          // Every site has a neighbour at the inter-site distance and none closer
+          Vector a = grid->GetPosition (i);
+          double nearest = INFINITY;
+          for (uint32_t j = 0; j < grid->GetN (); j++)
+            {
+              if (j != i)
+                {
+                  nearest = std::min (nearest, GetDistance (grid->GetPosition (j), a.x, a.y));
+                }
+            }
+          CHECK (rings == 1 || std::fabs (nearest - 1000) < 1e-6);
+          CHECK (grid->GetNearest (a.x, a.y) == i);
+        }
+
+      // Handed out centre first and then ring by ring, wrapping around
+      for (uint32_t i = 0; i < grid->GetN (); i++)
+        {
+          Vector a = grid->GetNext ();
+          CHECK (GetDistance (grid->GetPosition (i), a.x, a.y) < 1e-9);
+        }
+      CHECK (GetDistance (grid->GetNext (), 0, 0) < 1e-9);
+    }
+}
+
+static void
+CheckHexGridNearest (void)
+{
+  std::mt19937_64 rng (1);
+  std::uniform_real_distribution<double> coordinate (-30000, 30000);
+  for (uint32_t rings = 1; rings <= 5; rings++)
+    {
+      Ptr<HexGridPositionAllocator> grid = CreateObject<HexGridPositionAllocator> ();
+      grid->SetRings (rings);
+      grid->SetDistance (2500);
+      grid->SetCenter (Vector (300, -700, 0));
+      for (int i = 0; i < 20000; i++)
+        {
+          // Far enough out that some points miss the layout
+          double x = coordinate (rng);
+          double y = coordinate (rng);
+          uint32_t best = 0;
+          double bestD = INFINITY;
+          double secondD = INFINITY;
+          for (uint32_t s = 0; s < grid->GetN (); s++)
+            {
+              double d = GetDistance (grid->GetPosition (s), x, y);
+              if (d < bestD)
+                {
+                  secondD = bestD;
+                  bestD = d;
+                  best = s;
+                }
+              else if (d < secondD)
+                {
+                  secondD = d;
+                }
+            }
+          // On a cell edge either site will do
+          if (secondD - bestD < 1e-6)
+            {
+              continue;
+            }
+          uint32_t nearest = grid->GetNearest (x, y);
+          CHECK (nearest == best);
+          if (nearest != best)
+            {
+              std::cerr << "  rings " << rings << " at (" << x << ", " << y << "): site " << nearest
+                        << " instead of " << best << std::endl;
+            }
+        }
+    }
+}
+
+/* An event that does nothing, for the schedulers to hold */
+class NullEvent : public EventImpl
+{
+protected:
+  virtual void Notify (void)
+  {
+  }
+};
+
+static void
+CheckBucketScheduler (Time width, uint32_t buckets)
+{
+  Config::SetDefault ("ns3::BucketScheduler::BucketWidth", TimeValue (width));
+  Config::SetDefault ("ns3::BucketScheduler::Buckets", UintegerValue (buckets));
+  Ptr<Scheduler> bucket = CreateObject<BucketScheduler> ();
+  Ptr<Scheduler> map = CreateObject<MapScheduler> ();
+  NullEvent impl;
+
+  std::mt19937_64 rng (5);
+  const uint64_t widthTs = std::max<int64_t> (1, width.GetTimeStep ());
+  // A few offsets shared by many events, so timestamps tie often
+  const uint64_t offsets[6] = { 1, 7, widthTs - 1, widthTs, 3 * widthTs, 1000 * widthTs };
+  std::map<uint32_t, Scheduler::Event> pending;
+  uint64_t now = 0;
+  uint32_t uid = 0;
+  // Before Simulator::Run events come in any order
+  for (; uid < 2000; uid++)
+    {
+      Scheduler::Event ev;
+      ev.impl = &impl;
+      ev.key.m_ts = rng () % (1000 * widthTs);
+      ev.key.m_uid = uid;
+      ev.key.m_context = uint32_t (rng () % 10);
+      bucket->Insert (ev);
+      map->Insert (ev);
+      pending[ev.key.m_uid] = ev;
+    }
+  for (int i = 0; i < 300000; i++)
+    {
+      // Fill to thousands of events and drain, three times over, so the
+      // buckets double and halve
+      bool filling = (i / 50000) % 2 == 0;
+      uint32_t r = rng () % 100;
+      if (r < (filling ? 60u : 30u))
+        {
+          uint64_t delta;
+          switch (rng () % 4)
+            {
+            case 0:
+              delta = 0;
+              break;
+            case 1:
+              delta = offsets[rng () % 6];
+              break;
+            case 2:
+              delta = rng () % (64 * widthTs);
+              break;
+            default:
+              // Past a lap of the buckets
+              delta = rng () % (uint64_t (1) << 34);
+              break;
+            }
+          Scheduler::Event ev;
+          ev.impl = &impl;
+          ev.key.m_ts = now + delta;
+          ev.key.m_uid = uid++;
+          ev.key.m_context = uint32_t (rng () % 10);
+          bucket->Insert (ev);
+          map->Insert (ev);
+          pending[ev.key.m_uid] = ev;
+        }
+      else if (r < (filling ? 65u : 35u) && !pending.empty ())
+        {
+          // Cancel a pending event, as Simulator::Remove does
+          std::map<uint32_t, Scheduler::Event>::iterator it = pending.lower_bound (uint32_t (rng () % uid));
+          if (it == pending.end ())
+            {
+              it = pending.begin ();
+            }
+          bucket->Remove (it->second);
+          map->Remove (it->second);
+          pending.erase (it);
+        }
+      else if (!pending.empty ())
+        {
+          CHECK (!bucket->IsEmpty ());
+          Scheduler::Event peek = bucket->PeekNext ();
+          Scheduler::Event a = bucket->RemoveNext ();
+          Scheduler::Event b = map->RemoveNext ();
+          CHECK (peek.key.m_uid == a.key.m_uid);
+          CHECK (a.key.m_uid == b.key.m_uid && a.key.m_ts == b.key.m_ts);
+          CHECK (a.key.m_context == b.key.m_context && a.impl == b.impl);
+          if (a.key.m_uid != b.key.m_uid)
+            {
+              std::cerr << "  width " << widthTs << ", " << buckets << " buckets, step " << i << ": event "
+                        << a.key.m_uid << " at " << a.key.m_ts << " instead of " << b.key.m_uid << " at "
+                        << b.key.m_ts << std::endl;
+              return;
+            }
+          now = a.key.m_ts;
+          pending.erase (a.key.m_uid);
+        }
+      CHECK (bucket->IsEmpty () == pending.empty ());
+    }
+}
+
+int main (int argc, char *argv[])
+{
+  CommandLine cmd;
+  cmd.Parse (argc, argv);
+
+  CheckHexGridLayout ();
+  CheckHexGridNearest ();
+  // Narrow and few buckets, so the walk laps them, and the defaults
+  CheckBucketScheduler (NanoSeconds (10), 4);
+  CheckBucketScheduler (MicroSeconds (1), 64);
+  CheckBucketScheduler (MilliSeconds (1), 1024);
+
+  std::cerr << (failures ? "FAILED " : "passed, ") << failures << " failed checks" << std::endl;
+  return failures > 0 ? 1 : 0;
+}
@@ -0,0 +1,546 @@
+/*
+ * nslora-check.cc
+ *
+ * Self-checks of the ns-3-free data structures of the drivers.
+ *
+ * Usage: nslora-check
+ *
+ * Drives the packet tracker against a std::map holding the same packets,
+ * through collisions, wraparound of the probe sequences and backward-shift
+ * deletion, and checks its outcome rows.  Checks the bucket bounds and
+ * precision of the latency histogram, its percentiles against sorted
+ * samples, merging, and that its files round-trip and that a truncated
+ * or foreign one is rejected without touching the histograms.  Checks that
+ * the packet log reads back as written and that a failed write is
+ * reported by Close.  Prints
+ * every failed check, and exits with status 1 if there is one.  Builds
+ * like nslora-log-reader, without ns-3.
+ */
+
+#include "nslora-histogram.h"
+#include "nslora-packet-log.h"
+#include "nslora-packet-tracker.h"
+#include "nslora-sweep.h"
+
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <random>
+#include <sstream>
+#include <vector>
+
+using namespace nslora;
+
+static unsigned failures = 0;
+
+#define CHECK(cond)                                                     \
+  do                                                                    \
+    {                                                                   \
+      if (!(cond))                                                      \
+        {                                                               \
+          std::cerr << __FILE__ << ":" << __LINE__ << ": " #cond << std::endl; \
+          failures++;                                                   \
+        }                                                               \
+    }                                                                   \
+  while (0)
+
+/* Every packet of reference is found with its sender, and only those */
+static void
+CheckTracked (const PacketTracker &tracker, const std::map<uint64_t, uint32_t> &reference, uint64_t maxUid)
+{
+  CHECK (tracker.GetSize () == reference.size ());
+  for (uint64_t uid = 0; uid < maxUid; uid++)
+    {
+      PacketTracker::Handle h = tracker.Find (uid);
+      std::map<uint64_t, uint32_t>::const_iterator i = reference.find (uid);
+      if (i == reference.end ())
+        {
+          CHECK (h == PacketTracker::NONE);
+          continue;
+        }
+      CHECK (h != PacketTracker::NONE);
+      if (h != PacketTracker::NONE)
+        {
+          CHECK (tracker.GetUid (h) == uid);
+          CHECK (tracker.GetSenderId (h) == i->second);
+        }
+    }
+}
+
+/* UIDs whose home slot in a table of 16 is the last one */
+static std::vector<uint64_t>
+GetLastSlotUids (uint32_t n)
+{
+  std::vector<uint64_t> uids;
+  PacketTracker tracker;
+  tracker.Reset (1, 8);
+  for (uint64_t uid = 0; uids.size () < n; uid++)
+    {
+      // Alone in the table an entry sits in its home slot
+      PacketTracker::Handle h = tracker.Insert (uid, 0);
+      if (h == 15)
+        {
+          uids.push_back (uid);
+        }
+      tracker.Erase (h);
+    }
+  return uids;
+}
+
+static void
+CheckTrackerWraparound (void)
+{
+  // Three packets homed in the last slot fill it and wrap to 0 and 1
+  std::vector<uint64_t> uids = GetLastSlotUids (3);
+  PacketTracker tracker;
+  tracker.Reset (1, 8);
+  PacketTracker::Handle a = tracker.Insert (uids[0], 1);
+  PacketTracker::Handle b = tracker.Insert (uids[1], 2);
+  PacketTracker::Handle c = tracker.Insert (uids[2], 3);
+  CHECK (a == 15 && b == 0 && c == 1);
+
+  // Erasing the head shifts the wrapped ones back, across the end
+  tracker.Erase (a);
+  CHECK (tracker.Find (uids[0]) == PacketTracker::NONE);
+  CHECK (tracker.Find (uids[1]) == 15);
+  CHECK (tracker.Find (uids[2]) == 0);
+  CHECK (tracker.Find (uids[2]) != PacketTracker::NONE && tracker.GetSenderId (tracker.Find (uids[2])) == 3);
+
+  // Evicting across the end of the table finds every stale packet
+  tracker.Reset (1, 8);
+  tracker.Insert (uids[0], 1, 10);
+  tracker.Insert (uids[1], 2, 0);
+  tracker.Insert (uids[2], 3, 0);
+  int counts[UNSET] = { 0, 0, 0, 0 };
+  CHECK (tracker.Evict (5, counts) == 2);
+  CHECK (tracker.GetSize () == 1);
+  CHECK (tracker.Find (uids[0]) == 15);
+}
+
+static void
+CheckTrackerRandom (void)
+{
+  std::mt19937_64 rng (1);
+  PacketTracker tracker;
+  // A small start, so the table grows under the load
+  tracker.Reset (3, 4);
+  std::map<uint64_t, uint32_t> reference;
+  const uint64_t maxUid = 400;
+  for (int i = 0; i < 20000; i++)
+    {
+      uint64_t uid = rng () % maxUid;
+      if (rng () % 2 == 0)
+        {
+          uint32_t sender = uint32_t (rng () % 1000);
+          PacketTracker::Handle h = tracker.Insert (uid, sender);
+          // An insert of a tracked UID keeps the entry
+          if (!reference.insert (std::make_pair (uid, sender)).second)
+            {
+              CHECK (tracker.GetSenderId (h) == reference[uid]);
+            }
+        }
+      else if (reference.erase (uid) > 0)
+        {
+          tracker.Erase (tracker.Find (uid));
+        }
+      if (i % 500 == 0)
+        {
+          CheckTracked (tracker, reference, maxUid);
+        }
+    }
+  CheckTracked (tracker, reference, maxUid);
+  CHECK (tracker.GetPeakSize () >= reference.size ());
+
+  int counts[UNSET] = { 0, 0, 0, 0 };
+  CHECK (tracker.Evict (1, counts) == reference.size ());
+  CHECK (tracker.GetSize () == 0);
+}
+
+static void
+CheckTrackerOutcomes (void)
+{
+  // Rows of more than one code and mask word
+  const uint32_t nGateways = 70;
+  PacketTracker tracker;
+  tracker.Reset (nGateways, 2);
+  PacketTracker::Handle h = tracker.Insert (7, 1);
+  for (uint32_t g = 0; g < nGateways; g++)
+    {
+      CHECK (tracker.GetOutcome (h, g) == UNSET);
+    }
+  CHECK (tracker.SetOutcome (h, 0, RECEIVED) == 1);
+  CHECK (tracker.SetOutcome (h, 33, INTERFERED) == 2);
+  CHECK (tracker.SetOutcome (h, 69, NO_MORE_RECEIVERS) == 3);
+
+  uint64_t culled[2] = { uint64_t (1) << 5 | uint64_t (1) << 40, uint64_t (1) << 2 };
+  CHECK (tracker.SetOutcomes (h, culled, UNDER_SENSITIVITY) == 6);
+  CHECK (tracker.GetOutcome (h, 0) == RECEIVED);
+  CHECK (tracker.GetOutcome (h, 33) == INTERFERED);
+  CHECK (tracker.GetOutcome (h, 69) == NO_MORE_RECEIVERS);
+  CHECK (tracker.GetOutcome (h, 5) == UNDER_SENSITIVITY);
+  CHECK (tracker.GetOutcome (h, 40) == UNDER_SENSITIVITY);
+  CHECK (tracker.GetOutcome (h, 66) == UNDER_SENSITIVITY);
+  CHECK (tracker.GetOutcome (h, 1) == UNSET);
+  CHECK (tracker.GetOutcome (h, 67) == UNSET);
+
+  int counts[UNSET] = { 0, 0, 0, 0 };
+  tracker.CountOutcomes (h, counts);
+  CHECK (counts[RECEIVED] == 1 && counts[INTERFERED] == 1);
+  CHECK (counts[NO_MORE_RECEIVERS] == 1 && counts[UNDER_SENSITIVITY] == 3);
+
+  // A recycled row starts out empty
+  tracker.Erase (h);
+  h = tracker.Insert (8, 1);
+  CHECK (tracker.GetOutcomeNumber (h) == 0);
+  CHECK (tracker.GetOutcome (h, 0) == UNSET);
+  CHECK (tracker.GetOutcome (h, 66) == UNSET);
+
+  // So does its wait
+  tracker.SetWait (h, 1500000);
+  CHECK (tracker.GetWait (h) == 1500000);
+  tracker.Erase (h);
+  h = tracker.Insert (9, 1);
+  CHECK (tracker.GetWait (h) == 0);
+}
+
+static void
+CheckHistogramBuckets (void)
+{
+  const uint64_t sub = uint64_t (1) << LatencyHistogram::SUB_BITS;
+  // Buckets tile the values in order, each bounded by its high value
+  for (uint32_t b = 0; b < LatencyHistogram::BUCKETS; b++)
+    {
+      uint64_t high = LatencyHistogram::GetBucketHigh (b);
+      CHECK (LatencyHistogram::GetBucket (high) == b);
+      CHECK (b == 0 || LatencyHistogram::GetBucket (LatencyHistogram::GetBucketHigh (b - 1) + 1) == b);
+    }
+  CHECK (LatencyHistogram::GetBucketHigh (LatencyHistogram::BUCKETS - 1)
+         == (uint64_t (1) << LatencyHistogram::MAX_BITS) - 1);
+
+  // Exact below 2 * 2^SUB_BITS, within one part in 2^SUB_BITS above
+  std::mt19937_64 rng (2);
+  for (int i = 0; i < 200000; i++)
+    {
+      uint64_t value = i < 4 * int (sub) ? uint64_t (i) : rng () >> (rng () % 64);
+      value = std::min (value, (uint64_t (1) << LatencyHistogram::MAX_BITS) - 1);
+      uint32_t b = LatencyHistogram::GetBucket (value);
+      uint64_t high = LatencyHistogram::GetBucketHigh (b);
+      CHECK (b < LatencyHistogram::BUCKETS);
+      CHECK (high >= value);
+      CHECK (value < 2 * sub ? high == value : high - value < value / sub);
+    }
+
+  // Larger values are clamped to the last bucket
+  CHECK (LatencyHistogram::GetBucket (~uint64_t (0)) == LatencyHistogram::BUCKETS - 1);
+}
+
+static void
+CheckHistogramValues (void)
+{
+  std::mt19937_64 rng (3);
+  std::vector<uint64_t> samples;
+  LatencyHistogram whole, first, second;
+  // A count no quantile divides evenly, so the rank is rounded up
+  for (int i = 0; i < 100003; i++)
+    {
+      // Delays from a few microseconds to minutes, with many repeats
+      uint64_t value = uint64_t (std::exp (std::uniform_real_distribution<double> (0, 19) (rng)));
+      value = i % 5 == 0 ? 1000 : value;
+      samples.push_back (value);
+      whole.Add (value);
+      (i % 3 == 0 ? first : second).Add (value);
+    }
+  std::sort (samples.begin (), samples.end ());
+  CHECK (whole.GetCount () == samples.size ());
+  CHECK (whole.GetMax () == samples.back ());
+
+  static const double quantiles[] = { 0, 1e-5, 0.1, 0.2, 0.5, 0.9, 0.99, 0.999, 0.99999, 1 };
+  for (size_t i = 0; i < sizeof (quantiles) / sizeof (quantiles[0]); i++)
+    {
+      double q = quantiles[i];
+      size_t rank = std::max<size_t> (1, size_t (std::ceil (q * samples.size ())));
+      uint64_t exact = samples[rank - 1];
+      uint64_t value = whole.GetValueAt (q);
+      CHECK (value >= exact);
+      CHECK (value - exact <= exact >> LatencyHistogram::SUB_BITS);
+      CHECK (value <= whole.GetMax ());
+    }
+  CHECK (whole.GetValueAt (1) == whole.GetMax ());
+  CHECK (LatencyHistogram ().GetValueAt (0.5) == 0);
+
+  // Small values are exact: of 0 .. 9, 15% are at most 1, 10% at most 0
+  LatencyHistogram small;
+  for (uint64_t v = 0; v < 10; v++)
+    {
+      small.Add (v);
+    }
+  CHECK (small.GetValueAt (0.15) == 1);
+  CHECK (small.GetValueAt (0.1) == 0);
+  CHECK (small.GetValueAt (0.95) == 9);
+
+  // Merged halves are the whole
+  first.Merge (second);
+  CHECK (first.GetCount () == whole.GetCount ());
+  CHECK (first.GetMax () == whole.GetMax ());
+  CHECK (std::equal (first.GetCounts (), first.GetCounts () + LatencyHistogram::BUCKETS, whole.GetCounts ()));
+}
+
+static bool
+IsSame (const std::vector<LatencyHistogram> &a, const std::vector<LatencyHistogram> &b)
+{
+  if (a.size () != b.size ())
+    {
+      return false;
+    }
+  for (size_t h = 0; h < a.size (); h++)
+    {
+      if (a[h].GetCount () != b[h].GetCount () || a[h].GetMax () != b[h].GetMax ()
+          || !std::equal (a[h].GetCounts (), a[h].GetCounts () + LatencyHistogram::BUCKETS, b[h].GetCounts ()))
+        {
+          return false;
+        }
+    }
+  return true;
+}
+
+static void
+CheckHistogramFiles (void)
+{
+  std::ostringstream oss;
+  oss << "/tmp/nslora-check-" << getpid () << ".bin";
+  const std::string path = oss.str ();
+
+  std::mt19937_64 rng (4);
+  std::vector<LatencyHistogram> written (6);
+  for (int i = 0; i < 20000; i++)
+    {
+      written[rng () % 5].Add (rng () % 3000000);
+    }
+  CHECK (WriteHistograms (path, written));
+  CHECK (access ((path + ".tmp").c_str (), F_OK) != 0);
+
+  // Into nothing the file reads back as written, into itself it doubles
+  std::vector<LatencyHistogram> read;
+  CHECK (MergeHistograms (path, read));
+  CHECK (IsSame (read, written));
+  CHECK (MergeHistograms (path, read));
+  CHECK (read[2].GetCount () == 2 * written[2].GetCount ());
+
+  // Cut anywhere, or with a foreign header, a file changes nothing
+  FILE *f = fopen (path.c_str (), "rb");
+  std::vector<char> bytes;
+  char buffer[4096];
+  size_t n;
+  while (f != 0 && (n = fread (buffer, 1, sizeof (buffer), f)) > 0)
+    {
+      bytes.insert (bytes.end (), buffer, buffer + n);
+    }
+  if (f != 0)
+    {
+      fclose (f);
+    }
+  CHECK (bytes.size () > sizeof (HistogramFileHeader));
+  std::vector<LatencyHistogram> before = read;
+  for (size_t cut = 0; cut < bytes.size (); cut += 1 + cut / 4)
+    {
+      f = fopen (path.c_str (), "wb");
+      fwrite (bytes.data (), 1, cut, f);
+      fclose (f);
+      CHECK (!MergeHistograms (path, read));
+      CHECK (IsSame (read, before));
+    }
+  bytes[0] ^= 1;
+  f = fopen (path.c_str (), "wb");
+  fwrite (bytes.data (), 1, bytes.size (), f);
+  fclose (f);
+  CHECK (!MergeHistograms (path, read));
+  CHECK (IsSame (read, before));
+
+  unlink (path.c_str ());
+  CHECK (!MergeHistograms (path, read));
+}
+
+static void
+CheckPacketLog (void)
+{
+  std::ostringstream oss;
+  oss << "/tmp/nslora-check-" << getpid () << ".pkt";
+  const std::string path = oss.str ();
+
+  PacketLogWriter writer;
+  CHECK (writer.Open (path, 10, 3, 2));
+  for (uint32_t i = 0; i < 5; i++)
+    {
+      writer.Write (i, uint16_t (i % 3), uint8_t (i % 4), uint8_t (7 + i), 1000 * i);
+    }
+  CHECK (writer.GetRecordCount () == 5);
+  CHECK (writer.Close ());
+
+  std::vector<uint32_t> counts;
+  std::vector<uint32_t> senders;
+  bool same = true;
+  PacketLogReader reader;
+  CHECK (reader.Open (path));
+  CHECK (reader.GetHeader ().nDevices == 10 && reader.GetHeader ().nGateways == 3);
+  reader.ForEachBlock ([&] (const PacketLogBlock &b)
+    {
+      counts.push_back (b.count);
+      for (uint32_t k = 0; k < b.count; k++)
+        {
+          uint32_t i = b.sender[k];
+          senders.push_back (i);
+          same = same && b.gateway[k] == i % 3 && b.outcome[k] == i % 4
+            && b.sf[k] == 7 + i && b.sendTime[k] == 1000 * int64_t (i);
+        }
+    });
+  reader.Close ();
+  CHECK (counts == std::vector<uint32_t> ({ 2, 2, 1 }));
+  CHECK (senders == std::vector<uint32_t> ({ 0, 1, 2, 3, 4 }));
+  CHECK (same);
+
+  // Past a file size limit the second block fails: Close reports it and
+  // the first block stays readable
+  struct rlimit old;
+  getrlimit (RLIMIT_FSIZE, &old);
+  struct rlimit limit = old;
+  limit.rlim_cur = sizeof (PacketLogHeader) + 8 + 2 * 16 + 4;
+  signal (SIGXFSZ, SIG_IGN);
+  setrlimit (RLIMIT_FSIZE, &limit);
+  CHECK (writer.Open (path, 10, 3, 2));
+  for (uint32_t i = 0; i < 5; i++)
+    {
+      writer.Write (i, 0, 0, 7, 0);
+    }
+  CHECK (!writer.Close ());
+  setrlimit (RLIMIT_FSIZE, &old);
+  counts.clear ();
+  CHECK (reader.Open (path));
+  reader.ForEachBlock ([&] (const PacketLogBlock &b) { counts.push_back (b.count); });
+  reader.Close ();
+  CHECK (counts == std::vector<uint32_t> (1, 2));
+
+  // A header that cannot be written fails the open
+  CHECK (!writer.Open ("/dev/full", 10, 3, 2));
+  CHECK (writer.Close ());
+
+  unlink (path.c_str ());
+}
+
+static std::string
+ReadFile (const std::string &path)
+{
+  std::ifstream in (path.c_str ());
+  std::ostringstream oss;
+  oss << in.rdbuf ();
+  return oss.str ();
+}
+
+static size_t
+CountLines (const std::string &path)
+{
+  std::string text = ReadFile (path);
+  return std::count (text.begin (), text.end (), '\n');
+}
+
+static void
+CheckSweepResume (void)
+{
+  std::ostringstream oss;
+  oss << "/tmp/nslora-check-" << getpid ();
+  const std::string manifest = oss.str () + ".manifest";
+  const std::string csv = oss.str () + ".csv";
+  unlink (csv.c_str ());
+
+  std::vector<int> ran;
+  bool slow = true;
+  SweepRunner::RunFunction run = [&] (const SweepPoint &p)
+    {
+      // Point 2 runs until the kill, while the other worker finishes 3 to 6
+      if (slow && p.nDevices == 2)
+        {
+          sleep (60);
+        }
+      ran.push_back (p.nDevices);
+      SweepResult result;
+      result.file = csv;
+      result.row = std::to_string (p.nDevices) + "\n";
+      return result;
+    };
+  std::vector<SweepPoint> points;
+  for (int i = 1; i <= 6; i++)
+    {
+      SweepPoint p = { 0, i, 1, 10, 1.0, 1 };
+      points.push_back (p);
+    }
+
+  std::cout.flush ();
+  std::cerr.flush ();
+  pid_t pid = fork ();
+  if (pid == 0)
+    {
+      setpgid (0, 0);
+      SweepRunner sweep (run, 2, false);
+      for (size_t i = 0; i < points.size (); i++)
+        {
+          sweep.Add (points[i]);
+        }
+      sweep.SetManifest (manifest, false);
+      sweep.Run ();
+      _exit (0);
+    }
+  setpgid (pid, pid);
+  for (int t = 0; t < 200 && CountLines (manifest) < 5; t++)
+    {
+      usleep (50000);
+    }
+  // Kill the sweep and its workers, and cut a manifest line short
+  kill (-pid, SIGKILL);
+  waitpid (pid, 0, 0);
+  CHECK (CountLines (manifest) == 5);
+  CHECK (ReadFile (csv).find ('3') == std::string::npos);
+  {
+    std::ofstream fd (manifest.c_str (), std::ofstream::app);
+    fd << "0;2;1";
+  }
+
+  // Only point 2 is simulated again; the kept rows go in in sweep order
+  slow = false;
+  SweepRunner resumed (run, 1, false);
+  for (size_t i = 0; i < points.size (); i++)
+    {
+      resumed.Add (points[i]);
+    }
+  resumed.SetManifest (manifest, true);
+  CHECK (resumed.Run () == 0);
+  CHECK (ran == std::vector<int> (1, 2));
+  CHECK (ReadFile (csv) == "1\n2\n3\n4\n5\n6\n");
+  // Nothing is kept once every row is in
+  CHECK (rmdir ((manifest + ".d").c_str ()) == 0);
+
+  unlink (manifest.c_str ());
+  unlink (csv.c_str ());
+}
+
+int main (void)
+{
+  CheckTrackerWraparound ();
+  CheckTrackerRandom ();
+  CheckTrackerOutcomes ();
+  CheckHistogramBuckets ();
+  CheckHistogramValues ();
+  CheckHistogramFiles ();
+  CheckPacketLog ();
+  CheckSweepResume ();
+
+  std::cerr << (failures ? "FAILED " : "passed, ") << failures << " failed checks" << std::endl;
+  return failures > 0 ? 1 : 0;
+}
@@ -0,0 +1,290 @@
+/*
+ * nslora-coverage.h
+ *
+ * Coverage raster of a gateway layout: the RX power of the best gateway
+ * and the spreading factor SetSpreadingFactorsUp gives for it, over a
+ * square grid of cells covering the deployment disc.
+ *
+ * With a loss model that only depends on distance and never decreases
+ * with it, the best gateway is the nearest one, so a cell costs one
+ * squared distance per gateway and a single log10.  Rows are split across
+ * threads and the per-row loops are branch-free, so the compiler
+ * vectorizes them across cells.
+ *
+ *   header     CoverageHeader (64 bytes)
+ *   gateways   double[2 * nGateways], x and y of each gateway
+ *   rxPower    float[height * width], dBm, row-major from the lowest y
+ *   sf         uint8_t[height * width], 7..12, 0 out of range
+ *
+ * Cells whose center lies outside the disc have an RX power of NaN and an
+ * SF of 0.  Values are in host byte order.  nslora-log-reader prints a
+ * summary of a coverage raster.
+ */
+
+#ifndef NSLORA_COVERAGE_H
+#define NSLORA_COVERAGE_H
+
+#include "nslora-estimator.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <cmath>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <unistd.h>
+
+namespace nslora {
+
+struct CoverageParams
+{
+  uint32_t cells = 4096;                //!< per side
+  double radius = 7500;                 //!< deployment disc, m
+  double txPowerDbm = 14;
+  double pathLossExponent = 3.76;
+  double referenceLoss = 8.1;           //!< dB at the reference distance
+  double referenceDistance = 1;         //!< m
+  std::vector<double> gatewayX;
+  std::vector<double> gatewayY;
+};
+
+struct CoverageHeader
+{
+  char magic[8];
+  uint32_t version;
+  uint32_t width;
+  uint32_t height;
+  uint32_t nGateways;
+  double originX;               //!< center of the first cell, m
+  double originY;
+  double cellSize;              //!< m
+  float txPowerDbm;
+  float radius;
+  uint64_t reserved;
+};
+
+static const char COVERAGE_MAGIC[8] = { 'N', 'S', 'L', 'C', 'O', 'V', 'E', 'R' };
+static const uint32_t COVERAGE_VERSION = 1;
+
+class CoverageMap
+{
+public:
+  CoverageMap ();
+
+  /**
+   * Evaluate the raster.
+   *
+   * \param threads worker threads, 0 for one per core
+   */
+  void Compute (const CoverageParams &params, unsigned threads = 0);
+
+  /**
+   * Write the raster.  The file is written under a temporary name and
+   * renamed, so a reader never sees a partial one.
+   *
+   * \return false if the file cannot be written
+   */
+  bool Save (const std::string &path) const;
+
+  /* \return false if the file is missing, truncated or not a raster */
+  bool Load (const std::string &path);
+
+  const CoverageHeader &GetHeader (void) const;
+  const std::vector<double> &GetGateways (void) const;
+  const std::vector<float> &GetRxPower (void) const;
+  const std::vector<uint8_t> &GetSf (void) const;
+
+private:
+  /* Rows [first, last) of the raster */
+  void ComputeRows (const CoverageParams &params, uint32_t first, uint32_t last);
+
+  CoverageHeader m_header;
+  std::vector<double> m_gateways;
+  std::vector<float> m_rxPower;
+  std::vector<uint8_t> m_sf;
+};
+
+inline
+CoverageMap::CoverageMap ()
+{
+  memset (&m_header, 0, sizeof (m_header));
+}
+
+inline void
+CoverageMap::Compute (const CoverageParams &params, unsigned threads)
+{
+  uint32_t n = std::max (params.cells, 1u);
+  memset (&m_header, 0, sizeof (m_header));
+  memcpy (m_header.magic, COVERAGE_MAGIC, sizeof (m_header.magic));
+  m_header.version = COVERAGE_VERSION;
+  m_header.width = n;
+  m_header.height = n;
+  m_header.nGateways = params.gatewayX.size ();
+  m_header.cellSize = 2 * params.radius / n;
+  m_header.originX = -params.radius + m_header.cellSize / 2;
+  m_header.originY = -params.radius + m_header.cellSize / 2;
+  m_header.txPowerDbm = params.txPowerDbm;
+  m_header.radius = params.radius;
+
+  m_gateways.clear ();
+  for (size_t g = 0; g < params.gatewayX.size (); g++)
+    {
+      m_gateways.push_back (params.gatewayX[g]);
+      m_gateways.push_back (params.gatewayY[g]);
+    }
+  m_rxPower.resize (size_t (n) * n);
+  m_sf.resize (size_t (n) * n);
+
+  threads = threads ? threads : std::max (1u, std::thread::hardware_concurrency ());
+  threads = std::min (threads, n);
+  std::vector<std::thread> workers;
+  uint32_t chunk = (n + threads - 1) / threads;
+  for (uint32_t first = 0; first < n; first += chunk)
+    {
+      workers.push_back (std::thread (&CoverageMap::ComputeRows, this, std::cref (params),
+                                      first, std::min (n, first + chunk)));
+    }
+  for (size_t t = 0; t < workers.size (); t++)
+    {
+      workers[t].join ();
+    }
+}
+
+inline void
+CoverageMap::ComputeRows (const CoverageParams &params, uint32_t first, uint32_t last)
+{
+  const uint32_t w = m_header.width;
+  const size_t ng = params.gatewayX.size ();
+  const double slope = 10 * params.pathLossExponent;
+  const double base = params.txPowerDbm - params.referenceLoss + slope * std::log10 (params.referenceDistance);
+  const double minD2 = params.referenceDistance * params.referenceDistance;
+  const double r2 = params.radius * params.radius;
+  std::vector<double> x (w), best (w);
+  for (uint32_t i = 0; i < w; i++)
+    {
+      x[i] = m_header.originX + i * m_header.cellSize;
+    }
+
+  for (uint32_t row = first; row < last; row++)
+    {
+      const double y = m_header.originY + row * m_header.cellSize;
+      for (uint32_t i = 0; i < w; i++)
+        {
+          best[i] = INFINITY;
+        }
+      for (size_t g = 0; g < ng; g++)
+        {
+          const double gx = params.gatewayX[g];
+          const double dy2 = (y - params.gatewayY[g]) * (y - params.gatewayY[g]);
+          for (uint32_t i = 0; i < w; i++)
+            {
+              double dx = x[i] - gx;
+              best[i] = std::min (best[i], dx * dx + dy2);
+            }
+        }
+
+      float *rx = &m_rxPower[size_t (row) * w];
+      uint8_t *sf = &m_sf[size_t (row) * w];
+      for (uint32_t i = 0; i < w; i++)
+        {
+          double power = base - slope * 0.5 * std::log10 (std::max (best[i], minD2));
+          bool inside = x[i] * x[i] + y * y <= r2;
+          uint8_t s = 0;
+          for (int k = 5; k >= 0; k--)
+            {
+              s = power > ESTIMATOR_SF_SENSITIVITY[k] ? 7 + k : s;
+            }
+          rx[i] = inside ? float (power) : NAN;
+          sf[i] = inside ? s : 0;
+        }
+    }
+}
+
+inline bool
+CoverageMap::Save (const std::string &path) const
+{
+  std::string tmp = path + ".tmp";
+  FILE *f = fopen (tmp.c_str (), "wb");
+  if (f == 0)
+    {
+      return false;
+    }
+  bool ok = fwrite (&m_header, sizeof (m_header), 1, f) == 1
+    && fwrite (m_gateways.data (), sizeof (double), m_gateways.size (), f) == m_gateways.size ()
+    && fwrite (m_rxPower.data (), sizeof (float), m_rxPower.size (), f) == m_rxPower.size ()
+    && fwrite (m_sf.data (), 1, m_sf.size (), f) == m_sf.size ();
+  ok = fclose (f) == 0 && ok;
+  if (!ok || rename (tmp.c_str (), path.c_str ()) != 0)
+    {
+      unlink (tmp.c_str ());
+      return false;
+    }
+  return true;
+}
+
+inline bool
+CoverageMap::Load (const std::string &path)
+{
+  FILE *f = fopen (path.c_str (), "rb");
+  if (f == 0)
+    {
+      return false;
+    }
+  CoverageHeader header;
+  bool ok = fread (&header, sizeof (header), 1, f) == 1
+    && memcmp (header.magic, COVERAGE_MAGIC, sizeof (header.magic)) == 0
+    && header.version == COVERAGE_VERSION;
+  if (ok)
+    {
+      size_t cells = size_t (header.width) * header.height;
+      m_gateways.resize (2 * size_t (header.nGateways));
+      m_rxPower.resize (cells);
+      m_sf.resize (cells);
+      ok = fread (m_gateways.data (), sizeof (double), m_gateways.size (), f) == m_gateways.size ()
+        && fread (m_rxPower.data (), sizeof (float), cells, f) == cells
+        && fread (m_sf.data (), 1, cells, f) == cells;
+    }
+  fclose (f);
+  if (!ok)
+    {
+      memset (&m_header, 0, sizeof (m_header));
+      m_gateways.clear ();
+      m_rxPower.clear ();
+      m_sf.clear ();
+      return false;
+    }
+  m_header = header;
+  return true;
+}
+
+inline const CoverageHeader &
+CoverageMap::GetHeader (void) const
+{
+  return m_header;
+}
+
+inline const std::vector<double> &
+CoverageMap::GetGateways (void) const
+{
+  return m_gateways;
+}
+
+inline const std::vector<float> &
+CoverageMap::GetRxPower (void) const
+{
+  return m_rxPower;
+}
+
+inline const std::vector<uint8_t> &
+CoverageMap::GetSf (void) const
+{
+  return m_sf;
+}
+
+} // namespace nslora
+
+#endif /* NSLORA_COVERAGE_H */
@@ -0,0 +1,349 @@
+/*
+ * nslora-culled-channel.h
+ *
+ * A LoraChannel that only delivers a transmission to the end devices that
+ * could lock on it.
+ *
+ * The plain LoraChannel schedules a reception on every PHY attached to it,
+ * end devices included, so each uplink costs O(nodes) events even though
+ * almost all of them are far below sensitivity.  Once BuildIndex has been
+ * called this channel still delivers every frame to every gateway, but
+ * looks the end devices up in a uniform grid and skips those farther away
+ * than the cull range of the transmission's spreading factor.
+ *
+ * The cull range is where the received power falls below the end device
+ * sensitivity for that spreading factor, so the loss model must be
+ * deterministic and fall with distance.  EndDeviceLoraPhy drops such a
+ * frame without a state change; it only adds it to its interference
+ * helper, which judges the frames the device locks on.  Gateway outcomes
+ * are therefore the same as on the plain channel, reception paths and
+ * interference included.  What an end device misses are the culled frames
+ * in the interference of a downlink it receives: the drivers send none,
+ * and the other uplinks it locks on in its receive windows put it to sleep
+ * whether they are interfered or not.  Frames sent by gateways go to every
+ * PHY, as on the plain channel.
+ */
+
+#ifndef NSLORA_CULLED_CHANNEL_H
+#define NSLORA_CULLED_CHANNEL_H
+
+#include "ns3/lora-channel.h"
+#include "ns3/lora-net-device.h"
+#include "ns3/lora-phy.h"
+#include "ns3/end-device-lora-phy.h"
+#include "ns3/gateway-lora-phy.h"
+#include "ns3/constant-position-mobility-model.h"
+#include "ns3/node-container.h"
+#include "ns3/simulator.h"
+#include "ns3/traced-callback.h"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+namespace ns3 {
+
+class CulledLoraChannel : public LoraChannel
+{
+public:
+  static TypeId GetTypeId (void);
+
+  CulledLoraChannel ();
+  CulledLoraChannel (Ptr<PropagationLossModel> loss, Ptr<PropagationDelayModel> delay);
+
+  /**
+   * Index the PHYs of the given nodes, which must not move afterwards.
+   * Until this is called the channel behaves as a plain LoraChannel.
+   *
+   * \param nodes every node with a LoRa device on this channel
+   * \param txPowerDbm the transmission power the ranges are computed for
+   */
+  void BuildIndex (NodeContainer nodes, double txPowerDbm = 14);
+
+  /* Distance beyond which a transmission at sf is culled at end devices */
+  double GetCullRange (uint8_t sf) const;
+
+  /* Whether a transmission at sf between the two positions is culled */
+  bool IsCulled (const Vector &sender, const Vector &receiver, uint8_t sf) const;
+
+  virtual void Send (Ptr<LoraPhy> sender, Ptr<Packet> packet, double txPowerDbm,
+                     LoraTxParameters txParams, Time duration, double frequencyMHz) const;
+
+private:
+  struct Receiver
+  {
+    Ptr<LoraPhy> phy;
+    Ptr<MobilityModel> mobility;
+    Vector position;
+    uint32_t nodeId;
+  };
+
+  double ComputeRange (double thresholdDbm) const;
+  uint32_t GetCell (double x, double y) const;
+
+  Ptr<PropagationLossModel> m_cullLoss;
+  Ptr<PropagationDelayModel> m_cullDelay;
+  double m_txPowerDbm;
+  double m_range[6];                    //!< cull range for SF7..SF12
+
+  std::vector<Receiver> m_receivers;    //!< by node id
+  std::vector<uint32_t> m_gateways;     //!< receivers that are gateways
+  std::vector<uint32_t> m_cellStart;    //!< end devices of cell c are
+  std::vector<uint32_t> m_cellItems;    //!< m_cellItems[m_cellStart[c]..m_cellStart[c+1])
+  double m_minX;
+  double m_minY;
+  double m_cellSize;
+  uint32_t m_nx;
+  uint32_t m_ny;
+
+  mutable std::vector<uint32_t> m_candidates;
+
+  /* The base class fires its own, which this one shadows */
+  TracedCallback<Ptr<const Packet> > m_packetSent;
+};
+
+NS_OBJECT_ENSURE_REGISTERED (CulledLoraChannel);
+
+inline TypeId
+CulledLoraChannel::GetTypeId (void)
+{
+  static TypeId tid = TypeId ("ns3::CulledLoraChannel")
+    .SetParent<LoraChannel> ()
+    .SetGroupName ("lorawan")
+    .AddTraceSource ("PacketSent",
+                     "Trace source fired whenever a packet goes out on the channel",
+                     MakeTraceSourceAccessor (&CulledLoraChannel::m_packetSent),
+                     "ns3::Packet::TracedCallback");
+  return tid;
+}
+
+inline
+CulledLoraChannel::CulledLoraChannel ()
+  : m_txPowerDbm (14),
+    m_minX (0),
+    m_minY (0),
+    m_cellSize (0),
+    m_nx (0),
+    m_ny (0)
+{
+}
+
+inline
+CulledLoraChannel::CulledLoraChannel (Ptr<PropagationLossModel> loss, Ptr<PropagationDelayModel> delay)
+  : LoraChannel (loss, delay),
+    m_cullLoss (loss),
+    m_cullDelay (delay),
+    m_txPowerDbm (14),
+    m_minX (0),
+    m_minY (0),
+    m_cellSize (0),
+    m_nx (0),
+    m_ny (0)
+{
+}
+
+inline double
+CulledLoraChannel::ComputeRange (double thresholdDbm) const
+{
+  // Bisect the distance at which the loss model crosses the threshold, so
+  // that any monotone distance-based loss model works
+  Ptr<ConstantPositionMobilityModel> a = CreateObject<ConstantPositionMobilityModel> ();
+  Ptr<ConstantPositionMobilityModel> b = CreateObject<ConstantPositionMobilityModel> ();
+  a->SetPosition (Vector (0, 0, 0));
+  double lo = 1;
+  double hi = 1e7;
+  b->SetPosition (Vector (hi, 0, 0));
+  if (m_cullLoss->CalcRxPower (m_txPowerDbm, a, b) >= thresholdDbm)
+    {
+      return INFINITY;
+    }
+  for (int i = 0; i < 64; i++)
+    {
+      double mid = (lo + hi) / 2;
+      b->SetPosition (Vector (mid, 0, 0));
+      if (m_cullLoss->CalcRxPower (m_txPowerDbm, a, b) >= thresholdDbm)
+        {
+          lo = mid;
+        }
+      else
+        {
+          hi = mid;
+        }
+    }
+  // Err on the side of delivering
+  return hi + 1;
+}
+
+inline double
+CulledLoraChannel::GetCullRange (uint8_t sf) const
+{
+  if (sf < 7 || sf > 12 || m_cellSize == 0)
+    {
+      return INFINITY;
+    }
+  return m_range[sf - 7];
+}
+
+inline bool
+CulledLoraChannel::IsCulled (const Vector &sender, const Vector &receiver, uint8_t sf) const
+{
+  return CalculateDistance (sender, receiver) > GetCullRange (sf);
+}
+
+inline uint32_t
+CulledLoraChannel::GetCell (double x, double y) const
+{
+  double cx = std::floor ((x - m_minX) / m_cellSize);
+  double cy = std::floor ((y - m_minY) / m_cellSize);
+  cx = std::max (0.0, std::min (cx, double (m_nx - 1)));
+  cy = std::max (0.0, std::min (cy, double (m_ny - 1)));
+  return uint32_t (cy) * m_nx + uint32_t (cx);
+}
+
+inline void
+CulledLoraChannel::BuildIndex (NodeContainer nodes, double txPowerDbm)
+{
+  m_txPowerDbm = txPowerDbm;
+  for (int sf = 7; sf <= 12; sf++)
+    {
+      m_range[sf - 7] = ComputeRange (EndDeviceLoraPhy::sensitivity[sf - 7]);
+    }
+
+  m_receivers.clear ();
+  for (NodeContainer::Iterator i = nodes.Begin (); i != nodes.End (); ++i)
+    {
+      Ptr<LoraNetDevice> loraNetDevice = (*i)->GetDevice (0)->GetObject<LoraNetDevice> ();
+      NS_ASSERT (loraNetDevice != 0);
+      Receiver r;
+      r.phy = loraNetDevice->GetPhy ();
+      r.mobility = (*i)->GetObject<MobilityModel> ();
+      r.position = r.mobility->GetPosition ();
+      r.nodeId = (*i)->GetId ();
+      m_receivers.push_back (r);
+    }
+
+  // Sort by node id so that deliveries are scheduled in the same order
+  // as the plain channel, which adds PHYs as the nodes are installed
+  struct ByNodeId
+  {
+    bool operator() (const Receiver &a, const Receiver &b) const
+    {
+      return a.nodeId < b.nodeId;
+    }
+  };
+  std::stable_sort (m_receivers.begin (), m_receivers.end (), ByNodeId ());
+
+  // Only the end devices go into the grid
+  m_gateways.clear ();
+  m_minX = 0;
+  m_minY = 0;
+  std::vector<uint32_t> devices;
+  double maxX = 0;
+  double maxY = 0;
+  for (size_t r = 0; r < m_receivers.size (); r++)
+    {
+      if (m_receivers[r].phy->GetObject<GatewayLoraPhy> () != 0)
+        {
+          m_gateways.push_back (r);
+          continue;
+        }
+      const Vector &position = m_receivers[r].position;
+      if (devices.empty () || position.x < m_minX)
+        {
+          m_minX = position.x;
+        }
+      if (devices.empty () || position.y < m_minY)
+        {
+          m_minY = position.y;
+        }
+      if (devices.empty () || position.x > maxX)
+        {
+          maxX = position.x;
+        }
+      if (devices.empty () || position.y > maxY)
+        {
+          maxY = position.y;
+        }
+      devices.push_back (r);
+    }
+
+  // Half the smallest range keeps a query to a handful of cells
+  m_cellSize = std::max (100.0, std::min (m_range[0] / 2, 1e6));
+  m_nx = uint32_t ((maxX - m_minX) / m_cellSize) + 1;
+  m_ny = uint32_t ((maxY - m_minY) / m_cellSize) + 1;
+  m_cellStart.assign (size_t (m_nx) * m_ny + 1, 0);
+  for (size_t k = 0; k < devices.size (); k++)
+    {
+      const Vector &position = m_receivers[devices[k]].position;
+      m_cellStart[GetCell (position.x, position.y) + 1]++;
+    }
+  for (size_t c = 1; c < m_cellStart.size (); c++)
+    {
+      m_cellStart[c] += m_cellStart[c - 1];
+    }
+  m_cellItems.assign (devices.size (), 0);
+  std::vector<uint32_t> fill (m_cellStart.begin (), m_cellStart.end () - 1);
+  for (size_t k = 0; k < devices.size (); k++)
+    {
+      const Vector &position = m_receivers[devices[k]].position;
+      m_cellItems[fill[GetCell (position.x, position.y)]++] = devices[k];
+    }
+}
+
+inline void
+CulledLoraChannel::Send (Ptr<LoraPhy> sender, Ptr<Packet> packet, double txPowerDbm,
+                         LoraTxParameters txParams, Time duration, double frequencyMHz) const
+{
+  m_packetSent (packet);
+  double range = GetCullRange (txParams.sf);
+  if (m_receivers.empty () || txPowerDbm > m_txPowerDbm || std::isinf (range)
+      || sender->GetObject<GatewayLoraPhy> () != 0)
+    {
+      LoraChannel::Send (sender, packet, txPowerDbm, txParams, duration, frequencyMHz);
+      return;
+    }
+
+  Ptr<MobilityModel> senderMobility = sender->GetMobility ()->GetObject<MobilityModel> ();
+  Vector position = senderMobility->GetPosition ();
+
+  // Every gateway, and the end devices in range
+  m_candidates.assign (m_gateways.begin (), m_gateways.end ());
+  uint32_t x0 = GetCell (position.x - range, position.y - range) % m_nx;
+  uint32_t x1 = GetCell (position.x + range, position.y - range) % m_nx;
+  uint32_t y0 = GetCell (position.x - range, position.y - range) / m_nx;
+  uint32_t y1 = GetCell (position.x - range, position.y + range) / m_nx;
+  for (uint32_t y = y0; y <= y1 && !m_cellItems.empty (); y++)
+    {
+      for (uint32_t c = y * m_nx + x0; c <= y * m_nx + x1; c++)
+        {
+          for (uint32_t k = m_cellStart[c]; k < m_cellStart[c + 1]; k++)
+            {
+              uint32_t r = m_cellItems[k];
+              if (!IsCulled (position, m_receivers[r].position, txParams.sf))
+                {
+                  m_candidates.push_back (r);
+                }
+            }
+        }
+    }
+  std::sort (m_candidates.begin (), m_candidates.end ());
+
+  for (size_t k = 0; k < m_candidates.size (); k++)
+    {
+      const Receiver &r = m_receivers[m_candidates[k]];
+      if (r.phy == sender)
+        {
+          continue;
+        }
+      // Same delivery as LoraChannel::Send, straight to the receiving PHY
+      Time delay = m_cullDelay->GetDelay (senderMobility, r.mobility);
+      double rxPowerDbm = GetRxPower (txPowerDbm, senderMobility, r.mobility);
+      Ptr<Packet> copy = packet->Copy ();
+      Simulator::ScheduleWithContext (r.nodeId, delay, &LoraPhy::StartReceive, r.phy,
+                                      copy, rxPowerDbm, txParams.sf, duration, frequencyMHz);
+    }
+}
+
+} // namespace ns3
+
+#endif /* NSLORA_CULLED_CHANNEL_H */
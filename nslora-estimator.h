@@ -0,0 +1,274 @@
+/*
+ * nslora-estimator.h
+ *
+ * Analytical estimate of the gateway outcome probabilities of a scenario,
+ * in milliseconds rather than a full simulation.
+ *
+ * End devices are sampled uniformly over the deployment disc.  Each sample
+ * gets the spreading factor SetSpreadingFactorsUp would give it (the
+ * fastest one whose end device sensitivity the RX power at its best
+ * gateway clears, SF12 if none) and its RX power at every gateway under
+ * the log-distance model.  For each sample and gateway the outcome
+ * follows GatewayLoraPhy's order of checks:
+ *
+ *  - no more receivers if all reception paths are busy, whatever the RX
+ *    power.  Paths are only held by receptions above sensitivity that
+ *    found one free, so this is the blocking probability of an Erlang
+ *    loss system fed by those;
+ *  - under sensitivity if the RX power is below the SF's sensitivity;
+ *  - interfered unless every co-SF transmission overlapping it in pure
+ *    ALOHA fashion (a 2 * airtime window) is at least the capture
+ *    threshold weaker.  The share of co-SF devices that are not is read
+ *    from the sorted RX powers of the samples of that SF at that gateway;
+ *  - received otherwise.
+ *
+ * The PDR assumes the gateways at distinct positions decide independently.
+ * The sampling loops run over structure-of-arrays positions without
+ * branches, so they vectorize.
+ */
+
+#ifndef NSLORA_ESTIMATOR_H
+#define NSLORA_ESTIMATOR_H
+
+#include <stdint.h>
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+namespace nslora {
+
+struct EstimatorParams
+{
+  uint32_t nDevices = 100;
+  double radius = 7500;                 //!< deployment disc, m
+  double appPeriodSeconds = 10;
+  double txPowerDbm = 14;
+  double pathLossExponent = 3.76;
+  double referenceLoss = 8.1;           //!< dB at the reference distance
+  double referenceDistance = 1;         //!< m
+  uint32_t packetBytes = 19;            //!< PHY payload of an uplink
+  uint32_t receptionPaths = 8;          //!< per gateway
+  double captureDb = 6;                 //!< co-SF isolation
+  uint32_t samples = 20000;
+  uint64_t seed = 1;
+  std::vector<double> gatewayX;
+  std::vector<double> gatewayY;
+};
+
+struct Estimate
+{
+  // Share of gateway reports with each outcome
+  double received;
+  double interfered;
+  double noMoreReceivers;
+  double underSensitivity;
+  // Share of uplinks received by at least one gateway
+  double pdr;
+  // Share of end devices on SF7..SF12
+  double sfShare[6];
+};
+
+/* Gateway sensitivity for SF7..SF12, as in GatewayLoraPhy, dBm */
+static const double ESTIMATOR_SENSITIVITY[6] = { -130.0, -132.5, -135.0, -137.5, -140.0, -142.5 };
+
+/* End device sensitivity for SF7..SF12, as in EndDeviceLoraPhy, dBm.
+ * SetSpreadingFactorsUp picks the SF against these. */
+static const double ESTIMATOR_SF_SENSITIVITY[6] = { -124.0, -127.0, -130.0, -133.0, -135.0, -137.0 };
+
+/* Airtime of an uplink at sf, 125 kHz, CR 4/5, explicit header, CRC on */
+inline double
+LoraAirtime (uint32_t sf, uint32_t payloadBytes)
+{
+  double tSym = std::pow (2.0, sf) / 125000;
+  int lowDataRate = sf >= 11 ? 1 : 0;
+  double payloadSymbols = 8 + std::max (std::ceil ((8.0 * payloadBytes - 4 * sf + 28 + 16) / (4.0 * (sf - 2 * lowDataRate))) * 5, 0.0);
+  return (8 + 4.25) * tSym + payloadSymbols * tSym;
+}
+
+class AlohaEstimator
+{
+public:
+  Estimate Run (const EstimatorParams &params) const;
+
+private:
+  static double ErlangB (double load, uint32_t servers);
+};
+
+inline double
+AlohaEstimator::ErlangB (double load, uint32_t servers)
+{
+  double blocking = 1;
+  for (uint32_t k = 1; k <= servers; k++)
+    {
+      blocking = load * blocking / (k + load * blocking);
+    }
+  return blocking;
+}
+
+inline Estimate
+AlohaEstimator::Run (const EstimatorParams &p) const
+{
+  Estimate e = Estimate ();
+  const size_t m = p.samples;
+  const size_t ng = p.gatewayX.size ();
+  if (m == 0 || ng == 0)
+    {
+      return e;
+    }
+
+  // Uniform samples over the disc
+  std::vector<double> x (m), y (m);
+  uint64_t state = p.seed * 0x9e3779b97f4a7c15ULL + 1;
+  for (size_t i = 0; i < m; i++)
+    {
+      state ^= state >> 12;
+      state ^= state << 25;
+      state ^= state >> 27;
+      uint64_t bits = state * 0x2545f4914f6cdd1dULL;
+      double u = (bits >> 11) * (1.0 / 9007199254740992.0);
+      double v = (uint32_t (bits) >> 8) * (1.0 / 16777216.0);
+      double rho = p.radius * std::sqrt (u);
+      double theta = 2 * M_PI * v;
+      x[i] = rho * std::cos (theta);
+      y[i] = rho * std::sin (theta);
+    }
+
+  // RX power of every sample at every gateway, gateway-major
+  std::vector<float> rx (m * ng);
+  const double slope = 10 * p.pathLossExponent;
+  const double base = p.txPowerDbm - p.referenceLoss + slope * std::log10 (p.referenceDistance);
+  for (size_t g = 0; g < ng; g++)
+    {
+      const double gx = p.gatewayX[g];
+      const double gy = p.gatewayY[g];
+      float *row = &rx[g * m];
+      for (size_t i = 0; i < m; i++)
+        {
+          double dx = x[i] - gx;
+          double dy = y[i] - gy;
+          double d2 = std::max (dx * dx + dy * dy, p.referenceDistance * p.referenceDistance);
+          row[i] = float (base - slope * 0.5 * std::log10 (d2));
+        }
+    }
+
+  // Spreading factor from the best gateway
+  std::vector<uint8_t> sf (m);
+  std::vector<float> best (m, -INFINITY);
+  for (size_t g = 0; g < ng; g++)
+    {
+      const float *row = &rx[g * m];
+      for (size_t i = 0; i < m; i++)
+        {
+          best[i] = std::max (best[i], row[i]);
+        }
+    }
+  uint32_t sfCount[6] = { 0, 0, 0, 0, 0, 0 };
+  for (size_t i = 0; i < m; i++)
+    {
+      uint8_t s = 12;
+      for (int k = 5; k >= 0; k--)
+        {
+          s = best[i] > ESTIMATOR_SF_SENSITIVITY[k] ? 7 + k : s;
+        }
+      sf[i] = s;
+      sfCount[s - 7]++;
+    }
+
+  double airtime[6], devices[6];
+  for (int k = 0; k < 6; k++)
+    {
+      airtime[k] = LoraAirtime (7 + k, p.packetBytes);
+      devices[k] = double (p.nDevices) * sfCount[k] / m;
+      e.sfShare[k] = double (sfCount[k]) / m;
+    }
+
+  std::vector<double> pReceived (m * ng);
+  double reports[4] = { 0, 0, 0, 0 };
+  for (size_t g = 0; g < ng; g++)
+    {
+      const float *row = &rx[g * m];
+
+      // Offered load of the devices above sensitivity at this gateway, in
+      // receptions in progress
+      double load = 0;
+      std::vector<std::vector<float> > bySf (6);
+      for (size_t i = 0; i < m; i++)
+        {
+          int k = sf[i] - 7;
+          bySf[k].push_back (row[i]);
+          if (row[i] >= ESTIMATOR_SENSITIVITY[k])
+            {
+              load += airtime[k] / p.appPeriodSeconds;
+            }
+        }
+      load *= double (p.nDevices) / m;
+      double pBusy = ErlangB (load, p.receptionPaths);
+      for (int k = 0; k < 6; k++)
+        {
+          std::sort (bySf[k].begin (), bySf[k].end ());
+        }
+
+      for (size_t i = 0; i < m; i++)
+        {
+          int k = sf[i] - 7;
+          double r = 0;
+          // The gateway looks for a free path before it checks the power
+          reports[2] += pBusy;
+          if (row[i] < ESTIMATOR_SENSITIVITY[k])
+            {
+              reports[3] += 1 - pBusy;
+            }
+          else
+            {
+              // Co-SF devices strong enough to destroy this packet
+              const std::vector<float> &same = bySf[k];
+              size_t stronger = same.end () - std::lower_bound (same.begin (), same.end (),
+                                                                float (row[i] - p.captureDb));
+              double share = same.size () > 1 ? double (stronger - 1) / (same.size () - 1) : 0;
+              double overlap = 2 * airtime[k] / p.appPeriodSeconds;
+              double clean = std::exp (-(devices[k] - 1) * overlap * std::max (share, 0.0));
+              reports[1] += (1 - pBusy) * (1 - clean);
+              r = (1 - pBusy) * clean;
+              reports[0] += r;
+            }
+          pReceived[g * m + i] = r;
+        }
+    }
+
+  double total = double (m) * ng;
+  e.received = reports[0] / total;
+  e.interfered = reports[1] / total;
+  e.noMoreReceivers = reports[2] / total;
+  e.underSensitivity = reports[3] / total;
+
+  // Gateways at one position see the same outcomes, count them once
+  std::vector<size_t> distinct;
+  for (size_t g = 0; g < ng; g++)
+    {
+      bool seen = false;
+      for (size_t h = 0; h < distinct.size (); h++)
+        {
+          seen = seen || (p.gatewayX[distinct[h]] == p.gatewayX[g] && p.gatewayY[distinct[h]] == p.gatewayY[g]);
+        }
+      if (!seen)
+        {
+          distinct.push_back (g);
+        }
+    }
+  double pdr = 0;
+  for (size_t i = 0; i < m; i++)
+    {
+      double missed = 1;
+      for (size_t h = 0; h < distinct.size (); h++)
+        {
+          missed *= 1 - pReceived[distinct[h] * m + i];
+        }
+      pdr += 1 - missed;
+    }
+  e.pdr = pdr / m;
+  return e;
+}
+
+} // namespace nslora
+
+#endif /* NSLORA_ESTIMATOR_H */
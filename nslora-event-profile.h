@@ -0,0 +1,455 @@
+/*
+ * nslora-event-profile.h
+ *
+ * Per event type profile of the simulator hot loop.
+ *
+ * EventProfilingScheduler wraps the scheduler the simulator would use and
+ * reports every event it hands out for execution to an EventProfile.  The
+ * simulator invokes an event right after taking it from the scheduler and
+ * takes the next one right after it returns, so the wall-clock time
+ * between two RemoveNext calls is charged to the first event, including
+ * the events it schedules itself.
+ *
+ * Events are told apart by the dynamic type of their EventImpl, the
+ * closure class MakeEvent instantiates for the signature of the function
+ * the event calls, and by the kind of node they run on, from their context
+ * and the node id ranges given to SetNodeKinds (ED, GW or NS).  The kind
+ * separates the receptions of gateways from those of end devices, which
+ * share the signature of LoraPhy::StartReceive.  Functions of one
+ * signature on one kind of node, such as the receive window callbacks of
+ * EndDeviceLoraMac, are counted together.  Types are named after the
+ * signature.  Counts and times are kept per simulated second.
+ */
+
+#ifndef NSLORA_EVENT_PROFILE_H
+#define NSLORA_EVENT_PROFILE_H
+
+#include "ns3/scheduler.h"
+#include "ns3/event-impl.h"
+#include "ns3/nstime.h"
+#include "ns3/object-factory.h"
+
+#include <stdint.h>
+#include <algorithm>
+#include <chrono>
+#include <ostream>
+#include <string>
+#include <typeindex>
+#include <typeinfo>
+#include <unordered_map>
+#include <vector>
+
+#include <cxxabi.h>
+#include <stdlib.h>
+
+namespace nslora {
+
+class EventProfile
+{
+public:
+  EventProfile ();
+
+  void Clear (void);
+
+  /* Only events handed out between Start and Stop are profiled */
+  void Start (void);
+  void Stop (void);
+  bool IsRunning (void) const;
+
+  /**
+   * Tell the kinds of nodes apart by id: end devices below firstGateway,
+   * gateways below firstServer and network servers from there on.
+   */
+  void SetNodeKinds (uint32_t firstGateway, uint32_t firstServer);
+
+  /* An event with timestamp ts (in time steps) is about to run on context */
+  void Begin (ns3::EventImpl *impl, uint64_t ts, uint32_t context);
+
+  uint64_t GetEventCount (void) const;
+
+  /**
+   * Write the totals per event type, most expensive first, then the count
+   * and time of every type in every simulated second, as ;-separated
+   * tables.
+   */
+  void Write (std::ostream &os) const;
+
+private:
+  typedef std::chrono::steady_clock Clock;
+
+  struct Cell
+  {
+    uint64_t count;
+    double seconds;
+  };
+
+  struct Key
+  {
+    std::type_index type;
+    uint8_t kind;
+
+    bool operator== (const Key &other) const
+    {
+      return type == other.type && kind == other.kind;
+    }
+  };
+
+  struct KeyHash
+  {
+    size_t operator() (const Key &key) const
+    {
+      return key.type.hash_code () * 31 + key.kind;
+    }
+  };
+
+  void End (Clock::time_point now);
+  uint8_t GetKind (uint32_t context) const;
+  uint32_t GetType (ns3::EventImpl *impl, uint32_t context);
+  static std::string GetTypeName (const std::type_info &type);
+
+  std::unordered_map<Key, uint32_t, KeyHash> m_types;
+  std::vector<std::string> m_names;
+  uint32_t m_firstGateway;
+  uint32_t m_firstServer;
+  std::vector<std::vector<Cell> > m_cells;      //!< by simulated second, then type
+  int64_t m_stepsPerSecond;
+  bool m_running;
+  bool m_open;
+  uint32_t m_type;
+  uint32_t m_second;
+  Clock::time_point m_start;
+};
+
+inline
+EventProfile::EventProfile ()
+  : m_firstGateway (0),
+    m_firstServer (0),
+    m_stepsPerSecond (1),
+    m_running (false),
+    m_open (false),
+    m_type (0),
+    m_second (0)
+{
+  Clear ();
+}
+
+inline void
+EventProfile::Clear (void)
+{
+  m_types.clear ();
+  m_names.assign (1, "[cancelled]");
+  m_cells.clear ();
+  m_running = false;
+  m_open = false;
+}
+
+inline void
+EventProfile::SetNodeKinds (uint32_t firstGateway, uint32_t firstServer)
+{
+  m_firstGateway = firstGateway;
+  m_firstServer = firstServer;
+}
+
+inline void
+EventProfile::Start (void)
+{
+  m_stepsPerSecond = ns3::Seconds (1).GetTimeStep ();
+  m_running = true;
+  m_open = false;
+}
+
+inline void
+EventProfile::Stop (void)
+{
+  End (Clock::now ());
+  m_running = false;
+}
+
+inline bool
+EventProfile::IsRunning (void) const
+{
+  return m_running;
+}
+
+inline void
+EventProfile::End (Clock::time_point now)
+{
+  if (!m_open)
+    {
+      return;
+    }
+  Cell &cell = m_cells[m_second][m_type];
+  cell.count++;
+  cell.seconds += std::chrono::duration<double> (now - m_start).count ();
+  m_open = false;
+}
+
+inline void
+EventProfile::Begin (ns3::EventImpl *impl, uint64_t ts, uint32_t context)
+{
+  Clock::time_point now = Clock::now ();
+  End (now);
+  m_type = impl->IsCancelled () ? 0 : GetType (impl, context);
+  m_second = ts / m_stepsPerSecond;
+  if (m_second >= m_cells.size ())
+    {
+      m_cells.resize (m_second + 1);
+    }
+  if (m_type >= m_cells[m_second].size ())
+    {
+      Cell zero = { 0, 0 };
+      m_cells[m_second].resize (m_names.size (), zero);
+    }
+  m_open = true;
+  // Leave the bookkeeping above out of the event's time
+  m_start = Clock::now ();
+}
+
+inline uint8_t
+EventProfile::GetKind (uint32_t context) const
+{
+  // Context 0xffffffff is Simulator::NO_CONTEXT
+  return context == 0xffffffff ? 0 : context < m_firstGateway ? 1 : context < m_firstServer ? 2 : 3;
+}
+
+inline uint32_t
+EventProfile::GetType (ns3::EventImpl *impl, uint32_t context)
+{
+  static const char *kinds[4] = { "-", "ED", "GW", "NS" };
+  const std::type_info &type = typeid (*impl);
+  Key key = { std::type_index (type), GetKind (context) };
+  std::unordered_map<Key, uint32_t, KeyHash>::const_iterator it = m_types.find (key);
+  if (it != m_types.end ())
+    {
+      return it->second;
+    }
+  uint32_t index = m_names.size ();
+  m_names.push_back (std::string (kinds[key.kind]) + " " + GetTypeName (type));
+  m_types[key] = index;
+  return index;
+}
+
+inline std::string
+EventProfile::GetTypeName (const std::type_info &type)
+{
+  int status = 0;
+  char *demangled = abi::__cxa_demangle (type.name (), 0, 0, &status);
+  std::string name = status == 0 ? demangled : type.name ();
+  free (demangled);
+
+  // The first template argument of MakeEvent is the function it calls
+  std::string::size_type start = name.find ("MakeEvent<");
+  if (start != std::string::npos)
+    {
+      start += 10;
+      int depth = 0;
+      std::string::size_type end = start;
+      for (; end < name.size (); end++)
+        {
+          char c = name[end];
+          if (c == '<' || c == '(')
+            {
+              depth++;
+            }
+          else if (c == '>' || c == ')')
+            {
+              if (depth == 0)
+                {
+                  break;
+                }
+              depth--;
+            }
+          else if (c == ',' && depth == 0)
+            {
+              break;
+            }
+        }
+      name = name.substr (start, end - start);
+    }
+
+  std::string::size_type ns;
+  while ((ns = name.find ("ns3::")) != std::string::npos)
+    {
+      name.erase (ns, 5);
+    }
+  return name;
+}
+
+inline uint64_t
+EventProfile::GetEventCount (void) const
+{
+  uint64_t count = 0;
+  for (size_t s = 0; s < m_cells.size (); s++)
+    {
+      for (size_t t = 0; t < m_cells[s].size (); t++)
+        {
+          count += m_cells[s][t].count;
+        }
+    }
+  return count;
+}
+
+inline void
+EventProfile::Write (std::ostream &os) const
+{
+  std::vector<Cell> total (m_names.size ());
+  for (size_t t = 0; t < total.size (); t++)
+    {
+      total[t].count = 0;
+      total[t].seconds = 0;
+    }
+  for (size_t s = 0; s < m_cells.size (); s++)
+    {
+      for (size_t t = 0; t < m_cells[s].size (); t++)
+        {
+          total[t].count += m_cells[s][t].count;
+          total[t].seconds += m_cells[s][t].seconds;
+        }
+    }
+  std::vector<uint32_t> order;
+  for (uint32_t t = 0; t < total.size (); t++)
+    {
+      if (total[t].count > 0)
+        {
+          order.push_back (t);
+        }
+    }
+  std::sort (order.begin (), order.end (), [&total] (uint32_t a, uint32_t b)
+    {
+      return total[a].seconds > total[b].seconds;
+    });
+
+  os << "type;events;seconds;nsPerEvent" << std::endl;
+  for (size_t i = 0; i < order.size (); i++)
+    {
+      const Cell &c = total[order[i]];
+      os << m_names[order[i]] << ";" << c.count << ";" << c.seconds << ";" << c.seconds * 1e9 / c.count << std::endl;
+    }
+
+  os << std::endl << "second;type;events;seconds" << std::endl;
+  for (size_t s = 0; s < m_cells.size (); s++)
+    {
+      for (size_t i = 0; i < order.size (); i++)
+        {
+          if (order[i] < m_cells[s].size () && m_cells[s][order[i]].count > 0)
+            {
+              const Cell &c = m_cells[s][order[i]];
+              os << s << ";" << m_names[order[i]] << ";" << c.count << ";" << c.seconds << std::endl;
+            }
+        }
+    }
+}
+
+} // namespace nslora
+
+namespace ns3 {
+
+class EventProfilingScheduler : public Scheduler
+{
+public:
+  static TypeId GetTypeId (void);
+
+  EventProfilingScheduler ();
+
+  /**
+   * Make the schedulers created from now on report to profile and wrap a
+   * scheduler of the given type.  The simulator creates its scheduler
+   * from a type name, so this is process-wide.
+   */
+  static void Configure (nslora::EventProfile *profile, const std::string &inner = "ns3::MapScheduler");
+
+  virtual void Insert (const Event &ev);
+  virtual bool IsEmpty (void) const;
+  virtual Event PeekNext (void) const;
+  virtual Event RemoveNext (void);
+  virtual void Remove (const Event &ev);
+
+private:
+  static nslora::EventProfile *&GetProfile (void);
+  static std::string &GetInnerType (void);
+
+  Ptr<Scheduler> m_inner;
+  nslora::EventProfile *m_profile;
+};
+
+NS_OBJECT_ENSURE_REGISTERED (EventProfilingScheduler);
+
+inline TypeId
+EventProfilingScheduler::GetTypeId (void)
+{
+  static TypeId tid = TypeId ("ns3::EventProfilingScheduler")
+    .SetParent<Scheduler> ()
+    .SetGroupName ("Core")
+    .AddConstructor<EventProfilingScheduler> ();
+  return tid;
+}
+
+inline nslora::EventProfile *&
+EventProfilingScheduler::GetProfile (void)
+{
+  static nslora::EventProfile *profile = 0;
+  return profile;
+}
+
+inline std::string &
+EventProfilingScheduler::GetInnerType (void)
+{
+  static std::string inner = "ns3::MapScheduler";
+  return inner;
+}
+
+inline void
+EventProfilingScheduler::Configure (nslora::EventProfile *profile, const std::string &inner)
+{
+  GetProfile () = profile;
+  GetInnerType () = inner;
+}
+
+inline
+EventProfilingScheduler::EventProfilingScheduler ()
+  : m_profile (GetProfile ())
+{
+  ObjectFactory factory;
+  factory.SetTypeId (GetInnerType ());
+  m_inner = factory.Create<Scheduler> ();
+}
+
+inline void
+EventProfilingScheduler::Insert (const Event &ev)
+{
+  m_inner->Insert (ev);
+}
+
+inline bool
+EventProfilingScheduler::IsEmpty (void) const
+{
+  return m_inner->IsEmpty ();
+}
+
+inline Scheduler::Event
+EventProfilingScheduler::PeekNext (void) const
+{
+  return m_inner->PeekNext ();
+}
+
+inline Scheduler::Event
+EventProfilingScheduler::RemoveNext (void)
+{
+  Event ev = m_inner->RemoveNext ();
+  // The simulator also drains the queue this way when it is destroyed
+  if (m_profile != 0 && m_profile->IsRunning ())
+    {
+      m_profile->Begin (ev.impl, ev.key.m_ts, ev.key.m_context);
+    }
+  return ev;
+}
+
+inline void
+EventProfilingScheduler::Remove (const Event &ev)
+{
+  m_inner->Remove (ev);
+}
+
+} // namespace ns3
+
+#endif /* NSLORA_EVENT_PROFILE_H */
@@ -0,0 +1,244 @@
+/*
+ * nslora-hex-grid.h
+ *
+ * Hexagonal gateway layout of any number of rings.
+ *
+ * Ring 1 is the centre site alone and ring k adds 6 (k - 1) sites around
+ * it, so r rings hold 3r^2 - 3r + 1 sites, the nGateways of NsLoraSim.
+ * Sites are laid out pointy-top at a configurable inter-site distance and
+ * handed out centre first, then ring by ring.
+ *
+ * Sites are addressed by axial coordinates (q, r).  Mapping a point to
+ * axial coordinates and rounding in cube space gives the hexagon, and so
+ * the site, it is nearest to, which GetNearest looks up in a table: O(1)
+ * for any point inside the layout.  Points outside it are compared against
+ * the outer ring only.
+ */
+
+#ifndef NSLORA_HEX_GRID_H
+#define NSLORA_HEX_GRID_H
+
+#include "ns3/position-allocator.h"
+
+#include <cmath>
+#include <cstdlib>
+#include <vector>
+
+namespace ns3 {
+
+class HexGridPositionAllocator : public PositionAllocator
+{
+public:
+  static TypeId GetTypeId (void);
+
+  HexGridPositionAllocator ();
+
+  /* Number of rings, 1 for a single site */
+  void SetRings (uint32_t rings);
+  /* Distance between neighbouring sites, m */
+  void SetDistance (double distance);
+  void SetCenter (const Vector &center);
+
+  uint32_t GetN (void) const;
+  Vector GetPosition (uint32_t index) const;
+
+  /* Index of the site nearest to (x, y) */
+  uint32_t GetNearest (double x, double y) const;
+
+  virtual Vector GetNext (void) const;
+  virtual int64_t AssignStreams (int64_t stream);
+
+private:
+  void Build (void);
+  int32_t Lookup (int q, int r) const;
+
+  uint32_t m_rings;
+  double m_distance;
+  Vector m_center;
+
+  std::vector<Vector> m_sites;
+  std::vector<int> m_q;
+  std::vector<int> m_r;
+  std::vector<int32_t> m_table;   //!< site index by axial coordinates, -1 if none
+  int m_span;                     //!< side of m_table, 2 * rings - 1
+  mutable uint32_t m_next;
+};
+
+NS_OBJECT_ENSURE_REGISTERED (HexGridPositionAllocator);
+
+inline TypeId
+HexGridPositionAllocator::GetTypeId (void)
+{
+  static TypeId tid = TypeId ("ns3::HexGridPositionAllocator")
+    .SetParent<PositionAllocator> ()
+    .SetGroupName ("Mobility")
+    .AddConstructor<HexGridPositionAllocator> ();
+  return tid;
+}
+
+inline
+HexGridPositionAllocator::HexGridPositionAllocator ()
+  : m_rings (1),
+    m_distance (5000),
+    m_center (0, 0, 0),
+    m_span (1),
+    m_next (0)
+{
+  Build ();
+}
+
+inline void
+HexGridPositionAllocator::SetRings (uint32_t rings)
+{
+  m_rings = rings > 0 ? rings : 1;
+  Build ();
+}
+
+inline void
+HexGridPositionAllocator::SetDistance (double distance)
+{
+  m_distance = distance;
+  Build ();
+}
+
+inline void
+HexGridPositionAllocator::SetCenter (const Vector &center)
+{
+  m_center = center;
+  Build ();
+}
+
+inline void
+HexGridPositionAllocator::Build (void)
+{
+  m_sites.clear ();
+  m_q.clear ();
+  m_r.clear ();
+  m_next = 0;
+  m_span = 2 * m_rings - 1;
+  m_table.assign (size_t (m_span) * m_span, -1);
+
+  // Ring k + 1 starts k steps out in direction 4 and walks k steps along
+  // each of the six directions
+  static const int dirQ[6] = { 1, 1, 0, -1, -1, 0 };
+  static const int dirR[6] = { 0, -1, -1, 0, 1, 1 };
+  m_q.push_back (0);
+  m_r.push_back (0);
+  for (int k = 1; k < int (m_rings); k++)
+    {
+      int q = dirQ[4] * k;
+      int r = dirR[4] * k;
+      for (int side = 0; side < 6; side++)
+        {
+          for (int step = 0; step < k; step++)
+            {
+              m_q.push_back (q);
+              m_r.push_back (r);
+              q += dirQ[side];
+              r += dirR[side];
+            }
+        }
+    }
+
+  const double s3 = std::sqrt (3.0);
+  for (size_t i = 0; i < m_q.size (); i++)
+    {
+      // Pointy-top: neighbours along q are m_distance apart on the x axis
+      double x = m_distance * (m_q[i] + m_r[i] / 2.0);
+      double y = m_distance * (s3 / 2.0) * m_r[i];
+      m_sites.push_back (Vector (m_center.x + x, m_center.y + y, m_center.z));
+      int off = int (m_rings) - 1;
+      m_table[size_t (m_r[i] + off) * m_span + (m_q[i] + off)] = i;
+    }
+}
+
+inline int32_t
+HexGridPositionAllocator::Lookup (int q, int r) const
+{
+  int off = int (m_rings) - 1;
+  if (q + off < 0 || q + off >= m_span || r + off < 0 || r + off >= m_span)
+    {
+      return -1;
+    }
+  return m_table[size_t (r + off) * m_span + (q + off)];
+}
+
+inline uint32_t
+HexGridPositionAllocator::GetN (void) const
+{
+  return m_sites.size ();
+}
+
+inline Vector
+HexGridPositionAllocator::GetPosition (uint32_t index) const
+{
+  return m_sites[index];
+}
+
+inline uint32_t
+HexGridPositionAllocator::GetNearest (double x, double y) const
+{
+  const double s3 = std::sqrt (3.0);
+  double px = (x - m_center.x) / m_distance;
+  double py = (y - m_center.y) / m_distance;
+
+  // Fractional axial coordinates, rounded in cube space
+  double fr = py * 2.0 / s3;
+  double fq = px - fr / 2.0;
+  double fs = -fq - fr;
+  double rq = std::round (fq);
+  double rr = std::round (fr);
+  double rs = std::round (fs);
+  double dq = std::fabs (rq - fq);
+  double dr = std::fabs (rr - fr);
+  double ds = std::fabs (rs - fs);
+  if (dq > dr && dq > ds)
+    {
+      rq = -rr - rs;
+    }
+  else if (dr > ds)
+    {
+      rr = -rq - rs;
+    }
+  int32_t site = Lookup (int (rq), int (rr));
+  if (site >= 0)
+    {
+      return site;
+    }
+
+  // Outside the layout the nearest site is on the outer ring
+  uint32_t first = m_rings > 1 ? 3 * (m_rings - 1) * (m_rings - 1) - 3 * (m_rings - 1) + 1 : 0;
+  uint32_t best = first;
+  double bestD2 = INFINITY;
+  for (uint32_t i = first; i < m_sites.size (); i++)
+    {
+      double ddx = m_sites[i].x - x;
+      double ddy = m_sites[i].y - y;
+      double d2 = ddx * ddx + ddy * ddy;
+      if (d2 < bestD2)
+        {
+          bestD2 = d2;
+          best = i;
+        }
+    }
+  return best;
+}
+
+inline Vector
+HexGridPositionAllocator::GetNext (void) const
+{
+  Vector v = m_sites[m_next];
+  m_next = (m_next + 1) % m_sites.size ();
+  return v;
+}
+
+inline int64_t
+HexGridPositionAllocator::AssignStreams (int64_t)
+{
+  // The layout draws no random numbers
+  return 0;
+}
+
+} // namespace ns3
+
+#endif /* NSLORA_HEX_GRID_H */
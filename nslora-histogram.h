@@ -0,0 +1,326 @@
+/*
+ * nslora-histogram.h
+ *
+ * Fixed-memory log-linear latency histogram, after HdrHistogram.
+ *
+ * Values are non-negative integers, microseconds for delays.  Values
+ * below 2 * 2^SUB_BITS get a bucket each; above, every power of two is
+ * split into 2^SUB_BITS buckets, so any value is known to within one part
+ * in 2^SUB_BITS (under 1%) and the whole range up to 2^MAX_BITS takes
+ * BUCKETS counters.  Adding a value is a count leading zeros, a shift and
+ * an increment.  Histograms of the same layout merge by adding their
+ * counters, so the histograms of parallel runs combine without keeping
+ * their samples.
+ *
+ * A histogram file holds several histograms, sparsely:
+ *
+ *   file header   HistogramFileHeader (32 bytes)
+ *   histograms    nHistograms times:
+ *                   uint64_t max, uint32_t nBuckets used, uint32_t reserved
+ *                   HistogramBucket[nBuckets used] (16 bytes each)
+ *
+ * Values are in host byte order.  nslora-log-reader merges histogram
+ * files and prints their percentiles.
+ */
+
+#ifndef NSLORA_HISTOGRAM_H
+#define NSLORA_HISTOGRAM_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cmath>
+#include <string>
+#include <vector>
+
+namespace nslora {
+
+class LatencyHistogram
+{
+public:
+  static const uint32_t SUB_BITS = 7;
+  static const uint32_t MAX_BITS = 40;  //!< larger values are clamped
+  static const uint32_t BUCKETS = (MAX_BITS - SUB_BITS + 1) << SUB_BITS;
+
+  LatencyHistogram ();
+
+  void Reset (void);
+  void Add (uint64_t value);
+  void Merge (const LatencyHistogram &other);
+
+  uint64_t GetCount (void) const;
+  uint64_t GetMax (void) const;
+
+  /**
+   * The smallest value that at least a share q of the values do not
+   * exceed, to the precision of its bucket.  Never more than GetMax.
+   */
+  uint64_t GetValueAt (double q) const;
+
+  const uint64_t *GetCounts (void) const;
+  /* Replace the counters with BUCKETS counts, as from another histogram */
+  void Assign (const uint64_t *counts, uint64_t max);
+
+  static uint32_t GetBucket (uint64_t value);
+  /* The largest value of a bucket */
+  static uint64_t GetBucketHigh (uint32_t bucket);
+
+private:
+  std::vector<uint64_t> m_counts;
+  uint64_t m_count;
+  uint64_t m_max;
+};
+
+struct HistogramFileHeader
+{
+  char magic[8];
+  uint32_t version;
+  uint32_t subBits;
+  uint32_t maxBits;
+  uint32_t nHistograms;
+  uint64_t reserved;
+};
+
+struct HistogramBucket
+{
+  uint64_t index;
+  uint64_t count;
+};
+
+static const char HISTOGRAM_MAGIC[8] = { 'N', 'S', 'L', 'H', 'I', 'S', 'T', 'O' };
+static const uint32_t HISTOGRAM_VERSION = 1;
+
+inline
+LatencyHistogram::LatencyHistogram ()
+{
+  Reset ();
+}
+
+inline void
+LatencyHistogram::Reset (void)
+{
+  m_counts.assign (BUCKETS, 0);
+  m_count = 0;
+  m_max = 0;
+}
+
+inline uint32_t
+LatencyHistogram::GetBucket (uint64_t value)
+{
+  const uint64_t sub = uint64_t (1) << SUB_BITS;
+  value = std::min (value, (uint64_t (1) << MAX_BITS) - 1);
+  if (value < 2 * sub)
+    {
+      return uint32_t (value);
+    }
+  // The top SUB_BITS + 1 bits of the value pick the bucket
+  uint32_t shift = 63 - __builtin_clzll (value) - SUB_BITS;
+  return uint32_t ((shift + 1) * sub + ((value >> shift) - sub));
+}
+
+inline uint64_t
+LatencyHistogram::GetBucketHigh (uint32_t bucket)
+{
+  const uint64_t sub = uint64_t (1) << SUB_BITS;
+  if (bucket < 2 * sub)
+    {
+      return bucket;
+    }
+  uint32_t shift = bucket / sub - 1;
+  return ((sub + bucket % sub + 1) << shift) - 1;
+}
+
+inline void
+LatencyHistogram::Add (uint64_t value)
+{
+  m_counts[GetBucket (value)]++;
+  m_count++;
+  m_max = std::max (m_max, value);
+}
+
+inline void
+LatencyHistogram::Merge (const LatencyHistogram &other)
+{
+  for (uint32_t b = 0; b < BUCKETS; b++)
+    {
+      m_counts[b] += other.m_counts[b];
+    }
+  m_count += other.m_count;
+  m_max = std::max (m_max, other.m_max);
+}
+
+inline uint64_t
+LatencyHistogram::GetCount (void) const
+{
+  return m_count;
+}
+
+inline uint64_t
+LatencyHistogram::GetMax (void) const
+{
+  return m_max;
+}
+
+inline uint64_t
+LatencyHistogram::GetValueAt (double q) const
+{
+  if (m_count == 0)
+    {
+      return 0;
+    }
+  uint64_t rank = std::max<uint64_t> (1, uint64_t (std::ceil (q * m_count)));
+  uint64_t seen = 0;
+  for (uint32_t b = 0; b < BUCKETS; b++)
+    {
+      seen += m_counts[b];
+      if (seen >= rank)
+        {
+          return std::min (GetBucketHigh (b), m_max);
+        }
+    }
+  return m_max;
+}
+
+inline const uint64_t *
+LatencyHistogram::GetCounts (void) const
+{
+  return &m_counts[0];
+}
+
+inline void
+LatencyHistogram::Assign (const uint64_t *counts, uint64_t max)
+{
+  m_count = 0;
+  for (uint32_t b = 0; b < BUCKETS; b++)
+    {
+      m_counts[b] = counts[b];
+      m_count += counts[b];
+    }
+  m_max = max;
+}
+
+/**
+ * Write histograms to path.  The file is written under a temporary name
+ * and renamed, so a reader never sees a partial one.
+ *
+ * \return false if the file cannot be written
+ */
+inline bool
+WriteHistograms (const std::string &path, const std::vector<LatencyHistogram> &histograms)
+{
+  std::string tmp = path + ".tmp";
+  FILE *f = fopen (tmp.c_str (), "wb");
+  if (f == 0)
+    {
+      return false;
+    }
+  HistogramFileHeader header;
+  memset (&header, 0, sizeof (header));
+  memcpy (header.magic, HISTOGRAM_MAGIC, sizeof (header.magic));
+  header.version = HISTOGRAM_VERSION;
+  header.subBits = LatencyHistogram::SUB_BITS;
+  header.maxBits = LatencyHistogram::MAX_BITS;
+  header.nHistograms = histograms.size ();
+  bool ok = fwrite (&header, sizeof (header), 1, f) == 1;
+
+  std::vector<HistogramBucket> used;
+  for (size_t h = 0; h < histograms.size () && ok; h++)
+    {
+      const uint64_t *counts = histograms[h].GetCounts ();
+      used.clear ();
+      for (uint32_t b = 0; b < LatencyHistogram::BUCKETS; b++)
+        {
+          if (counts[b] > 0)
+            {
+              HistogramBucket bucket = { b, counts[b] };
+              used.push_back (bucket);
+            }
+        }
+      uint64_t max = histograms[h].GetMax ();
+      uint32_t n[2] = { uint32_t (used.size ()), 0 };
+      ok = fwrite (&max, sizeof (max), 1, f) == 1
+        && fwrite (n, sizeof (n), 1, f) == 1
+        && fwrite (used.data (), sizeof (HistogramBucket), used.size (), f) == used.size ();
+    }
+  ok = fclose (f) == 0 && ok;
+  if (!ok || rename (tmp.c_str (), path.c_str ()) != 0)
+    {
+      unlink (tmp.c_str ());
+      return false;
+    }
+  return true;
+}
+
+/**
+ * Merge the histograms of a file into histograms, which is resized to
+ * hold as many as the file has.  The file is read whole before anything
+ * is merged, so histograms is left unchanged when it fails.
+ *
+ * \return false if the file is missing, truncated, not a histogram file
+ * or of another layout
+ */
+inline bool
+MergeHistograms (const std::string &path, std::vector<LatencyHistogram> &histograms)
+{
+  FILE *f = fopen (path.c_str (), "rb");
+  if (f == 0)
+    {
+      return false;
+    }
+  HistogramFileHeader header;
+  bool ok = fread (&header, sizeof (header), 1, f) == 1
+    && memcmp (header.magic, HISTOGRAM_MAGIC, sizeof (header.magic)) == 0
+    && header.version == HISTOGRAM_VERSION
+    && header.subBits == LatencyHistogram::SUB_BITS
+    && header.maxBits == LatencyHistogram::MAX_BITS;
+
+  std::vector<LatencyHistogram> file;
+  std::vector<uint64_t> counts (LatencyHistogram::BUCKETS);
+  std::vector<HistogramBucket> used;
+  for (uint32_t h = 0; ok && h < header.nHistograms; h++)
+    {
+      uint64_t max;
+      uint32_t n[2];
+      ok = fread (&max, sizeof (max), 1, f) == 1 && fread (n, sizeof (n), 1, f) == 1
+        && n[0] <= LatencyHistogram::BUCKETS;
+      if (!ok)
+        {
+          break;
+        }
+      used.resize (n[0]);
+      ok = fread (used.data (), sizeof (HistogramBucket), used.size (), f) == used.size ();
+      std::fill (counts.begin (), counts.end (), 0);
+      for (size_t i = 0; ok && i < used.size (); i++)
+        {
+          ok = used[i].index < LatencyHistogram::BUCKETS;
+          counts[ok ? used[i].index : 0] += used[i].count;
+        }
+      if (ok)
+        {
+          file.push_back (LatencyHistogram ());
+          file.back ().Assign (&counts[0], max);
+        }
+    }
+  fclose (f);
+  if (!ok)
+    {
+      return false;
+    }
+
+  if (histograms.size () < file.size ())
+    {
+      histograms.resize (file.size ());
+    }
+  for (size_t h = 0; h < file.size (); h++)
+    {
+      histograms[h].Merge (file[h]);
+    }
+  return true;
+}
+
+} // namespace nslora
+
+#endif /* NSLORA_HISTOGRAM_H */
@@ -0,0 +1,284 @@
+/*
+ * nslora-log-reader.cc
+ *
+ * Aggregates a binary packet log written by nslora-sim --packetLog=1.
+ *
+ * Usage: nslora-log-reader <pkt-*.bin> [--devices]
+ *        nslora-log-reader <trace-*.bin>
+ *        nslora-log-reader <coverage-*.bin>
+ *        nslora-log-reader <traffic file>
+ *        nslora-log-reader <lat-*.bin>...
+ *
+ * Prints outcome totals, per-gateway and per-SF outcome tables and, with
+ * --devices, one outcome row per end device.  Given an event trace written
+ * with --trace, prints its records one per line instead.  Given a coverage
+ * raster written with --coverage, prints the share of the disc each SF
+ * covers.  Given a traffic file for --traffic, prints its length and the
+ * busiest devices and seconds.  Given delay histograms written with
+ * --latency, merges them and prints the delay percentiles per SF.
+ */
+
+#include "nslora-coverage.h"
+#include "nslora-histogram.h"
+#include "nslora-packet-log.h"
+#include "nslora-packet-tracker.h"
+#include "nslora-trace-log.h"
+#include "nslora-traffic.h"
+
+#include <algorithm>
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+using namespace nslora;
+
+static const char *outcomeNames[UNSET] = { "received", "interfered", "noMoreReceivers", "underSensitivity" };
+
+struct OutcomeCounts
+{
+  uint64_t n[UNSET];
+};
+
+static void
+PrintHeader (std::ostream &os, const char *key)
+{
+  os << key;
+  for (int o = 0; o < UNSET; o++)
+    {
+      os << ";" << outcomeNames[o];
+    }
+  os << ";pdr" << std::endl;
+}
+
+static void
+PrintRow (std::ostream &os, uint64_t key, const OutcomeCounts &c)
+{
+  uint64_t total = 0;
+  os << key;
+  for (int o = 0; o < UNSET; o++)
+    {
+      os << ";" << c.n[o];
+      total += c.n[o];
+    }
+  os << ";" << (total ? double (c.n[RECEIVED]) / total : 0.0) << std::endl;
+}
+
+static void
+PrintTrace (const TraceLogReader &trace)
+{
+  static const char *eventNames[TRACE_EVENTS] = { "transmit", "outcome" };
+  std::cout << "time;node;event;outcome;uid;arg" << std::endl;
+  const TraceRecord *r = trace.GetRecords ();
+  for (size_t i = 0; i < trace.GetRecordCount (); i++)
+    {
+      std::cout << r[i].time << ";" << r[i].node << ";"
+                << (r[i].event < TRACE_EVENTS ? eventNames[r[i].event] : "?") << ";"
+                << (r[i].event == TRACE_OUTCOME && r[i].outcome < UNSET ? outcomeNames[r[i].outcome] : "") << ";"
+                << r[i].uid << ";" << r[i].arg << "\n";
+    }
+}
+
+static void
+PrintCoverage (const CoverageMap &map)
+{
+  const CoverageHeader &h = map.GetHeader ();
+  const std::vector<float> &rx = map.GetRxPower ();
+  const std::vector<uint8_t> &sf = map.GetSf ();
+  uint64_t cells[13] = { 0 };
+  uint64_t inside = 0;
+  for (size_t i = 0; i < sf.size (); i++)
+    {
+      // NaN marks the cells outside the disc
+      bool in = rx[i] == rx[i];
+      inside += in;
+      cells[sf[i] < 13 ? sf[i] : 0] += in;
+    }
+  std::cout << "# " << h.width << "x" << h.height << " cells of " << h.cellSize << " m, "
+            << h.nGateways << " gateways, radius " << h.radius << " m" << std::endl;
+  std::cout << "sf;cells;share" << std::endl;
+  for (int s = 7; s <= 12; s++)
+    {
+      std::cout << s << ";" << cells[s] << ";" << (inside ? double (cells[s]) / inside : 0.0) << std::endl;
+    }
+  std::cout << "none;" << cells[0] << ";" << (inside ? double (cells[0]) / inside : 0.0) << std::endl;
+}
+
+static void
+PrintTraffic (const TrafficFileReader &traffic)
+{
+  const TrafficRecord *r = traffic.GetRecords ();
+  size_t n = traffic.GetRecordCount ();
+  std::vector<uint64_t> perDevice (traffic.GetHeader ().nDevices, 0);
+  std::vector<uint64_t> perSecond;
+  uint64_t bytes = 0;
+  for (size_t i = 0; i < n; i++)
+    {
+      if (r[i].device < perDevice.size ())
+        {
+          perDevice[r[i].device]++;
+        }
+      size_t second = r[i].time > 0 ? size_t (r[i].time / 1000000000) : 0;
+      if (second >= perSecond.size ())
+        {
+          perSecond.resize (second + 1, 0);
+        }
+      perSecond[second]++;
+      bytes += r[i].size;
+    }
+  std::cout << "# " << n << " uplinks, " << bytes << " bytes, " << perDevice.size () << " devices, "
+            << (n ? r[n - 1].time / 1e9 : 0.0) << " s" << std::endl;
+  std::cout << "peak uplinks per second;" << (perSecond.empty () ? 0 : *std::max_element (perSecond.begin (), perSecond.end ())) << std::endl;
+  std::cout << "peak uplinks per device;" << (perDevice.empty () ? 0 : *std::max_element (perDevice.begin (), perDevice.end ())) << std::endl;
+}
+
+static void
+PrintLatency (const std::vector<LatencyHistogram> &histograms)
+{
+  LatencyHistogram all;
+  std::cout << "sf;packets;p50;p90;p99;p999;max" << std::endl;
+  for (size_t i = 0; i <= histograms.size (); i++)
+    {
+      const LatencyHistogram &h = i < histograms.size () ? histograms[i] : all;
+      if (i < histograms.size ())
+        {
+          std::cout << 7 + i;
+          all.Merge (h);
+        }
+      else
+        {
+          std::cout << "all";
+        }
+      std::cout << ";" << h.GetCount () << ";" << h.GetValueAt (0.5) / 1e6 << ";" << h.GetValueAt (0.9) / 1e6
+                << ";" << h.GetValueAt (0.99) / 1e6 << ";" << h.GetValueAt (0.999) / 1e6 << ";" << h.GetMax () / 1e6 << std::endl;
+    }
+}
+
+int main (int argc, char *argv[])
+{
+  if (argc < 2)
+    {
+      std::cerr << "usage: " << argv[0] << " <pkt-*.bin> [--devices]" << std::endl;
+      return 2;
+    }
+  bool devices = argc > 2 && std::string (argv[2]) == "--devices";
+
+  TraceLogReader trace;
+  if (trace.Open (argv[1]))
+    {
+      PrintTrace (trace);
+      return 0;
+    }
+
+  std::vector<LatencyHistogram> histograms;
+  if (MergeHistograms (argv[1], histograms))
+    {
+      // Runs of one sweep merge into the delays of all of them
+      for (int i = 2; i < argc; i++)
+        {
+          if (!MergeHistograms (argv[i], histograms))
+            {
+              std::cerr << argv[i] << ": not a delay histogram" << std::endl;
+              return 1;
+            }
+        }
+      PrintLatency (histograms);
+      return 0;
+    }
+
+  TrafficFileReader traffic;
+  if (traffic.Open (argv[1]))
+    {
+      PrintTraffic (traffic);
+      return 0;
+    }
+
+  CoverageMap coverage;
+  if (coverage.Load (argv[1]))
+    {
+      PrintCoverage (coverage);
+      return 0;
+    }
+
+  PacketLogReader reader;
+  if (!reader.Open (argv[1]))
+    {
+      std::cerr << argv[1] << ": not a packet log" << std::endl;
+      return 1;
+    }
+  const PacketLogHeader &header = reader.GetHeader ();
+
+  OutcomeCounts zero = { { 0, 0, 0, 0 } };
+  OutcomeCounts total = zero;
+  std::vector<OutcomeCounts> perGateway (header.nGateways, zero);
+  std::vector<OutcomeCounts> perSf (13, zero);
+  std::vector<OutcomeCounts> perDevice (devices ? header.nDevices : 0, zero);
+  uint64_t records = 0;
+  int64_t lastSend = 0;
+
+  // Column-at-a-time passes keep each loop on one or two contiguous arrays
+  reader.ForEachBlock ([&] (const PacketLogBlock &b)
+    {
+      records += b.count;
+      for (uint32_t i = 0; i < b.count; i++)
+        {
+          uint8_t o = b.outcome[i] & 3;
+          total.n[o]++;
+          if (b.gateway[i] < header.nGateways)
+            {
+              perGateway[b.gateway[i]].n[o]++;
+            }
+        }
+      for (uint32_t i = 0; i < b.count; i++)
+        {
+          if (b.sf[i] < perSf.size ())
+            {
+              perSf[b.sf[i]].n[b.outcome[i] & 3]++;
+            }
+        }
+      if (devices)
+        {
+          for (uint32_t i = 0; i < b.count; i++)
+            {
+              if (b.sender[i] < perDevice.size ())
+                {
+                  perDevice[b.sender[i]].n[b.outcome[i] & 3]++;
+                }
+            }
+        }
+      for (uint32_t i = 0; i < b.count; i++)
+        {
+          lastSend = b.sendTime[i] > lastSend ? b.sendTime[i] : lastSend;
+        }
+    });
+
+  std::cout << "# " << records << " records, " << header.nDevices << " devices, "
+            << header.nGateways << " gateways, last send " << lastSend / 1e9 << " s" << std::endl;
+  PrintHeader (std::cout, "all");
+  PrintRow (std::cout, records, total);
+
+  std::cout << std::endl;
+  PrintHeader (std::cout, "gateway");
+  for (size_t g = 0; g < perGateway.size (); g++)
+    {
+      PrintRow (std::cout, g, perGateway[g]);
+    }
+
+  std::cout << std::endl;
+  PrintHeader (std::cout, "sf");
+  for (size_t sf = 7; sf < perSf.size (); sf++)
+    {
+      PrintRow (std::cout, sf, perSf[sf]);
+    }
+
+  if (devices)
+    {
+      std::cout << std::endl;
+      PrintHeader (std::cout, "device");
+      for (size_t d = 0; d < perDevice.size (); d++)
+        {
+          PrintRow (std::cout, d, perDevice[d]);
+        }
+    }
+  return 0;
+}
@@ -0,0 +1,351 @@
+/*
+ * nslora-packet-log.h
+ *
+ * Binary per-packet outcome log.
+ *
+ * One record is written for every outcome a gateway reports on an uplink:
+ * sender node, gateway index, outcome, send time and spreading factor.
+ * Records are stored column-wise in fixed-width blocks so the reader can
+ * scan a column without touching the others:
+ *
+ *   file header   PacketLogHeader (32 bytes)
+ *   block         uint32 count, uint32 reserved,
+ *                 int64  sendTime[count]   (nanoseconds)
+ *                 uint32 sender[count]     (node id of the end device)
+ *                 uint16 gateway[count]    (gateway index)
+ *                 uint8  outcome[count]    (PacketOutcome)
+ *                 uint8  sf[count]
+ *   block ...
+ *
+ * Every block but the last holds blockRecords records.  Values are in host
+ * byte order.  The writer stops at the first failed write and Close
+ * reports it; the records before it stay readable.
+ */
+
+#ifndef NSLORA_PACKET_LOG_H
+#define NSLORA_PACKET_LOG_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace nslora {
+
+struct PacketLogHeader
+{
+  char magic[8];
+  uint32_t version;
+  uint32_t blockRecords;
+  uint32_t nDevices;
+  uint32_t nGateways;
+  uint64_t reserved;
+};
+
+static const char PACKET_LOG_MAGIC[8] = { 'N', 'S', 'L', 'P', 'K', 'T', 'L', 'G' };
+static const uint32_t PACKET_LOG_VERSION = 1;
+
+/**
+ * A view of one block of records inside a mapped log.
+ */
+struct PacketLogBlock
+{
+  uint32_t count;
+  const int64_t *sendTime;
+  const uint32_t *sender;
+  const uint16_t *gateway;
+  const uint8_t *outcome;
+  const uint8_t *sf;
+};
+
+class PacketLogWriter
+{
+public:
+  PacketLogWriter ();
+  ~PacketLogWriter ();
+
+  /**
+   * Create the log file, truncating any previous one.
+   *
+   * \return false if the file cannot be created
+   */
+  bool Open (const std::string &path, uint32_t nDevices, uint32_t nGateways,
+             uint32_t blockRecords = 65536);
+
+  void Write (uint32_t sender, uint16_t gateway, uint8_t outcome, uint8_t sf, int64_t sendTime);
+
+  /**
+   * Write the last, partial block and close the file.
+   *
+   * \return false if any write since Open failed, in which case the file
+   *         holds the blocks before the failure
+   */
+  bool Close (void);
+
+  uint64_t GetRecordCount (void) const;
+
+private:
+  PacketLogWriter (const PacketLogWriter &);
+  PacketLogWriter &operator= (const PacketLogWriter &);
+
+  void FlushBlock (void);
+
+  FILE *m_file;
+  bool m_failed;                //!< a write failed, later ones are skipped
+  uint32_t m_blockRecords;
+  uint32_t m_count;
+  uint64_t m_records;
+
+  std::vector<int64_t> m_sendTime;
+  std::vector<uint32_t> m_sender;
+  std::vector<uint16_t> m_gateway;
+  std::vector<uint8_t> m_outcome;
+  std::vector<uint8_t> m_sf;
+};
+
+class PacketLogReader
+{
+public:
+  PacketLogReader ();
+  ~PacketLogReader ();
+
+  /**
+   * Map a log file read-only.
+   *
+   * \return false if the file cannot be mapped or is not a packet log
+   */
+  bool Open (const std::string &path);
+  void Close (void);
+
+  const PacketLogHeader &GetHeader (void) const;
+
+  /**
+   * Call f (const PacketLogBlock &) for every complete block in the file.
+   * A block cut short by a crashed writer is skipped.
+   */
+  template <typename F>
+  void ForEachBlock (F f) const;
+
+private:
+  PacketLogReader (const PacketLogReader &);
+  PacketLogReader &operator= (const PacketLogReader &);
+
+  const uint8_t *m_data;
+  size_t m_size;
+  PacketLogHeader m_header;
+};
+
+inline
+PacketLogWriter::PacketLogWriter ()
+  : m_file (0),
+    m_failed (false),
+    m_blockRecords (0),
+    m_count (0),
+    m_records (0)
+{
+}
+
+inline
+PacketLogWriter::~PacketLogWriter ()
+{
+  Close ();
+}
+
+inline bool
+PacketLogWriter::Open (const std::string &path, uint32_t nDevices, uint32_t nGateways,
+                       uint32_t blockRecords)
+{
+  Close ();
+  m_file = fopen (path.c_str (), "wb");
+  if (m_file == 0)
+    {
+      return false;
+    }
+  // Whole blocks are handed to fwrite, stdio buffering would only copy them
+  setvbuf (m_file, 0, _IONBF, 0);
+
+  PacketLogHeader header;
+  memset (&header, 0, sizeof (header));
+  memcpy (header.magic, PACKET_LOG_MAGIC, sizeof (header.magic));
+  header.version = PACKET_LOG_VERSION;
+  header.blockRecords = blockRecords;
+  header.nDevices = nDevices;
+  header.nGateways = nGateways;
+  if (fwrite (&header, sizeof (header), 1, m_file) != 1)
+    {
+      fclose (m_file);
+      m_file = 0;
+      return false;
+    }
+  m_failed = false;
+
+  m_blockRecords = blockRecords;
+  m_count = 0;
+  m_records = 0;
+  m_sendTime.resize (blockRecords);
+  m_sender.resize (blockRecords);
+  m_gateway.resize (blockRecords);
+  m_outcome.resize (blockRecords);
+  m_sf.resize (blockRecords);
+  return true;
+}
+
+inline void
+PacketLogWriter::Write (uint32_t sender, uint16_t gateway, uint8_t outcome, uint8_t sf, int64_t sendTime)
+{
+  m_sendTime[m_count] = sendTime;
+  m_sender[m_count] = sender;
+  m_gateway[m_count] = gateway;
+  m_outcome[m_count] = outcome;
+  m_sf[m_count] = sf;
+  m_records++;
+  if (++m_count == m_blockRecords)
+    {
+      FlushBlock ();
+    }
+}
+
+inline void
+PacketLogWriter::FlushBlock (void)
+{
+  if (m_count == 0 || m_failed)
+    {
+      m_count = 0;
+      return;
+    }
+  uint32_t head[2] = { m_count, 0 };
+  m_failed = !(fwrite (head, sizeof (head), 1, m_file) == 1
+               && fwrite (&m_sendTime[0], sizeof (int64_t), m_count, m_file) == m_count
+               && fwrite (&m_sender[0], sizeof (uint32_t), m_count, m_file) == m_count
+               && fwrite (&m_gateway[0], sizeof (uint16_t), m_count, m_file) == m_count
+               && fwrite (&m_outcome[0], sizeof (uint8_t), m_count, m_file) == m_count
+               && fwrite (&m_sf[0], sizeof (uint8_t), m_count, m_file) == m_count);
+  m_count = 0;
+}
+
+inline bool
+PacketLogWriter::Close (void)
+{
+  if (m_file == 0)
+    {
+      return true;
+    }
+  FlushBlock ();
+  bool ok = fclose (m_file) == 0 && !m_failed;
+  m_file = 0;
+  return ok;
+}
+
+inline uint64_t
+PacketLogWriter::GetRecordCount (void) const
+{
+  return m_records;
+}
+
+inline
+PacketLogReader::PacketLogReader ()
+  : m_data (0),
+    m_size (0)
+{
+  memset (&m_header, 0, sizeof (m_header));
+}
+
+inline
+PacketLogReader::~PacketLogReader ()
+{
+  Close ();
+}
+
+inline bool
+PacketLogReader::Open (const std::string &path)
+{
+  Close ();
+  int fd = open (path.c_str (), O_RDONLY);
+  if (fd < 0)
+    {
+      return false;
+    }
+  struct stat st;
+  if (fstat (fd, &st) != 0 || size_t (st.st_size) < sizeof (PacketLogHeader))
+    {
+      close (fd);
+      return false;
+    }
+  void *data = mmap (0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close (fd);
+  if (data == MAP_FAILED)
+    {
+      return false;
+    }
+  madvise (data, st.st_size, MADV_SEQUENTIAL);
+  m_data = static_cast<const uint8_t *> (data);
+  m_size = st.st_size;
+
+  memcpy (&m_header, m_data, sizeof (m_header));
+  if (memcmp (m_header.magic, PACKET_LOG_MAGIC, sizeof (m_header.magic)) != 0
+      || m_header.version != PACKET_LOG_VERSION)
+    {
+      Close ();
+      return false;
+    }
+  return true;
+}
+
+inline void
+PacketLogReader::Close (void)
+{
+  if (m_data != 0)
+    {
+      munmap (const_cast<uint8_t *> (m_data), m_size);
+      m_data = 0;
+      m_size = 0;
+    }
+}
+
+inline const PacketLogHeader &
+PacketLogReader::GetHeader (void) const
+{
+  return m_header;
+}
+
+template <typename F>
+void
+PacketLogReader::ForEachBlock (F f) const
+{
+  size_t offset = sizeof (PacketLogHeader);
+  while (offset + 2 * sizeof (uint32_t) <= m_size)
+    {
+      const uint32_t *head = reinterpret_cast<const uint32_t *> (m_data + offset);
+      uint32_t count = head[0];
+      size_t bytes = 2 * sizeof (uint32_t) + size_t (count) * 16;
+      if (count == 0 || offset + bytes > m_size)
+        {
+          return;
+        }
+      const uint8_t *p = m_data + offset + 2 * sizeof (uint32_t);
+      PacketLogBlock block;
+      block.count = count;
+      block.sendTime = reinterpret_cast<const int64_t *> (p);
+      p += count * sizeof (int64_t);
+      block.sender = reinterpret_cast<const uint32_t *> (p);
+      p += count * sizeof (uint32_t);
+      block.gateway = reinterpret_cast<const uint16_t *> (p);
+      p += count * sizeof (uint16_t);
+      block.outcome = p;
+      p += count;
+      block.sf = p;
+      f (block);
+      offset += bytes;
+    }
+}
+
+} // namespace nslora
+
+#endif /* NSLORA_PACKET_LOG_H */
@@ -0,0 +1,515 @@
+/*
+ * nslora-packet-tracker.h
+ *
+ * Per-packet gateway outcome tracker used by the scenario drivers.
+ *
+ * Packets in flight are kept in an open-addressing hash table keyed by the
+ * packet UID (copies made by the channel keep the UID of the original).
+ * The per-gateway outcomes of an entry live in a fixed-size row of a pooled
+ * arena: a 2-bit outcome code per gateway followed by a bitmask of the
+ * gateways that have reported.  Freed rows are recycled through a free
+ * list, so once the table and arena have grown to the in-flight working
+ * set, insert, update and erase do not allocate.
+ *
+ * Entries remember their send time so that packets which will never get
+ * an outcome from every gateway can be evicted, and the tracker keeps
+ * high-water marks of its size and memory for sizing long runs.
+ */
+
+#ifndef NSLORA_PACKET_TRACKER_H
+#define NSLORA_PACKET_TRACKER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+namespace nslora {
+
+enum PacketOutcome {
+  RECEIVED,
+  INTERFERED,
+  NO_MORE_RECEIVERS,
+  UNDER_SENSITIVITY,
+  UNSET
+};
+
+class PacketTracker
+{
+public:
+  typedef uint32_t Handle;
+
+  /* Returned by Find when the packet is not tracked */
+  static const Handle NONE = 0xffffffff;
+
+  PacketTracker ();
+
+  /**
+   * Forget every tracked packet and size the tracker for a new run.
+   *
+   * \param nGateways the number of outcomes kept per packet
+   * \param expected the number of packets expected in flight at once
+   */
+  void Reset (uint32_t nGateways, uint32_t expected = 1024);
+
+  /**
+   * Start tracking a packet.  If the UID is already tracked the existing
+   * entry is returned unchanged.
+   *
+   * \param sendTime the transmission time, in simulator time steps
+   */
+  Handle Insert (uint64_t uid, uint32_t senderId, int64_t sendTime = 0);
+  Handle Find (uint64_t uid) const;
+
+  /**
+   * Record the outcome of a packet at a gateway.
+   *
+   * \return the number of outcomes reported so far for this packet
+   */
+  uint32_t SetOutcome (Handle h, uint32_t gateway, enum PacketOutcome outcome);
+
+  /**
+   * Record the same outcome for every gateway set in a bitmask of
+   * (nGateways + 63) / 64 words, a word at a time.
+   *
+   * \return the number of outcomes reported so far for this packet
+   */
+  uint32_t SetOutcomes (Handle h, const uint64_t *gateways, enum PacketOutcome outcome);
+  enum PacketOutcome GetOutcome (Handle h, uint32_t gateway) const;
+
+  /**
+   * Add the reported outcomes of a packet to counts, which is indexed by
+   * PacketOutcome and must hold UNSET elements.
+   */
+  void CountOutcomes (Handle h, int *counts) const;
+
+  uint32_t GetOutcomeNumber (Handle h) const;
+  uint32_t GetSenderId (Handle h) const;
+  uint64_t GetUid (Handle h) const;
+  int64_t GetSendTime (Handle h) const;
+
+  /* Time the packet waited at its end device before the send, in microseconds */
+  void SetWait (Handle h, uint32_t wait);
+  uint32_t GetWait (Handle h) const;
+
+  /**
+   * Stop tracking a packet.  Handles of other entries may be invalidated.
+   */
+  void Erase (Handle h);
+
+  /**
+   * Erase every packet sent before cutoff, adding the outcomes reported
+   * so far to counts as CountOutcomes does.
+   *
+   * \return the number of evicted packets
+   */
+  uint32_t Evict (int64_t cutoff, int *counts);
+
+  uint32_t GetSize (void) const;
+  /* Largest number of packets tracked at once since Reset */
+  uint32_t GetPeakSize (void) const;
+  /* Bytes currently held by the table and the arena */
+  size_t GetMemory (void) const;
+  /* Largest GetMemory () since Reset */
+  size_t GetPeakMemory (void) const;
+
+private:
+  static const uint64_t EMPTY = ~uint64_t (0);
+  static const uint32_t NO_ROW = 0xffffffff;
+
+  struct Entry
+  {
+    uint64_t uid;
+    int64_t sendTime;
+    uint32_t senderId;
+    uint32_t row;
+    uint32_t outcomeNumber;
+    uint32_t wait;
+  };
+
+  static uint64_t Hash (uint64_t uid);
+  static uint64_t Spread (uint32_t bits);
+  uint32_t AllocateRow (void);
+  void FreeRow (uint32_t row);
+  uint64_t *GetRow (uint32_t row);
+  const uint64_t *GetRow (uint32_t row) const;
+  void Grow (void);
+  void UpdatePeakMemory (void);
+
+  uint32_t m_nGateways;
+  uint32_t m_codeWords;     //!< words of 2-bit outcome codes per row
+  uint32_t m_rowWords;      //!< code words plus reported-mask words
+
+  std::vector<Entry> m_table;
+  uint32_t m_mask;
+  uint32_t m_size;
+
+  std::vector<uint64_t> m_arena;
+  uint32_t m_rows;          //!< rows handed out from the arena so far
+  uint32_t m_freeRow;       //!< head of the free row list
+
+  uint32_t m_peakSize;
+  size_t m_peakMemory;
+};
+
+inline
+PacketTracker::PacketTracker ()
+  : m_nGateways (0),
+    m_codeWords (0),
+    m_rowWords (1),
+    m_mask (0),
+    m_size (0),
+    m_rows (0),
+    m_freeRow (NO_ROW),
+    m_peakSize (0),
+    m_peakMemory (0)
+{
+}
+
+inline void
+PacketTracker::Reset (uint32_t nGateways, uint32_t expected)
+{
+  m_nGateways = nGateways;
+  m_codeWords = (2 * nGateways + 63) / 64;
+  m_rowWords = m_codeWords + (nGateways + 63) / 64;
+  if (m_rowWords == 0)
+    {
+      m_rowWords = 1;
+    }
+
+  // Keep the table at most half full
+  uint32_t capacity = 16;
+  while (capacity < 2 * expected)
+    {
+      capacity *= 2;
+    }
+  Entry empty = { EMPTY, 0, 0, NO_ROW, 0, 0 };
+  m_table.assign (capacity, empty);
+  m_mask = capacity - 1;
+  m_size = 0;
+
+  m_arena.assign (size_t (expected) * m_rowWords, 0);
+  m_rows = 0;
+  m_freeRow = NO_ROW;
+
+  m_peakSize = 0;
+  m_peakMemory = 0;
+  UpdatePeakMemory ();
+}
+
+inline uint64_t
+PacketTracker::Hash (uint64_t uid)
+{
+  // splitmix64 finalizer: UIDs are sequential, spread them over the table
+  uid ^= uid >> 30;
+  uid *= 0xbf58476d1ce4e5b9ULL;
+  uid ^= uid >> 27;
+  uid *= 0x94d049bb133111ebULL;
+  uid ^= uid >> 31;
+  return uid;
+}
+
+inline uint64_t *
+PacketTracker::GetRow (uint32_t row)
+{
+  return &m_arena[size_t (row) * m_rowWords];
+}
+
+inline const uint64_t *
+PacketTracker::GetRow (uint32_t row) const
+{
+  return &m_arena[size_t (row) * m_rowWords];
+}
+
+inline uint32_t
+PacketTracker::AllocateRow (void)
+{
+  uint32_t row;
+  if (m_freeRow != NO_ROW)
+    {
+      // Free rows are linked through their first word
+      row = m_freeRow;
+      m_freeRow = uint32_t (GetRow (row)[0]);
+    }
+  else
+    {
+      if (size_t (m_rows + 1) * m_rowWords > m_arena.size ())
+        {
+          m_arena.resize (m_arena.size () * 2 + m_rowWords, 0);
+          UpdatePeakMemory ();
+        }
+      row = m_rows++;
+    }
+  uint64_t *words = GetRow (row);
+  for (uint32_t w = 0; w < m_rowWords; w++)
+    {
+      words[w] = 0;
+    }
+  return row;
+}
+
+inline void
+PacketTracker::FreeRow (uint32_t row)
+{
+  GetRow (row)[0] = m_freeRow;
+  m_freeRow = row;
+}
+
+inline void
+PacketTracker::Grow (void)
+{
+  std::vector<Entry> old;
+  old.swap (m_table);
+  Entry empty = { EMPTY, 0, 0, NO_ROW, 0, 0 };
+  m_table.assign (old.empty () ? 16 : old.size () * 2, empty);
+  m_mask = m_table.size () - 1;
+  for (size_t i = 0; i < old.size (); i++)
+    {
+      if (old[i].uid == EMPTY)
+        {
+          continue;
+        }
+      uint32_t slot = Hash (old[i].uid) & m_mask;
+      while (m_table[slot].uid != EMPTY)
+        {
+          slot = (slot + 1) & m_mask;
+        }
+      m_table[slot] = old[i];
+    }
+  UpdatePeakMemory ();
+}
+
+inline PacketTracker::Handle
+PacketTracker::Insert (uint64_t uid, uint32_t senderId, int64_t sendTime)
+{
+  if (2 * (m_size + 1) > m_table.size ())
+    {
+      Grow ();
+    }
+  uint32_t slot = Hash (uid) & m_mask;
+  while (m_table[slot].uid != EMPTY)
+    {
+      if (m_table[slot].uid == uid)
+        {
+          return slot;
+        }
+      slot = (slot + 1) & m_mask;
+    }
+  Entry &e = m_table[slot];
+  e.uid = uid;
+  e.sendTime = sendTime;
+  e.senderId = senderId;
+  e.row = AllocateRow ();
+  e.outcomeNumber = 0;
+  e.wait = 0;
+  m_size++;
+  if (m_size > m_peakSize)
+    {
+      m_peakSize = m_size;
+    }
+  return slot;
+}
+
+inline PacketTracker::Handle
+PacketTracker::Find (uint64_t uid) const
+{
+  if (m_table.empty ())
+    {
+      return NONE;
+    }
+  uint32_t slot = Hash (uid) & m_mask;
+  while (m_table[slot].uid != EMPTY)
+    {
+      if (m_table[slot].uid == uid)
+        {
+          return slot;
+        }
+      slot = (slot + 1) & m_mask;
+    }
+  return NONE;
+}
+
+inline uint32_t
+PacketTracker::SetOutcome (Handle h, uint32_t gateway, enum PacketOutcome outcome)
+{
+  Entry &e = m_table[h];
+  uint64_t *words = GetRow (e.row);
+  uint64_t &code = words[gateway / 32];
+  uint32_t shift = 2 * (gateway % 32);
+  code = (code & ~(uint64_t (3) << shift)) | (uint64_t (outcome & 3) << shift);
+  words[m_codeWords + gateway / 64] |= uint64_t (1) << (gateway % 64);
+  return ++e.outcomeNumber;
+}
+
+inline uint64_t
+PacketTracker::Spread (uint32_t bits)
+{
+  // Move bit i to bit 2i, the low bit of the i-th 2-bit code
+  uint64_t x = bits;
+  x = (x | (x << 16)) & 0x0000ffff0000ffffULL;
+  x = (x | (x << 8)) & 0x00ff00ff00ff00ffULL;
+  x = (x | (x << 4)) & 0x0f0f0f0f0f0f0f0fULL;
+  x = (x | (x << 2)) & 0x3333333333333333ULL;
+  x = (x | (x << 1)) & 0x5555555555555555ULL;
+  return x;
+}
+
+inline uint32_t
+PacketTracker::SetOutcomes (Handle h, const uint64_t *gateways, enum PacketOutcome outcome)
+{
+  Entry &e = m_table[h];
+  uint64_t *words = GetRow (e.row);
+  for (uint32_t w = 0; w < m_codeWords; w++)
+    {
+      uint64_t low = Spread (uint32_t (gateways[w / 2] >> (32 * (w % 2))));
+      words[w] = (words[w] & ~(low * 3)) | (low * (outcome & 3));
+    }
+  for (uint32_t w = 0; w < m_rowWords - m_codeWords; w++)
+    {
+      words[m_codeWords + w] |= gateways[w];
+      e.outcomeNumber += __builtin_popcountll (gateways[w]);
+    }
+  return e.outcomeNumber;
+}
+
+inline enum PacketOutcome
+PacketTracker::GetOutcome (Handle h, uint32_t gateway) const
+{
+  const uint64_t *words = GetRow (m_table[h].row);
+  if (!(words[m_codeWords + gateway / 64] & (uint64_t (1) << (gateway % 64))))
+    {
+      return UNSET;
+    }
+  return static_cast<enum PacketOutcome> ((words[gateway / 32] >> (2 * (gateway % 32))) & 3);
+}
+
+inline void
+PacketTracker::CountOutcomes (Handle h, int *counts) const
+{
+  for (uint32_t j = 0; j < m_nGateways; j++)
+    {
+      enum PacketOutcome outcome = GetOutcome (h, j);
+      if (outcome != UNSET)
+        {
+          counts[outcome] += 1;
+        }
+    }
+}
+
+inline uint32_t
+PacketTracker::GetOutcomeNumber (Handle h) const
+{
+  return m_table[h].outcomeNumber;
+}
+
+inline uint32_t
+PacketTracker::GetSenderId (Handle h) const
+{
+  return m_table[h].senderId;
+}
+
+inline uint64_t
+PacketTracker::GetUid (Handle h) const
+{
+  return m_table[h].uid;
+}
+
+inline int64_t
+PacketTracker::GetSendTime (Handle h) const
+{
+  return m_table[h].sendTime;
+}
+
+inline void
+PacketTracker::SetWait (Handle h, uint32_t wait)
+{
+  m_table[h].wait = wait;
+}
+
+inline uint32_t
+PacketTracker::GetWait (Handle h) const
+{
+  return m_table[h].wait;
+}
+
+inline void
+PacketTracker::Erase (Handle h)
+{
+  FreeRow (m_table[h].row);
+  m_table[h].uid = EMPTY;
+  m_size--;
+
+  // Backward-shift deletion keeps probe sequences intact without tombstones
+  uint32_t hole = h;
+  uint32_t slot = (h + 1) & m_mask;
+  while (m_table[slot].uid != EMPTY)
+    {
+      uint32_t home = Hash (m_table[slot].uid) & m_mask;
+      // Move the entry into the hole unless its home lies cyclically in (hole, slot]
+      if (((slot - home) & m_mask) >= ((slot - hole) & m_mask))
+        {
+          m_table[hole] = m_table[slot];
+          m_table[slot].uid = EMPTY;
+          hole = slot;
+        }
+      slot = (slot + 1) & m_mask;
+    }
+}
+
+inline uint32_t
+PacketTracker::Evict (int64_t cutoff, int *counts)
+{
+  uint32_t evicted = 0;
+  uint32_t slot = 0;
+  while (slot < m_table.size ())
+    {
+      const Entry &e = m_table[slot];
+      if (e.uid != EMPTY && e.sendTime < cutoff)
+        {
+          CountOutcomes (slot, counts);
+          Erase (slot);
+          evicted++;
+          // Erase may have shifted a later entry into this slot
+          continue;
+        }
+      slot++;
+    }
+  return evicted;
+}
+
+inline uint32_t
+PacketTracker::GetSize (void) const
+{
+  return m_size;
+}
+
+inline uint32_t
+PacketTracker::GetPeakSize (void) const
+{
+  return m_peakSize;
+}
+
+inline size_t
+PacketTracker::GetMemory (void) const
+{
+  return m_table.capacity () * sizeof (Entry) + m_arena.capacity () * sizeof (uint64_t);
+}
+
+inline size_t
+PacketTracker::GetPeakMemory (void) const
+{
+  return m_peakMemory;
+}
+
+inline void
+PacketTracker::UpdatePeakMemory (void)
+{
+  size_t memory = GetMemory ();
+  if (memory > m_peakMemory)
+    {
+      m_peakMemory = memory;
+    }
+}
+
+} // namespace nslora
+
+#endif /* NSLORA_PACKET_TRACKER_H */
@@ -0,0 +1,69 @@
+/*
+ * nslora-partition.h
+ *
+ * Spatial partition of the gateways of a deployment across MPI ranks.
+ *
+ * The disc is cut into angular sectors around its centre, each holding
+ * the same number of gateways give or take one, so a rank owns a
+ * contiguous region and the gateways nearest to it.  Gateways at the
+ * centre belong to the first sector.
+ *
+ * Only the gateways are partitioned: nslora-sim --mpi replicates the end
+ * devices on every rank, as rows of a compact population, and shards the
+ * receptions, which scales the gateway side of a run but not the end
+ * device side.  Every gateway hears every uplink, if only as
+ * interference, so the end devices cannot be split by region without
+ * sending each uplink to every rank.
+ */
+
+#ifndef NSLORA_PARTITION_H
+#define NSLORA_PARTITION_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+namespace nslora {
+
+/**
+ * The part each of n gateways falls in, 0 .. parts - 1.
+ *
+ * \param cx centre of the disc
+ * \param cy centre of the disc
+ */
+inline std::vector<uint32_t>
+PartitionBySector (const double *x, const double *y, size_t n, uint32_t parts,
+                   double cx = 0, double cy = 0)
+{
+  std::vector<uint32_t> owner (n, 0);
+  if (parts <= 1 || n == 0)
+    {
+      return owner;
+    }
+  std::vector<double> angle (n);
+  std::vector<size_t> order (n);
+  for (size_t i = 0; i < n; i++)
+    {
+      double dx = x[i] - cx;
+      double dy = y[i] - cy;
+      // atan2 (0, 0) is 0; send the centre to the front instead
+      angle[i] = dx == 0 && dy == 0 ? -4 : std::atan2 (dy, dx);
+      order[i] = i;
+    }
+  // Ties keep their index order, so every rank computes the same partition
+  std::stable_sort (order.begin (), order.end (), [&angle] (size_t a, size_t b)
+    {
+      return angle[a] < angle[b];
+    });
+  for (size_t k = 0; k < n; k++)
+    {
+      owner[order[k]] = uint32_t (k * parts / n);
+    }
+  return owner;
+}
+
+} // namespace nslora
+
+#endif /* NSLORA_PARTITION_H */
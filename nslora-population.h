@@ -0,0 +1,430 @@
+/*
+ * nslora-population.h
+ *
+ * Compact end device population: every device is a row of a few arrays
+ * (position, data rate, next send time) instead of a Node with its
+ * mobility, LoraNetDevice, PHY, MAC and PeriodicSender, so a run holds
+ * millions of devices in tens of bytes each.
+ *
+ * A single event chain sends the uplinks.  The devices of a data rate all
+ * send every period, so ordered by their first send they keep that order
+ * for the whole run; one cursor per data rate walks its devices and the
+ * next uplink is the earliest of six.
+ *
+ * Uplinks go out on the unchanged LoraChannel, so gateways, forwarders
+ * and the network server see the frames a PeriodicSender, EndDeviceLoraMac
+ * and EndDeviceLoraPhy would have sent.  The server only accepts frames
+ * from end devices it was given as nodes, so each data rate has one real
+ * end device, its carrier: the uplinks of that data rate are sent from
+ * the PHY of the carrier, moved to the position of the device, under the
+ * address and a frame counter of the carrier.  Carriers are taken off the
+ * channel and never receive.
+ *
+ * A device's application hands over an uplink once per period, as a
+ * PeriodicSender does.  Under the 1% duty cycle of the EU sub-band the
+ * next uplink may start 100 airtimes after the previous one; an uplink
+ * handed over before that is postponed to then, as EndDeviceLoraMac
+ * postpones it, and a later one handed over meanwhile replaces it.  A
+ * device whose period is shorter than 100 airtimes thus sends every 100
+ * airtimes, the newest of the uplinks its application handed over.
+ */
+
+#ifndef NSLORA_POPULATION_H
+#define NSLORA_POPULATION_H
+
+#include "ns3/object.h"
+#include "ns3/end-device-lora-mac.h"
+#include "ns3/end-device-lora-phy.h"
+#include "ns3/lora-channel.h"
+#include "ns3/lora-frame-header.h"
+#include "ns3/lora-mac-header.h"
+#include "ns3/lora-net-device.h"
+#include "ns3/lora-tag.h"
+#include "ns3/mobility-model.h"
+#include "ns3/node-container.h"
+#include "ns3/packet.h"
+#include "ns3/position-allocator.h"
+#include "ns3/random-variable-stream.h"
+#include "ns3/simulator.h"
+#include "ns3/traced-callback.h"
+
+#include "nslora-hex-grid.h"
+#include "nslora-sf-assignment.h"
+
+#include <stdint.h>
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+namespace ns3 {
+
+class CompactPopulation : public Object
+{
+public:
+  static const uint8_t DATA_RATES = 6;
+
+  static TypeId GetTypeId (void);
+
+  /**
+   * TracedCallback signature of StartSending.
+   *
+   * \param wait how long the duty cycle held the uplink after its hand-over
+   */
+  typedef void (* StartSendingTracedCallback) (Ptr<Packet const> packet, uint32_t device, Time wait);
+
+  CompactPopulation ();
+
+  /**
+   * Place n devices uniformly on the disc of the given radius around the
+   * origin, 1.2 m high, and give each the data rate SetSpreadingFactorsUp
+   * would, from the RX power of 14 dBm at the nearest gateway.
+   *
+   * \return the number of devices per SF, SF7 first, and the number of
+   * devices out of range of every gateway last
+   */
+  std::vector<int> Place (uint32_t n, double radius, NodeContainer gateways, Ptr<LoraChannel> channel);
+
+  /* Find the nearest gateway with the allocator the gateways were placed with */
+  void SetHexGrid (Ptr<HexGridPositionAllocator> grid);
+
+  /**
+   * Send the uplinks of data rate dr from end device dr of carriers, which
+   * must have been installed on channel.
+   */
+  void SetCarriers (NodeContainer carriers, Ptr<LoraChannel> channel);
+
+  /* Hand over an uplink every period from a random offset, up to stop */
+  void Start (Time period, Time stop);
+
+  uint32_t GetN (void) const;
+  Vector GetPosition (uint32_t device) const;
+  uint8_t GetDataRate (uint32_t device) const;
+
+  uint64_t GetSentCount (void) const;
+  /* Uplinks handed over and replaced before the duty cycle let them out */
+  uint64_t GetSkippedCount (void) const;
+
+private:
+  void Send (void);
+  void Transmit (uint32_t device);
+
+  // One row per device
+  std::vector<double> m_x;
+  std::vector<double> m_y;
+  std::vector<uint8_t> m_dataRate;
+  std::vector<int64_t> m_firstSend;     //!< time step of the first hand-over
+  std::vector<int64_t> m_nextSend;      //!< time step
+
+  // Devices grouped by data rate, each group ordered by first send
+  std::vector<uint32_t> m_order;
+  uint32_t m_groupStart[DATA_RATES + 1];
+  uint32_t m_cursor[DATA_RATES];
+  int64_t m_groupPeriod[DATA_RATES];    //!< time steps between two sends
+
+  Ptr<HexGridPositionAllocator> m_grid;
+  Ptr<LoraChannel> m_channel;
+  Ptr<LoraPhy> m_carrierPhy[DATA_RATES];
+  Ptr<MobilityModel> m_carrierMobility[DATA_RATES];
+  LoraDeviceAddress m_carrierAddress[DATA_RATES];
+  uint16_t m_frameCounter[DATA_RATES];
+  Ptr<UniformRandomVariable> m_random;
+
+  uint8_t m_payloadSize;
+  double m_txPowerDbm;
+  int64_t m_period;             //!< time steps
+  int64_t m_stop;
+  uint64_t m_sent;
+  uint64_t m_skippedSends;
+
+  TracedCallback<Ptr<Packet const>, uint32_t, Time> m_startSending;
+};
+
+NS_OBJECT_ENSURE_REGISTERED (CompactPopulation);
+
+inline TypeId
+CompactPopulation::GetTypeId (void)
+{
+  static TypeId tid = TypeId ("ns3::CompactPopulation")
+    .SetParent<Object> ()
+    .SetGroupName ("lorawan")
+    .AddConstructor<CompactPopulation> ()
+    .AddTraceSource ("StartSending",
+                     "An uplink of a device starts, with the index of the device "
+                     "and how long the duty cycle held it",
+                     MakeTraceSourceAccessor (&CompactPopulation::m_startSending),
+                     "ns3::CompactPopulation::StartSendingTracedCallback");
+  return tid;
+}
+
+inline
+CompactPopulation::CompactPopulation ()
+  : m_payloadSize (10),
+    m_txPowerDbm (14),
+    m_period (0),
+    m_stop (0),
+    m_sent (0),
+    m_skippedSends (0)
+{
+  m_random = CreateObject<UniformRandomVariable> ();
+  for (uint8_t dr = 0; dr < DATA_RATES; dr++)
+    {
+      m_frameCounter[dr] = 0;
+      m_cursor[dr] = 0;
+      m_groupPeriod[dr] = 0;
+    }
+}
+
+inline std::vector<int>
+CompactPopulation::Place (uint32_t n, double radius, NodeContainer gateways, Ptr<LoraChannel> channel)
+{
+  Ptr<UniformDiscPositionAllocator> disc = CreateObject<UniformDiscPositionAllocator> ();
+  disc->SetRho (radius);
+  disc->SetX (0);
+  disc->SetY (0);
+  m_x.resize (n);
+  m_y.resize (n);
+  std::vector<double> z (n, 1.2);
+  for (uint32_t i = 0; i < n; i++)
+    {
+      Vector pos = disc->GetNext ();
+      m_x[i] = pos.x;
+      m_y[i] = pos.y;
+    }
+
+  size_t ng = gateways.GetN ();
+  std::vector<Ptr<MobilityModel> > gwMobility (ng);
+  std::vector<double> gx (ng), gy (ng), gz (ng);
+  for (size_t g = 0; g < ng; g++)
+    {
+      gwMobility[g] = gateways.Get (g)->GetObject<MobilityModel> ();
+      Vector pos = gwMobility[g]->GetPosition ();
+      gx[g] = pos.x;
+      gy[g] = pos.y;
+      gz[g] = pos.z;
+    }
+  std::vector<uint32_t> nearest (n, 0);
+  if (m_grid != 0 && m_grid->GetN () == ng)
+    {
+      for (uint32_t i = 0; i < n; i++)
+        {
+          nearest[i] = m_grid->GetNearest (m_x[i], m_y[i]);
+        }
+    }
+  else if (ng > 0)
+    {
+      nslora::FindNearestGateways (&m_x[0], &m_y[0], &z[0], n, &gx[0], &gy[0], &gz[0], ng, &nearest[0]);
+    }
+
+  // The channel only takes mobility models; one scratch model stands in
+  // for every device
+  Ptr<MobilityModel> scratch = CreateObject<ConstantPositionMobilityModel> ();
+  std::vector<int> sfQuantity (7, 0);
+  m_dataRate.assign (n, 0);
+  for (uint32_t i = 0; i < n && ng > 0; i++)
+    {
+      scratch->SetPosition (Vector (m_x[i], m_y[i], z[i]));
+      double rxPower = channel->GetRxPower (m_txPowerDbm, scratch, gwMobility[nearest[i]]);
+      int bucket = 6;
+      for (int sf = 7; sf <= 12; sf++)
+        {
+          // SetSpreadingFactorsUp compares with the end device sensitivity
+          if (rxPower > EndDeviceLoraPhy::sensitivity[sf - 7])
+            {
+              m_dataRate[i] = 12 - sf;
+              bucket = sf - 7;
+              break;
+            }
+        }
+      sfQuantity[bucket]++;
+    }
+  return sfQuantity;
+}
+
+inline void
+CompactPopulation::SetHexGrid (Ptr<HexGridPositionAllocator> grid)
+{
+  m_grid = grid;
+}
+
+inline void
+CompactPopulation::SetCarriers (NodeContainer carriers, Ptr<LoraChannel> channel)
+{
+  NS_ASSERT (carriers.GetN () >= DATA_RATES);
+  m_channel = channel;
+  for (uint8_t dr = 0; dr < DATA_RATES; dr++)
+    {
+      Ptr<Node> node = carriers.Get (dr);
+      Ptr<LoraNetDevice> loraNetDevice = node->GetDevice (0)->GetObject<LoraNetDevice> ();
+      NS_ASSERT (loraNetDevice != 0);
+      Ptr<EndDeviceLoraMac> mac = loraNetDevice->GetMac ()->GetObject<EndDeviceLoraMac> ();
+      mac->SetDataRate (dr);
+      m_carrierAddress[dr] = mac->GetDeviceAddress ();
+      m_carrierPhy[dr] = loraNetDevice->GetPhy ();
+      m_carrierMobility[dr] = node->GetObject<MobilityModel> ();
+      channel->Remove (m_carrierPhy[dr]);
+    }
+}
+
+inline void
+CompactPopulation::Start (Time period, Time stop)
+{
+  const uint32_t n = m_x.size ();
+  m_period = period.GetTimeStep ();
+  m_stop = stop.GetTimeStep ();
+  m_sent = 0;
+  m_skippedSends = 0;
+  if (n == 0 || m_channel == 0)
+    {
+      return;
+    }
+
+  // First hand-overs uniform over one period, as PeriodicSender draws them
+  m_firstSend.resize (n);
+  for (uint32_t i = 0; i < n; i++)
+    {
+      m_firstSend[i] = Seconds (m_random->GetValue (0, period.GetSeconds ())).GetTimeStep ();
+    }
+  m_nextSend = m_firstSend;
+
+  for (uint8_t dr = 0; dr < DATA_RATES; dr++)
+    {
+      // Uplinks of a data rate all last as long, and may start 100 times
+      // that apart: the airtime and the 99 the sub-band is off after it
+      LoraTxParameters params;
+      params.sf = 12 - dr;
+      Time airtime = LoraPhy::GetOnAirTime (Create<Packet> (m_payloadSize + 9), params);
+      m_groupPeriod[dr] = std::max (m_period, 100 * airtime.GetTimeStep ());
+    }
+
+  m_order.resize (n);
+  for (uint32_t i = 0; i < n; i++)
+    {
+      m_order[i] = i;
+    }
+  const std::vector<uint8_t> &dataRate = m_dataRate;
+  const std::vector<int64_t> &nextSend = m_nextSend;
+  std::sort (m_order.begin (), m_order.end (), [&dataRate, &nextSend] (uint32_t a, uint32_t b)
+    {
+      return dataRate[a] != dataRate[b] ? dataRate[a] < dataRate[b] : nextSend[a] < nextSend[b];
+    });
+  uint32_t k = 0;
+  for (uint8_t dr = 0; dr <= DATA_RATES; dr++)
+    {
+      while (k < n && m_dataRate[m_order[k]] < dr)
+        {
+          k++;
+        }
+      m_groupStart[dr] = k;
+    }
+  for (uint8_t dr = 0; dr < DATA_RATES; dr++)
+    {
+      m_cursor[dr] = m_groupStart[dr];
+    }
+
+  Simulator::ScheduleNow (&CompactPopulation::Send, this);
+}
+
+inline void
+CompactPopulation::Send (void)
+{
+  const int64_t now = Simulator::Now ().GetTimeStep ();
+  int64_t next = m_stop;
+  for (uint8_t dr = 0; dr < DATA_RATES; dr++)
+    {
+      const uint32_t first = m_groupStart[dr];
+      const uint32_t last = m_groupStart[dr + 1];
+      if (first == last)
+        {
+          continue;
+        }
+      uint32_t device = m_order[m_cursor[dr]];
+      while (m_nextSend[device] <= now)
+        {
+          Transmit (device);
+          m_nextSend[device] += m_groupPeriod[dr];
+          m_cursor[dr] = m_cursor[dr] + 1 == last ? first : m_cursor[dr] + 1;
+          device = m_order[m_cursor[dr]];
+        }
+      next = std::min (next, m_nextSend[device]);
+    }
+  if (next < m_stop)
+    {
+      Simulator::Schedule (TimeStep (next - now), &CompactPopulation::Send, this);
+    }
+}
+
+inline void
+CompactPopulation::Transmit (uint32_t device)
+{
+  // The frame EndDeviceLoraMac builds for an unconfirmed uplink
+  const uint8_t dr = m_dataRate[device];
+  Ptr<Packet> packet = Create<Packet> (m_payloadSize);
+  LoraFrameHeader frameHdr;
+  frameHdr.SetAsUplink ();
+  frameHdr.SetFPort (1);
+  frameHdr.SetAddress (m_carrierAddress[dr]);
+  frameHdr.SetFCnt (m_frameCounter[dr]++);
+  packet->AddHeader (frameHdr);
+  LoraMacHeader macHdr;
+  macHdr.SetMType (LoraMacHeader::UNCONFIRMED_DATA_UP);
+  packet->AddHeader (macHdr);
+
+  LoraTxParameters params;
+  params.sf = 12 - dr;
+  LoraTag tag;
+  tag.SetSpreadingFactor (params.sf);
+  tag.SetSendtime (uint16_t (Simulator::Now ().GetSeconds ()));
+  packet->AddPacketTag (tag);
+
+  // One of the three default EU channels, as GetChannelForTx picks them
+  static const double frequencies[3] = { 868.1, 868.3, 868.5 };
+  double frequencyMHz = frequencies[m_random->GetInteger (0, 2)];
+
+  // Hand-overs up to now, the last of which goes out, and up to the next
+  // send, all but the last of which are replaced
+  const int64_t now = Simulator::Now ().GetTimeStep ();
+  const int64_t handedOver = (now - m_firstSend[device]) / m_period;
+  const int64_t next = now + m_groupPeriod[dr];
+  const int64_t handedOverNext = ((next < m_stop ? next : m_stop - 1) - m_firstSend[device]) / m_period;
+  m_sent++;
+  m_skippedSends += handedOverNext - handedOver - (next < m_stop ? 1 : 0);
+  m_carrierMobility[dr]->SetPosition (Vector (m_x[device], m_y[device], 1.2));
+  m_channel->Send (m_carrierPhy[dr], packet, m_txPowerDbm, params,
+                   LoraPhy::GetOnAirTime (packet, params), frequencyMHz);
+  // After the channel, as EndDeviceLoraPhy::Send fires it
+  m_startSending (packet, device, TimeStep (now - m_firstSend[device] - handedOver * m_period));
+}
+
+inline uint32_t
+CompactPopulation::GetN (void) const
+{
+  return m_x.size ();
+}
+
+inline Vector
+CompactPopulation::GetPosition (uint32_t device) const
+{
+  return Vector (m_x[device], m_y[device], 1.2);
+}
+
+inline uint8_t
+CompactPopulation::GetDataRate (uint32_t device) const
+{
+  return m_dataRate[device];
+}
+
+inline uint64_t
+CompactPopulation::GetSentCount (void) const
+{
+  return m_sent;
+}
+
+inline uint64_t
+CompactPopulation::GetSkippedCount (void) const
+{
+  return m_skippedSends;
+}
+
+} // namespace ns3
+
+#endif /* NSLORA_POPULATION_H */
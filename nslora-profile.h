@@ -0,0 +1,231 @@
+/*
+ * nslora-profile.h
+ *
+ * Wall-clock and memory profile of the phases of a simulation run.
+ *
+ * Phases are delimited by Start calls: each one ends the running phase
+ * and begins the named one.  A name may come back several times, its
+ * times then add up.  At the end of each phase the resident set size and
+ * the peak resident set size are sampled, so a jump in the peak points at
+ * the phase that caused it.
+ *
+ * The peak is the kernel's high-water mark of the process (VmHWM), which
+ * Clear resets to the current resident set through /proc/self/clear_refs.
+ * A run that clears the profiler first thus reports its own peak rather
+ * than the largest one of an earlier run, or of the parent it was forked
+ * from; memory it inherited and still holds counts towards it.  Where the
+ * reset is not allowed the peak is the process' since its start.
+ */
+
+#ifndef NSLORA_PROFILE_H
+#define NSLORA_PROFILE_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <chrono>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include <sys/resource.h>
+#include <unistd.h>
+
+namespace nslora {
+
+struct PhaseSample
+{
+  std::string name;
+  double seconds;
+  long rssKb;                   //!< resident set size at the end of the phase
+  long peakRssKb;               //!< peak resident set size since Clear, at the end of the phase
+};
+
+class PhaseProfiler
+{
+public:
+  PhaseProfiler ();
+
+  /* End the running phase, if any, and begin the named one */
+  void Start (const std::string &name);
+  /* End the running phase */
+  void Stop (void);
+  /* Forget the phases and reset the peak resident set size */
+  void Clear (void);
+
+  const std::vector<PhaseSample> &GetPhases (void) const;
+  /* Seconds spent in the named phase, 0 if it never ran */
+  double GetSeconds (const std::string &name) const;
+  double GetTotalSeconds (void) const;
+
+  static long GetRssKb (void);
+  /* Peak resident set size since the last reset, or since the process started */
+  static long GetPeakRssKb (void);
+  /* Reset the peak resident set size to the current one; false if not allowed */
+  static bool ResetPeakRss (void);
+
+  /* Write the phases as a JSON array */
+  void WriteJson (std::ostream &os) const;
+
+private:
+  typedef std::chrono::steady_clock Clock;
+
+  std::vector<PhaseSample> m_phases;
+  int m_current;
+  Clock::time_point m_start;
+};
+
+inline
+PhaseProfiler::PhaseProfiler ()
+  : m_current (-1)
+{
+}
+
+inline void
+PhaseProfiler::Start (const std::string &name)
+{
+  Stop ();
+  m_current = -1;
+  for (size_t i = 0; i < m_phases.size (); i++)
+    {
+      if (m_phases[i].name == name)
+        {
+          m_current = i;
+        }
+    }
+  if (m_current < 0)
+    {
+      PhaseSample sample = { name, 0, 0, 0 };
+      m_phases.push_back (sample);
+      m_current = m_phases.size () - 1;
+    }
+  m_start = Clock::now ();
+}
+
+inline void
+PhaseProfiler::Stop (void)
+{
+  if (m_current < 0)
+    {
+      return;
+    }
+  PhaseSample &sample = m_phases[m_current];
+  sample.seconds += std::chrono::duration<double> (Clock::now () - m_start).count ();
+  sample.rssKb = GetRssKb ();
+  sample.peakRssKb = GetPeakRssKb ();
+  m_current = -1;
+}
+
+inline void
+PhaseProfiler::Clear (void)
+{
+  m_phases.clear ();
+  m_current = -1;
+  ResetPeakRss ();
+}
+
+inline const std::vector<PhaseSample> &
+PhaseProfiler::GetPhases (void) const
+{
+  return m_phases;
+}
+
+inline double
+PhaseProfiler::GetSeconds (const std::string &name) const
+{
+  for (size_t i = 0; i < m_phases.size (); i++)
+    {
+      if (m_phases[i].name == name)
+        {
+          return m_phases[i].seconds;
+        }
+    }
+  return 0;
+}
+
+inline double
+PhaseProfiler::GetTotalSeconds (void) const
+{
+  double total = 0;
+  for (size_t i = 0; i < m_phases.size (); i++)
+    {
+      total += m_phases[i].seconds;
+    }
+  return total;
+}
+
+inline long
+PhaseProfiler::GetRssKb (void)
+{
+  long pages = 0;
+  FILE *f = fopen ("/proc/self/statm", "r");
+  if (f != 0)
+    {
+      if (fscanf (f, "%*s %ld", &pages) != 1)
+        {
+          pages = 0;
+        }
+      fclose (f);
+    }
+  return pages * (sysconf (_SC_PAGESIZE) / 1024);
+}
+
+inline long
+PhaseProfiler::GetPeakRssKb (void)
+{
+  // ru_maxrss never goes down, VmHWM follows the resets
+  long kb = -1;
+  FILE *f = fopen ("/proc/self/status", "r");
+  if (f != 0)
+    {
+      char line[256];
+      while (kb < 0 && fgets (line, sizeof (line), f) != 0)
+        {
+          if (sscanf (line, "VmHWM: %ld kB", &kb) != 1)
+            {
+              kb = -1;
+            }
+        }
+      fclose (f);
+    }
+  if (kb >= 0)
+    {
+      return kb;
+    }
+  struct rusage usage;
+  if (getrusage (RUSAGE_SELF, &usage) != 0)
+    {
+      return 0;
+    }
+  // Kilobytes on Linux
+  return usage.ru_maxrss;
+}
+
+inline bool
+PhaseProfiler::ResetPeakRss (void)
+{
+  FILE *f = fopen ("/proc/self/clear_refs", "w");
+  if (f == 0)
+    {
+      return false;
+    }
+  bool ok = fputs ("5", f) >= 0;
+  return fclose (f) == 0 && ok;
+}
+
+inline void
+PhaseProfiler::WriteJson (std::ostream &os) const
+{
+  os << "[";
+  for (size_t i = 0; i < m_phases.size (); i++)
+    {
+      const PhaseSample &s = m_phases[i];
+      os << (i ? ",\n    " : "\n    ")
+         << "{\"name\": \"" << s.name << "\", \"seconds\": " << s.seconds
+         << ", \"rssKb\": " << s.rssKb << ", \"peakRssKb\": " << s.peakRssKb << "}";
+    }
+  os << "\n  ]";
+}
+
+} // namespace nslora
+
+#endif /* NSLORA_PROFILE_H */
@@ -0,0 +1,188 @@
+/*
+ * nslora-replication.h
+ *
+ * Sequential replication of a sweep point.
+ *
+ * Instead of a fixed number of seeds, a point is simulated with seed after
+ * seed until the confidence interval of every tracked metric is narrower
+ * than its target, or a maximum number of replications is reached.  The
+ * interval is the usual Student t interval on the mean of independent
+ * replications; ReplicationStat keeps the running mean and variance with
+ * Welford's update so no sample needs to be stored.
+ */
+
+#ifndef NSLORA_REPLICATION_H
+#define NSLORA_REPLICATION_H
+
+#include <stdint.h>
+#include <cmath>
+
+namespace nslora {
+
+/* Quantile of the standard normal distribution (Acklam's approximation) */
+inline double
+NormalQuantile (double p)
+{
+  static const double a[6] = { -3.969683028665376e+01, 2.209460984245205e+02, -2.759285104469687e+02,
+                               1.383577518672690e+02, -3.066479806614716e+01, 2.506628277459239e+00 };
+  static const double b[5] = { -5.447609879822406e+01, 1.615858368580409e+02, -1.556989798598866e+02,
+                               6.680131188771972e+01, -1.328068155288572e+01 };
+  static const double c[6] = { -7.784894002430293e-03, -3.223964580411365e-01, -2.400758277161838e+00,
+                               -2.549732539343734e+00, 4.374664141464968e+00, 2.938163982698783e+00 };
+  static const double d[4] = { 7.784695709041462e-03, 3.224671290700398e-01, 2.445134137142996e+00,
+                               3.754408661907416e+00 };
+  if (p <= 0)
+    {
+      return -INFINITY;
+    }
+  if (p >= 1)
+    {
+      return INFINITY;
+    }
+  if (p < 0.02425 || p > 1 - 0.02425)
+    {
+      double q = std::sqrt (-2 * std::log (p < 0.5 ? p : 1 - p));
+      double x = (((((c[0] * q + c[1]) * q + c[2]) * q + c[3]) * q + c[4]) * q + c[5])
+        / ((((d[0] * q + d[1]) * q + d[2]) * q + d[3]) * q + 1);
+      return p < 0.5 ? x : -x;
+    }
+  double q = p - 0.5;
+  double r = q * q;
+  return (((((a[0] * r + a[1]) * r + a[2]) * r + a[3]) * r + a[4]) * r + a[5]) * q
+    / (((((b[0] * r + b[1]) * r + b[2]) * r + b[3]) * r + b[4]) * r + 1);
+}
+
+/**
+ * Critical value t such that a Student t variable with df degrees of
+ * freedom lies within [-t, t] with the given probability (Hill's
+ * algorithm 396).
+ */
+inline double
+StudentTCritical (double confidence, uint32_t df)
+{
+  double p = 1 - confidence;
+  if (df == 0 || p <= 0)
+    {
+      return INFINITY;
+    }
+  if (df == 1)
+    {
+      return 1 / std::tan (p * M_PI / 2);
+    }
+  if (df == 2)
+    {
+      return std::sqrt (2 / (p * (2 - p)) - 2);
+    }
+  double n = df;
+  double a = 1 / (n - 0.5);
+  double b = 48 / (a * a);
+  double c = ((20700 * a / b - 98) * a - 16) * a + 96.36;
+  double d = ((94.5 / (b + c) - 3) / b + 1) * std::sqrt (a * M_PI / 2) * n;
+  double x = d * p;
+  double y = std::pow (x, 2 / n);
+  if (y > 0.05 + a)
+    {
+      x = NormalQuantile (0.5 * p);
+      y = x * x;
+      if (df < 5)
+        {
+          c += 0.3 * (n - 4.5) * (x + 0.6);
+        }
+      c = (((0.05 * d * x - 5) * x - 7) * x - 2) * x + b + c;
+      y = (((((0.4 * y + 6.3) * y + 36) * y + 94.5) / c - y - 3) / b + 1) * x;
+      y = std::expm1 (a * y * y);
+    }
+  else
+    {
+      y = ((1 / (((n + 6) / (n * y) - 0.089 * d - 0.822) * (n + 2) * 3)
+            + 0.5 / (n + 4)) * y - 1) * (n + 1) / (n + 2) + 1 / y;
+    }
+  return std::sqrt (n * y);
+}
+
+/* Running mean and confidence interval of one metric over replications */
+class ReplicationStat
+{
+public:
+  ReplicationStat ();
+
+  void Add (double x);
+
+  uint32_t GetCount (void) const;
+  double GetMean (void) const;
+  double GetVariance (void) const;
+
+  /* Half width of the confidence interval on the mean, infinite below two samples */
+  double GetHalfWidth (double confidence) const;
+
+  /**
+   * Whether the half width is at most target, taken as a fraction of the
+   * mean if relative is set.  A target of 0 or less is always met.
+   */
+  bool IsPrecise (double target, bool relative, double confidence) const;
+
+private:
+  uint32_t m_n;
+  double m_mean;
+  double m_m2;
+};
+
+inline
+ReplicationStat::ReplicationStat ()
+  : m_n (0),
+    m_mean (0),
+    m_m2 (0)
+{
+}
+
+inline void
+ReplicationStat::Add (double x)
+{
+  m_n++;
+  double delta = x - m_mean;
+  m_mean += delta / m_n;
+  m_m2 += delta * (x - m_mean);
+}
+
+inline uint32_t
+ReplicationStat::GetCount (void) const
+{
+  return m_n;
+}
+
+inline double
+ReplicationStat::GetMean (void) const
+{
+  return m_mean;
+}
+
+inline double
+ReplicationStat::GetVariance (void) const
+{
+  return m_n > 1 ? m_m2 / (m_n - 1) : 0;
+}
+
+inline double
+ReplicationStat::GetHalfWidth (double confidence) const
+{
+  if (m_n < 2)
+    {
+      return INFINITY;
+    }
+  return StudentTCritical (confidence, m_n - 1) * std::sqrt (GetVariance () / m_n);
+}
+
+inline bool
+ReplicationStat::IsPrecise (double target, bool relative, double confidence) const
+{
+  if (target <= 0)
+    {
+      return true;
+    }
+  double bound = relative ? target * std::fabs (m_mean) : target;
+  return GetHalfWidth (confidence) <= bound;
+}
+
+} // namespace nslora
+
+#endif /* NSLORA_REPLICATION_H */
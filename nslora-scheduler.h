@@ -0,0 +1,304 @@
+/*
+ * nslora-scheduler.h
+ *
+ * Event schedulers for the drivers, selectable by name, and a calendar
+ * queue with a fixed bucket width for periodic LoRa traffic.
+ *
+ * BucketScheduler hashes an event to bucket (ts / width) mod buckets, a
+ * list kept in time order, and takes events out by walking the buckets
+ * from the last one removed, one width of simulated time per bucket.
+ * With a width of a few mean gaps between executed events and about as
+ * many buckets as pending events, a bucket holds a handful of events and
+ * insert and pop are O(1) amortized.  ns3::CalendarScheduler estimates
+ * its width from a sample of the queue whenever it resizes, which the
+ * bursts of receptions of one uplink at every gateway throw off; here the
+ * width is set once from the load, see Tune, and only the number of
+ * buckets follows the size of the queue.
+ */
+
+#ifndef NSLORA_SCHEDULER_H
+#define NSLORA_SCHEDULER_H
+
+#include "ns3/scheduler.h"
+#include "ns3/event-impl.h"
+#include "ns3/nstime.h"
+#include "ns3/uinteger.h"
+#include "ns3/config.h"
+
+#include <stdint.h>
+#include <algorithm>
+#include <cmath>
+#include <deque>
+#include <string>
+#include <vector>
+
+namespace nslora {
+
+/**
+ * The ns-3 type of a scheduler given by its short name: map, heap, list,
+ * calendar or bucket.  Any other name is taken as a type name.
+ */
+inline std::string
+GetSchedulerType (const std::string &name)
+{
+  static const char *names[5][2] = {
+    { "map", "ns3::MapScheduler" },
+    { "heap", "ns3::HeapScheduler" },
+    { "list", "ns3::ListScheduler" },
+    { "calendar", "ns3::CalendarScheduler" },
+    { "bucket", "ns3::BucketScheduler" },
+  };
+  for (int i = 0; i < 5; i++)
+    {
+      if (name == names[i][0])
+        {
+          return names[i][1];
+        }
+    }
+  return name;
+}
+
+} // namespace nslora
+
+namespace ns3 {
+
+class BucketScheduler : public Scheduler
+{
+public:
+  static TypeId GetTypeId (void);
+
+  BucketScheduler ();
+
+  /**
+   * Set the defaults of the schedulers created from now on for senders
+   * sending once per period, each uplink received by receivers for about
+   * airtime: a width of three mean gaps between events, and a bucket per
+   * pending send and reception.
+   */
+  static void Tune (uint32_t senders, uint32_t receivers, Time period, Time airtime);
+
+  virtual void Insert (const Event &ev);
+  virtual bool IsEmpty (void) const;
+  virtual Event PeekNext (void) const;
+  virtual Event RemoveNext (void);
+  virtual void Remove (const Event &ev);
+
+private:
+  typedef std::deque<Event> Bucket;
+
+  uint32_t GetBucket (uint64_t ts) const;
+  /* Point the cursor at the bucket of ts */
+  void Seek (uint64_t ts);
+  /* Bucket holding the earliest event, and the end of its window */
+  void FindNext (uint32_t &bucket, uint64_t &top) const;
+  void Resize (uint32_t buckets);
+  void DoInsert (const Event &ev);
+
+  Time m_width;
+  uint32_t m_minBuckets;
+  uint64_t m_widthTs;                   //!< m_width in time steps
+  std::vector<Bucket> m_buckets;
+  uint32_t m_size;
+  uint32_t m_current;                   //!< bucket of the last event removed
+  uint64_t m_top;                       //!< end of the window of m_current
+};
+
+NS_OBJECT_ENSURE_REGISTERED (BucketScheduler);
+
+inline TypeId
+BucketScheduler::GetTypeId (void)
+{
+  static TypeId tid = TypeId ("ns3::BucketScheduler")
+    .SetParent<Scheduler> ()
+    .SetGroupName ("Core")
+    .AddConstructor<BucketScheduler> ()
+    .AddAttribute ("BucketWidth",
+                   "Simulated time covered by one bucket",
+                   TimeValue (MilliSeconds (1)),
+                   MakeTimeAccessor (&BucketScheduler::m_width),
+                   MakeTimeChecker ())
+    .AddAttribute ("Buckets",
+                   "Initial number of buckets, and the fewest the queue shrinks to",
+                   UintegerValue (1024),
+                   MakeUintegerAccessor (&BucketScheduler::m_minBuckets),
+                   MakeUintegerChecker<uint32_t> (1));
+  return tid;
+}
+
+inline
+BucketScheduler::BucketScheduler ()
+  : m_width (MilliSeconds (1)),
+    m_minBuckets (1024),
+    m_widthTs (0),
+    m_size (0),
+    m_current (0),
+    m_top (0)
+{
+}
+
+inline void
+BucketScheduler::Tune (uint32_t senders, uint32_t receivers, Time period, Time airtime)
+{
+  double rate = senders / std::max (period.GetSeconds (), 1e-9);
+  // Every uplink starts and ends a reception at each receiver
+  double events = rate * (1 + 2.0 * receivers);
+  Time width = events > 0 ? Seconds (3 / events) : MilliSeconds (1);
+  width = std::max (width, NanoSeconds (1));
+  double pending = senders + 2 * rate * receivers * airtime.GetSeconds ();
+  uint32_t buckets = 16;
+  while (buckets < pending && buckets < (1u << 24))
+    {
+      buckets *= 2;
+    }
+  Config::SetDefault ("ns3::BucketScheduler::BucketWidth", TimeValue (width));
+  Config::SetDefault ("ns3::BucketScheduler::Buckets", UintegerValue (buckets));
+}
+
+inline uint32_t
+BucketScheduler::GetBucket (uint64_t ts) const
+{
+  return uint32_t ((ts / m_widthTs) % m_buckets.size ());
+}
+
+inline void
+BucketScheduler::Seek (uint64_t ts)
+{
+  m_current = GetBucket (ts);
+  m_top = (ts / m_widthTs + 1) * m_widthTs;
+}
+
+inline void
+BucketScheduler::DoInsert (const Event &ev)
+{
+  // Events mostly arrive later than the ones already in their bucket, so
+  // look for the place from the back
+  Bucket &b = m_buckets[GetBucket (ev.key.m_ts)];
+  Bucket::iterator i = b.end ();
+  while (i != b.begin () && ev.key < (i - 1)->key)
+    {
+      --i;
+    }
+  b.insert (i, ev);
+}
+
+inline void
+BucketScheduler::Insert (const Event &ev)
+{
+  if (m_buckets.empty ())
+    {
+      // Attributes are set after construction
+      m_widthTs = std::max<int64_t> (1, m_width.GetTimeStep ());
+      m_buckets.resize (m_minBuckets);
+      Seek (ev.key.m_ts);
+    }
+  if (m_size >= 2 * m_buckets.size ())
+    {
+      Resize (2 * m_buckets.size ());
+    }
+  DoInsert (ev);
+  m_size++;
+  // Never behind the cursor, or the walk would only find it a lap later
+  if (ev.key.m_ts < m_top - m_widthTs)
+    {
+      Seek (ev.key.m_ts);
+    }
+}
+
+inline bool
+BucketScheduler::IsEmpty (void) const
+{
+  return m_size == 0;
+}
+
+inline void
+BucketScheduler::FindNext (uint32_t &bucket, uint64_t &top) const
+{
+  NS_ASSERT (m_size > 0);
+  const uint32_t n = m_buckets.size ();
+  bucket = m_current;
+  top = m_top;
+  for (uint32_t k = 0; k < n; k++)
+    {
+      const Bucket &b = m_buckets[bucket];
+      if (!b.empty () && b.front ().key.m_ts < top)
+        {
+          return;
+        }
+      bucket = bucket + 1 == n ? 0 : bucket + 1;
+      top += m_widthTs;
+    }
+
+  // Nothing within a lap: the queue is sparse, take the earliest head
+  const Event *best = 0;
+  for (uint32_t i = 0; i < n; i++)
+    {
+      const Bucket &b = m_buckets[i];
+      if (!b.empty () && (best == 0 || b.front ().key < best->key))
+        {
+          best = &b.front ();
+          bucket = i;
+        }
+    }
+  top = (best->key.m_ts / m_widthTs + 1) * m_widthTs;
+}
+
+inline Scheduler::Event
+BucketScheduler::PeekNext (void) const
+{
+  uint32_t bucket;
+  uint64_t top;
+  FindNext (bucket, top);
+  return m_buckets[bucket].front ();
+}
+
+inline Scheduler::Event
+BucketScheduler::RemoveNext (void)
+{
+  FindNext (m_current, m_top);
+  Event ev = m_buckets[m_current].front ();
+  m_buckets[m_current].pop_front ();
+  m_size--;
+  if (m_size < m_buckets.size () / 2 && m_buckets.size () > m_minBuckets)
+    {
+      Resize (m_buckets.size () / 2);
+    }
+  return ev;
+}
+
+inline void
+BucketScheduler::Remove (const Event &ev)
+{
+  Bucket &b = m_buckets[GetBucket (ev.key.m_ts)];
+  for (Bucket::iterator i = b.begin (); i != b.end (); ++i)
+    {
+      if (i->key.m_uid == ev.key.m_uid)
+        {
+          NS_ASSERT (ev.impl == i->impl);
+          b.erase (i);
+          m_size--;
+          return;
+        }
+    }
+  NS_ASSERT (false);
+}
+
+inline void
+BucketScheduler::Resize (uint32_t buckets)
+{
+  std::vector<Bucket> old;
+  old.swap (m_buckets);
+  m_buckets.resize (std::max (buckets, 1u));
+  for (size_t i = 0; i < old.size (); i++)
+    {
+      for (Bucket::const_iterator j = old[i].begin (); j != old[i].end (); ++j)
+        {
+          DoInsert (*j);
+        }
+    }
+  // Same window, renumbered
+  Seek (m_top - m_widthTs);
+}
+
+} // namespace ns3
+
+#endif /* NSLORA_SCHEDULER_H */
@@ -23,7 +23,12 @@
 #include "ns3/one-shot-sender-helper.h"
 #include "ns3/simple-network-server.h"
 
+#include "nslora-packet-tracker.h"
+#include "nslora-scheduler.h"
+#include "nslora-trace-log.h"
+
 using namespace ns3;
+using namespace nslora;
 
 NS_LOG_COMPONENT_DEFINE ("NetworkServerExample");
 
@@ -47,130 +52,73 @@ uint16_t transmittedPkt = 0;
 // bool printEDs = true;
 // bool buildingsEnabled = false;
 
-enum PacketOutcome {
-  RECEIVED,
-  INTERFERED,
-  NO_MORE_RECEIVERS,
-  UNDER_SENSITIVITY,
-  UNSET
-};
-
-struct PacketStatus {
-  Ptr<Packet const> packet;
-  uint32_t senderId;
-  int outcomeNumber;
-  std::vector<enum PacketOutcome> outcomes;
-};
-
-std::map<Ptr<Packet const>, PacketStatus> packetTracker;
+PacketTracker packetTracker;
 
 void
-CheckReceptionByAllGWsComplete (std::map<Ptr<Packet const>, PacketStatus>::iterator it)
+CheckReceptionByAllGWsComplete (PacketTracker::Handle h)
 {
   // Check whether this packet is received by all gateways
-  if ((*it).second.outcomeNumber == nGateways)
+  if (packetTracker.GetOutcomeNumber (h) == uint32_t (nGateways))
     {
       // Update the statistics
-      PacketStatus status = (*it).second;
-      for (int j = 0; j < nGateways; j++)
-        {
-          switch (status.outcomes.at (j))
-            {
-            case RECEIVED:
-              {
-                received += 1;
-                break;
-              }
-            case UNDER_SENSITIVITY:
-              {
-                underSensitivity += 1;
-                break;
-              }
-            case NO_MORE_RECEIVERS:
-              {
-                noMoreReceivers += 1;
-                break;
-              }
-            case INTERFERED:
-              {
-                interfered += 1;
-                break;
-              }
-            case UNSET:
-              {
-                break;
-              }
-            }
-        }
+      int counts[UNSET] = {0, 0, 0, 0};
+      packetTracker.CountOutcomes (h, counts);
+      received += counts[RECEIVED];
+      underSensitivity += counts[UNDER_SENSITIVITY];
+      noMoreReceivers += counts[NO_MORE_RECEIVERS];
+      interfered += counts[INTERFERED];
+
       // Remove the packet from the tracker
-      packetTracker.erase (it);
+      packetTracker.Erase (h);
     }
 }
 
-void
-TransmissionCallback (Ptr<Packet const> packet, uint32_t systemId)
-{
-  NS_LOG_INFO ("Transmitted a packet from device " << systemId);
-  // Create a packetStatus
-  PacketStatus status;
-  status.packet = packet;
-  status.senderId = systemId;
-  status.outcomeNumber = 0;
-  status.outcomes = std::vector<enum PacketOutcome> (nGateways, UNSET);
-
-  packetTracker.insert (std::pair<Ptr<Packet const>, PacketStatus> (packet, status));
-}
-
-void
-PacketReceptionCallback (Ptr<Packet const> packet, uint32_t systemId)
+PacketTracker::Handle
+SetPacketOutcome (Ptr<Packet const> packet, uint32_t systemId, enum PacketOutcome outcome)
 {
-  std::map<Ptr<Packet const>, PacketStatus>::iterator it = packetTracker.find (packet);
-  (*it).second.outcomes.at (systemId - nDevices) = RECEIVED;
-  (*it).second.outcomeNumber += 1;
-
-  Ptr<Packet> pkt = packet->Copy ();
-  LoraTag tag;
-  pkt->RemovePacketTag(tag);
-  uint16_t sendtime = tag.GetSendtime();
-
-  // Remove the successfully received packet from the list of sent ones
-  NS_LOG_INFO ("A packet was successfully received at server " << systemId << " stime: " << sendtime);
-
-  CheckReceptionByAllGWsComplete (it);
+  PacketTracker::Handle h = packetTracker.Find (packet->GetUid ());
+  if (h != PacketTracker::NONE)
+    {
+      packetTracker.SetOutcome (h, systemId - nDevices, outcome);
+    }
+  return h;
 }
 
 void
-InterferenceCallback (Ptr<Packet const> packet, uint32_t systemId)
+TransmissionCallback (Ptr<Packet const> packet, uint32_t systemId)
 {
-	NS_LOG_INFO ("A packet was interferenced " << systemId);
-
-	std::map<Ptr<Packet const>, PacketStatus>::iterator it = packetTracker.find (packet);
-	it->second.outcomes.at (systemId - nDevices) = INTERFERED;
-	it->second.outcomeNumber += 1;
+  NSLORA_TRACE (TRACE_TRANSMIT, systemId, packet->GetUid (), 0, 0);
+  packetTracker.Insert (packet->GetUid (), systemId);
 }
 
+// One handler for every gateway outcome, the outcome is bound at hookup
 void
-NoMoreReceiversCallback (Ptr<Packet const> packet, uint32_t systemId)
+OutcomeCallback (enum PacketOutcome outcome, Ptr<Packet const> packet, uint32_t systemId)
 {
-  // NS_LOG_INFO ("A packet was lost because there were no more receivers at gateway " << systemId);
-
-  std::map<Ptr<Packet const>, PacketStatus>::iterator it = packetTracker.find (packet);
-  (*it).second.outcomes.at (systemId - nDevices) = NO_MORE_RECEIVERS;
-  (*it).second.outcomeNumber += 1;
-
-  CheckReceptionByAllGWsComplete (it);
-}
+  PacketTracker::Handle h = SetPacketOutcome (packet, systemId, outcome);
 
-void
-UnderSensitivityCallback (Ptr<Packet const> packet, uint32_t systemId)
-{
-  // NS_LOG_INFO ("A packet arrived at the gateway under sensitivity at gateway " << systemId);
+#if NSLORA_TRACE_COMPILED
+  uint16_t sendtime = 0;
+  if (outcome == RECEIVED)
+    {
+      // Read the tag in place rather than from a copy of the packet
+      LoraTag tag;
+      packet->PeekPacketTag (tag);
+      sendtime = tag.GetSendtime();
+    }
+  NSLORA_TRACE (TRACE_OUTCOME, systemId, packet->GetUid (), outcome, sendtime);
+#endif
 
-  std::map<Ptr<Packet const>, PacketStatus>::iterator it = packetTracker.find (packet);
-  (*it).second.outcomes.at (systemId - nDevices) = UNDER_SENSITIVITY;
-  (*it).second.outcomeNumber += 1;
+  if (outcome == INTERFERED)
+    {
+      // Another gateway may still report on it
+      return;
+    }
 
-  CheckReceptionByAllGWsComplete (it);
+  if (h != PacketTracker::NONE)
+    {
+      CheckReceptionByAllGWsComplete (h);
+    }
 }
 
 void
@@ -220,6 +168,8 @@ int main (int argc, char *argv[])
   bool verbose = false;
   bool printdev = false;
   int nring = 1;
+  std::string trace;
+  std::string scheduler = "map";
 
   CommandLine cmd;
   cmd.AddValue ("verbose", "Whether to print output or not", verbose);
@@ -227,13 +177,32 @@ int main (int argc, char *argv[])
   cmd.AddValue ("simtime", "SimulationTIme", simulationTime);
   cmd.AddValue ("ndev", "SimulationTIme", nDevices);
   cmd.AddValue ("nring", "Num of rings", nring);
+  cmd.AddValue ("trace", "Record transmissions and outcomes to this binary trace file", trace);
+  cmd.AddValue ("scheduler", "Event scheduler [map, heap, list, calendar, bucket or an ns-3 type name]", scheduler);
   cmd.Parse (argc, argv);
 
   gatewayRings = nring;
   nGateways = 3*gatewayRings*gatewayRings-3*gatewayRings+1;
+  packetTracker.Reset (nGateways);
+
+  ObjectFactory schedulerFactory;
+  schedulerFactory.SetTypeId (GetSchedulerType (scheduler));
+  if (GetSchedulerType (scheduler) == "ns3::BucketScheduler")
+  {
+	  // An SF10 uplink stands in for the typical one
+	  LoraTxParameters params;
+	  params.sf = 10;
+	  BucketScheduler::Tune (nDevices, nGateways, Seconds (appPeriodSeconds), LoraPhy::GetOnAirTime (Create<Packet> (19), params));
+  }
+  Simulator::SetScheduler (schedulerFactory);
 
   // Logging
-  LogComponentEnable ("NetworkServerExample", LOG_LEVEL_DEBUG);
+  if (verbose)
+  {
+    LogComponentEnable ("NetworkServerExample", LOG_LEVEL_DEBUG);
+    LogComponentEnableAll (LOG_PREFIX_NODE);
+    LogComponentEnableAll (LOG_PREFIX_TIME);
+  }
   //LogComponentEnable ("SimpleNetworkServer", LOG_LEVEL_ALL);
   // LogComponentEnable ("GatewayLoraMac", LOG_LEVEL_ALL);
   // LogComponentEnable("LoraFrameHeader", LOG_LEVEL_ALL);
@@ -252,8 +221,6 @@ int main (int argc, char *argv[])
   // LogComponentEnable ("DeviceStatus", LOG_LEVEL_ALL);
   // LogComponentEnable ("GatewayStatus", LOG_LEVEL_ALL);
 //  LogComponentEnableAll (LOG_PREFIX_FUNC);
-  LogComponentEnableAll (LOG_PREFIX_NODE);
-  LogComponentEnableAll (LOG_PREFIX_TIME);
 
   NS_LOG_DEBUG ("ng: " << std::to_string(nGateways) << " " << "nr: " << std::to_string(gatewayRings));
 
@@ -389,13 +356,13 @@ int main (int argc, char *argv[])
 
 	// Global callbacks (every gateway)
 	gwPhy->TraceConnectWithoutContext ("ReceivedPacket",
-									   MakeCallback (&PacketReceptionCallback));
+									   MakeBoundCallback (&OutcomeCallback, RECEIVED));
 	gwPhy->TraceConnectWithoutContext ("LostPacketBecauseInterference",
-									   MakeCallback (&InterferenceCallback));
+									   MakeBoundCallback (&OutcomeCallback, INTERFERED));
 	gwPhy->TraceConnectWithoutContext ("LostPacketBecauseNoMoreReceivers",
-									   MakeCallback (&NoMoreReceiversCallback));
+									   MakeBoundCallback (&OutcomeCallback, NO_MORE_RECEIVERS));
 	gwPhy->TraceConnectWithoutContext ("LostPacketBecauseUnderSensitivity",
-									   MakeCallback (&UnderSensitivityCallback));
+									   MakeBoundCallback (&OutcomeCallback, UNDER_SENSITIVITY));
   }
 
   if (printdev)
@@ -406,6 +373,18 @@ int main (int argc, char *argv[])
   }
 
 
+  if (!trace.empty ())
+  {
+    if (!NSLORA_TRACE_COMPILED)
+    {
+      std::cerr << "tracing is compiled out, build with -DNSLORA_TRACE_ENABLE" << std::endl;
+    }
+    else if (!TraceLog::Get ().Open (trace))
+    {
+      std::cerr << "cannot create " << trace << std::endl;
+    }
+  }
+
   // Start simulation
   appContainer.Start (Seconds (0));
   appContainer.Stop (appStopTime);
@@ -413,6 +392,7 @@ int main (int argc, char *argv[])
   Simulator::Stop (appStopTime);
   Simulator::Run ();
   Simulator::Destroy ();
+  TraceLog::Get ().Close ();
 
   Ptr<SimpleNetworkServer> aps = DynamicCast<SimpleNetworkServer>(serverContainer.Get(0));
   NS_ASSERT (aps != 0);
@@ -0,0 +1,220 @@
+/*
+ * nslora-sf-assignment.h
+ *
+ * Bulk spreading factor assignment for large deployments.
+ *
+ * LoraMacHelper::SetSpreadingFactorsUp evaluates the channel for every
+ * ED-gateway pair through GetObject, GetPosition and CalcRxPower calls.
+ * With a loss model that only depends on distance and never decreases
+ * with it, the gateway with the highest RX power is the nearest one, so
+ * BulkSfHelper finds it with a plain arithmetic kernel over
+ * structure-of-arrays positions, split across threads, and then asks the
+ * channel for the RX power of that single pair.  The thresholds are the
+ * ones SetSpreadingFactorsUp applies, so the assignment is the same.
+ */
+
+#ifndef NSLORA_SF_ASSIGNMENT_H
+#define NSLORA_SF_ASSIGNMENT_H
+
+#include "ns3/lora-channel.h"
+#include "ns3/lora-net-device.h"
+#include "ns3/end-device-lora-mac.h"
+#include "ns3/end-device-lora-phy.h"
+#include "ns3/mobility-model.h"
+#include "ns3/node-container.h"
+
+#include "nslora-hex-grid.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <algorithm>
+#include <thread>
+#include <vector>
+
+namespace nslora {
+
+/**
+ * For each of n points, the index of the nearest of ng gateways.  Ties go
+ * to the lowest index, as in SetSpreadingFactorsUp.
+ */
+inline void
+FindNearestGateways (const double *x, const double *y, const double *z, size_t n,
+                     const double *gx, const double *gy, const double *gz, size_t ng,
+                     uint32_t *nearest)
+{
+  // Blocks small enough to stay in L1; the inner loop is branch-free so
+  // the compiler can vectorize it across end devices
+  const size_t BLOCK = 256;
+  double best[BLOCK];
+  uint32_t index[BLOCK];
+  for (size_t start = 0; start < n; start += BLOCK)
+    {
+      size_t m = std::min (BLOCK, n - start);
+      const double *bx = x + start;
+      const double *by = y + start;
+      const double *bz = z + start;
+      for (size_t i = 0; i < m; i++)
+        {
+          best[i] = __builtin_inf ();
+          index[i] = 0;
+        }
+      for (size_t g = 0; g < ng; g++)
+        {
+          const double cx = gx[g];
+          const double cy = gy[g];
+          const double cz = gz[g];
+          const uint32_t cg = g;
+          for (size_t i = 0; i < m; i++)
+            {
+              double dx = bx[i] - cx;
+              double dy = by[i] - cy;
+              double dz = bz[i] - cz;
+              double d2 = dx * dx + dy * dy + dz * dz;
+              bool closer = d2 < best[i];
+              best[i] = closer ? d2 : best[i];
+              index[i] = closer ? cg : index[i];
+            }
+        }
+      std::copy (index, index + m, nearest + start);
+    }
+}
+
+} // namespace nslora
+
+namespace ns3 {
+
+class BulkSfHelper
+{
+public:
+  /**
+   * \param threads worker threads for the gateway search, 0 for one per core
+   */
+  BulkSfHelper (unsigned threads = 0);
+
+  /**
+   * Assign the data rate of every end device as SetSpreadingFactorsUp
+   * does, assuming devices transmit at 14 dBm.
+   *
+   * \return the number of devices per SF, SF7 first, and the number of
+   * devices out of range of every gateway last
+   */
+  std::vector<int> SetSpreadingFactorsUp (NodeContainer endDevices, NodeContainer gateways,
+                                          Ptr<LoraChannel> channel);
+
+  /**
+   * Find the nearest gateway with the O(1) lookup of the allocator the
+   * gateways were placed with, instead of searching all of them.
+   */
+  void SetHexGrid (Ptr<HexGridPositionAllocator> grid);
+
+private:
+  unsigned m_threads;
+  Ptr<HexGridPositionAllocator> m_grid;
+};
+
+inline
+BulkSfHelper::BulkSfHelper (unsigned threads)
+  : m_threads (threads)
+{
+}
+
+inline void
+BulkSfHelper::SetHexGrid (Ptr<HexGridPositionAllocator> grid)
+{
+  m_grid = grid;
+}
+
+inline std::vector<int>
+BulkSfHelper::SetSpreadingFactorsUp (NodeContainer endDevices, NodeContainer gateways,
+                                     Ptr<LoraChannel> channel)
+{
+  std::vector<int> sfQuantity (7, 0);
+  size_t n = endDevices.GetN ();
+  size_t ng = gateways.GetN ();
+  if (n == 0 || ng == 0)
+    {
+      return sfQuantity;
+    }
+
+  // Gather positions once; object lookups are not thread safe
+  std::vector<Ptr<MobilityModel> > edMobility (n);
+  std::vector<double> x (n), y (n), z (n);
+  for (size_t i = 0; i < n; i++)
+    {
+      edMobility[i] = endDevices.Get (i)->GetObject<MobilityModel> ();
+      NS_ASSERT (edMobility[i] != 0);
+      Vector pos = edMobility[i]->GetPosition ();
+      x[i] = pos.x;
+      y[i] = pos.y;
+      z[i] = pos.z;
+    }
+  std::vector<Ptr<MobilityModel> > gwMobility (ng);
+  std::vector<double> gx (ng), gy (ng), gz (ng);
+  for (size_t g = 0; g < ng; g++)
+    {
+      gwMobility[g] = gateways.Get (g)->GetObject<MobilityModel> ();
+      Vector pos = gwMobility[g]->GetPosition ();
+      gx[g] = pos.x;
+      gy[g] = pos.y;
+      gz[g] = pos.z;
+    }
+
+  std::vector<uint32_t> nearest (n);
+  if (m_grid != 0 && m_grid->GetN () == ng)
+    {
+      // Gateways share one height, so the nearest in the plane is the
+      // nearest in space
+      for (size_t i = 0; i < n; i++)
+        {
+          nearest[i] = m_grid->GetNearest (x[i], y[i]);
+        }
+    }
+  else
+    {
+      unsigned threads = m_threads ? m_threads : std::max (1u, std::thread::hardware_concurrency ());
+      // Not worth a thread below a few thousand devices
+      threads = std::max<size_t> (1, std::min<size_t> (threads, n / 4096));
+      std::vector<std::thread> workers;
+      size_t chunk = (n + threads - 1) / threads;
+      for (size_t start = 0; start < n; start += chunk)
+        {
+          size_t count = std::min (chunk, n - start);
+          workers.push_back (std::thread (nslora::FindNearestGateways,
+                                          &x[start], &y[start], &z[start], count,
+                                          &gx[0], &gy[0], &gz[0], ng, &nearest[start]));
+        }
+      for (size_t t = 0; t < workers.size (); t++)
+        {
+          workers[t].join ();
+        }
+    }
+
+  for (size_t i = 0; i < n; i++)
+    {
+      double rxPower = channel->GetRxPower (14, edMobility[i], gwMobility[nearest[i]]);
+      uint8_t dataRate = 0;
+      int bucket = 6;
+      for (int sf = 7; sf <= 12; sf++)
+        {
+          // SetSpreadingFactorsUp compares with the end device sensitivity
+          if (rxPower > EndDeviceLoraPhy::sensitivity[sf - 7])
+            {
+              dataRate = 12 - sf;
+              bucket = sf - 7;
+              break;
+            }
+        }
+      sfQuantity[bucket]++;
+
+      Ptr<LoraNetDevice> loraNetDevice = endDevices.Get (i)->GetDevice (0)->GetObject<LoraNetDevice> ();
+      NS_ASSERT (loraNetDevice != 0);
+      Ptr<EndDeviceLoraMac> mac = loraNetDevice->GetMac ()->GetObject<EndDeviceLoraMac> ();
+      NS_ASSERT (mac != 0);
+      mac->SetDataRate (dataRate);
+    }
+  return sfQuantity;
+}
+
+} // namespace ns3
+
+#endif /* NSLORA_SF_ASSIGNMENT_H */
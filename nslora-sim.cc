@@ -25,11 +25,88 @@
 #include "ns3/one-shot-sender-helper.h"
 #include "ns3/simple-network-server.h"
 #include <string.h>
+#include <functional>
+#include <queue>
+#include <unordered_map>
+
+#ifdef NS3_MPI
+#include "ns3/mpi-interface.h"
+#include <mpi.h>
+#endif
+
+#include "nslora-cached-loss.h"
+#include "nslora-coverage.h"
+#include "nslora-culled-channel.h"
+#include "nslora-estimator.h"
+#include "nslora-event-profile.h"
+#include "nslora-hex-grid.h"
+#include "nslora-histogram.h"
+#include "nslora-packet-log.h"
+#include "nslora-packet-tracker.h"
+#include "nslora-partition.h"
+#include "nslora-population.h"
+#include "nslora-profile.h"
+#include "nslora-replication.h"
+#include "nslora-scheduler.h"
+#include "nslora-sf-assignment.h"
+#include "nslora-stats.h"
+#include "nslora-sweep.h"
+#include "nslora-timeseries.h"
+#include "nslora-topology.h"
+#include "nslora-trace-log.h"
+#include "nslora-traffic-replay.h"
 
 using namespace ns3;
+using namespace nslora;
 
 NS_LOG_COMPONENT_DEFINE ("NsLoraSim");
 
+// Run-wide options set from the command line, shared by every sweep point
+struct SimOptions {
+	// Finalize packets on interference too, and evict stale tracker entries
+	bool boundedTracker = false;
+	// Write every gateway outcome to dat/<mode>/pkt-*.bin
+	bool packetLog = false;
+	// Only deliver uplinks to the end devices within reach of them
+	bool cullChannel = false;
+	// Precompute the ED-gateway path losses once per run
+	bool cacheLoss = false;
+	// Assign SFs with the threaded nearest-gateway search
+	bool bulkSf = false;
+	// Place the gateways on real hexagonal rings
+	bool hexGrid = false;
+	// Inter-site distance of the hex grid, 0 to fit the rings in the disc
+	double gatewayDistance = 0;
+	// Restore placement and SFs from dat/topo-*.bin when a matching one exists
+	bool snapshot = false;
+	// Write the phase timings of every run to dat/<mode>/prof-*.json.  Only
+	// a single run times its csv phase; a sweep appends the rows itself
+	bool profile = false;
+	// Count and time the executed events by type to dat/<mode>/events-*.csv
+	bool eventProfile = false;
+	// Record transmissions and outcomes to dat/<mode>/trace-*.bin
+	bool trace = false;
+	// Count outcomes by SF, gateway and distance to dat/<mode>/stats-*.csv
+	bool stats = false;
+	// Width of the distance rings of the outcome counters, m
+	double distanceBin = 500;
+	// Width of the time series windows in dat/<mode>/series-*.csv, s, 0 for none
+	double window = 0;
+	// Replay the uplinks of this traffic file instead of the periodic senders
+	std::string traffic;
+	// How far ahead the replayed sends are scheduled, s
+	double trafficWindow = 1;
+	// Write the per-SF delay histograms to dat/<mode>/lat-*.bin
+	bool latency = false;
+	// Keep the end devices as rows of a CompactPopulation instead of nodes;
+	// no traffic replay, snapshot or device map then
+	bool compact = false;
+	// Event scheduler, see GetSchedulerType
+	std::string scheduler = "map";
+	// Width of the buckets of the bucket scheduler, s, 0 to tune it to the load
+	double bucketWidth = 0;
+};
+
 class NsLoraSim {
 public:
 	NsLoraSim ();
@@ -38,6 +115,28 @@ public:
 	NsLoraSim (int, double, uint8_t, uint64_t);
 	~NsLoraSim ();
 	void Run (void);
+	void Simulate (void);
+	std::string GetResultFile (std::string prefix = "dat") const;
+	std::string GetResultRow (void) const;
+	Estimate EstimateOutcomes (uint32_t samples) const;
+	std::string GetEstimateRow (const Estimate &) const;
+	bool WriteCoverage (uint32_t cells, std::string path) const;
+	double GetReceivedProb (void) const;
+	double GetAverageDelay (void) const;
+	void SetOptions (const SimOptions &);
+	void SetPartition (uint32_t, uint32_t);
+	void SetAppPeriod (uint8_t);
+	void SetPrintDevices (bool);
+	const PhaseProfiler &GetProfile (void) const;
+	double GetSetupSeconds (void) const;
+	uint64_t GetEventCount (void) const;
+	void WriteProfile (void) const;
+	void WriteProfileJson (std::ostream &) const;
+	void WriteEventProfile (void) const;
+	void WriteStats (void) const;
+	void WriteSeries (void) const;
+	void WriteLatency (void) const;
+	void WriteSidecars (void) const;
 private:
 	int nDevices;
 	uint8_t gatewayRings;
@@ -58,30 +157,94 @@ private:
 	bool printdev;
 	int mode = 0;
 
-	enum PacketOutcome {
-	  RECEIVED,
-	  INTERFERED,
-	  NO_MORE_RECEIVERS,
-	  UNDER_SENSITIVITY,
-	  UNSET
-	};
-
-	struct PacketStatus {
-	  Ptr<Packet const> packet;
-	  uint32_t senderId;
-	  int outcomeNumber;
-	  std::vector<enum PacketOutcome> outcomes;
+	std::string resultRow;
+	double receivedProb = 0;
+	double averageDelay = 0;
+
+	SimOptions options;
+
+	PacketTracker packetTracker;
+	Time trackerWindow;
+	uint32_t evicted = 0;
+
+	// Node id of the first gateway; gateway node ids are consecutive
+	uint32_t firstGatewayId = 0;
+
+	// Spreading factor of each end device, indexed by node id, or by its
+	// row of the compact population
+	std::vector<uint8_t> deviceSf;
+	PacketLogWriter *packetLog = 0;
+
+	Ptr<CulledLoraChannel> culledChannel;
+
+	OutcomeStats outcomeStats;
+	// Distance ring of every ED-gateway pair, nDevices rows of nGateways
+	std::vector<uint8_t> distanceBins;
+
+	WindowedSeries series;
+	// When each uplink on the air ends, earliest first, for the in-flight
+	// column of the series
+	std::priority_queue<int64_t, std::vector<int64_t>, std::greater<int64_t> > airEnds;
+
+	// Delay from the application handing a packet to the MAC to the
+	// first copy reaching the network server, by SF of the sender, in
+	// microseconds
+	std::vector<LatencyHistogram> latency;
+	// When the MAC of an end device took each packet from its application,
+	// by UID, until the packet goes on the air
+	std::unordered_map<uint64_t, int64_t> macSendTime;
+	// Uplinks the applications handed over, and those the duty cycle
+	// dropped rather than sent
+	uint64_t handedOver = 0;
+	uint64_t dutyCycleDrops = 0;
+	// Packets a gateway received, by UID, until their first copy reaches
+	// the network server
+	struct Delivery
+	{
+		int64_t handedOver;
+		uint32_t sender;
+		int64_t sendTime;
+		uint8_t sf;
 	};
-
-	std::map<Ptr<Packet const>, PacketStatus> packetTracker;
-
-	void CheckReceptionByAllGWsComplete (std::map<Ptr<Packet const>, PacketStatus>::iterator );
+	std::unordered_map<uint64_t, Delivery> pendingDeliveries;
+	// Uplinks whose first copy reached the server of this rank
+	uint64_t serverReceived = 0;
+	// With several ranks, those uplinks as sender, send time step, delay
+	// in microseconds and SF; another rank may have had them first, see
+	// ReducePartitions
+	std::vector<uint64_t> firstArrivals;
+
+	// This process simulates the receptions of the gateways of region
+	// rank out of ranks, see nslora-partition.h
+	uint32_t rank = 0;
+	uint32_t ranks = 1;
+	std::vector<uint8_t> localGateway;
+	uint32_t localGateways = 0;
+
+	PhaseProfiler profile;
+	uint64_t eventCount = 0;
+	EventProfile eventProfile;
+
+	void CheckReceptionByAllGWsComplete (PacketTracker::Handle);
+	void PartitionGateways (NodeContainer , Ptr<LoraChannel> );
+	void ReducePartitions (void);
+	void EvictStalePackets (void);
+	void LogOutcome (PacketTracker::Handle, uint32_t, enum PacketOutcome);
+	void CountOutcome (PacketTracker::Handle, uint32_t, enum PacketOutcome);
+	void RecordLatency (PacketTracker::Handle);
+	void SetPacketOutcome (Ptr<Packet const>, uint32_t, enum PacketOutcome, bool);
+	void MacSendCallback (Ptr<Packet const>);
+	void MacDropCallback (Ptr<Packet const>);
 	void TransmissionCallback (Ptr<Packet const>, uint32_t );
-	void PacketReceptionCallback (Ptr<Packet const> , uint32_t );
-	void InterferenceCallback (Ptr<Packet const> , uint32_t );
-	void NoMoreReceiversCallback (Ptr<Packet const> , uint32_t );
-	void UnderSensitivityCallback (Ptr<Packet const> , uint32_t );
+	void PopulationSendCallback (Ptr<Packet const>, uint32_t, Time);
+	void ServerReceptionCallback (Ptr<Packet const>);
+	static void OutcomeCallback (NsLoraSim *, enum PacketOutcome, Ptr<Packet const>, uint32_t);
 	void CreateMap (NodeContainer , NodeContainer , NodeContainer , std::string );
+	Ptr<PositionAllocator> CreateGatewayAllocator (void) const;
+	TopologyKey GetTopologyKey (void) const;
+	std::string GetTopologyFile (void) const;
+	bool RestoreTopology (NodeContainer , NodeContainer );
+	void SaveTopology (NodeContainer , NodeContainer );
 };
 
 NsLoraSim::NsLoraSim () :
@@ -155,112 +318,308 @@ NsLoraSim::~NsLoraSim()
 }
 
 void
-NsLoraSim::CheckReceptionByAllGWsComplete (std::map<Ptr<Packet const>, PacketStatus>::iterator it)
+NsLoraSim::CheckReceptionByAllGWsComplete (PacketTracker::Handle h)
 {
   // Check whether this packet is received by all gateways
-  if ((*it).second.outcomeNumber == nGateways)
+  if (packetTracker.GetOutcomeNumber (h) == localGateways)
     {
       // Update the statistics
-      PacketStatus status = (*it).second;
-      for (int j = 0; j < nGateways; j++)
-        {
-          switch (status.outcomes.at (j))
-            {
-            case RECEIVED:
-              {
-                received += 1;
-                break;
-              }
-            case UNDER_SENSITIVITY:
-              {
-                underSensitivity += 1;
-                break;
-              }
-            case NO_MORE_RECEIVERS:
-              {
-                noMoreReceivers += 1;
-                break;
-              }
-            case INTERFERED:
-              {
-                interfered += 1;
-                break;
-              }
-            case UNSET:
-              {
-                break;
-              }
-            }
-        }
+      int counts[UNSET] = {0, 0, 0, 0};
+      packetTracker.CountOutcomes (h, counts);
+      received += counts[RECEIVED];
+      underSensitivity += counts[UNDER_SENSITIVITY];
+      noMoreReceivers += counts[NO_MORE_RECEIVERS];
+      interfered += counts[INTERFERED];
+
       // Remove the packet from the tracker
-      packetTracker.erase (it);
+      packetTracker.Erase (h);
     }
 }
 
+// Keep the gateways of this rank's region on the channel and drop the
+// others, so only their receptions are simulated here.  Every rank runs
+// every end device, in the same order, so placement, SF assignment and
+// the uplinks are the same on all of them.  A gateway outcome depends on
+// every uplink, those under sensitivity included, through interference
+// and busy reception paths, so each region needs every uplink anyway:
+// replicating a device is cheaper than sending its uplinks to all ranks,
+// and remote events would be bounded by the propagation delay across a
+// region border, microseconds, for a synchronization per microsecond
 void
-NsLoraSim::TransmissionCallback (Ptr<Packet const> packet, uint32_t systemId)
+NsLoraSim::PartitionGateways (NodeContainer gateways, Ptr<LoraChannel> channel)
 {
-  // NS_LOG_DEBUG ("Transmitted a packet from device " << systemId);
-  // Create a packetStatus
-  PacketStatus status;
-  status.packet = packet;
-  status.senderId = systemId;
-  status.outcomeNumber = 0;
-  status.outcomes = std::vector<enum PacketOutcome> (nGateways, UNSET);
+	std::vector<double> x (nGateways), y (nGateways);
+	for (int g = 0; g < nGateways; g++)
+	{
+		Vector pos = gateways.Get (g)->GetObject<MobilityModel> ()->GetPosition ();
+		x[g] = pos.x;
+		y[g] = pos.y;
+	}
+	std::vector<uint32_t> owner = PartitionBySector (&x[0], &y[0], nGateways, ranks);
+	localGateway.assign (nGateways, 0);
+	localGateways = 0;
+	for (int g = 0; g < nGateways; g++)
+	{
+		if (owner[g] == rank)
+		{
+			localGateway[g] = 1;
+			localGateways++;
+			continue;
+		}
+		Ptr<LoraNetDevice> loraNetDevice = gateways.Get (g)->GetDevice (0)->GetObject<LoraNetDevice> ();
+		channel->Remove (loraNetDevice->GetPhy ());
+	}
+	if (ranks > 1)
+	{
+		NS_LOG_INFO ("rank " << rank << " simulates " << localGateways << " of " << nGateways << " gateways");
+	}
+}
 
-  packetTracker.insert (std::pair<Ptr<Packet const>, PacketStatus> (packet, status));
+// Sum the outcome counters of every rank and weigh their average delays by
+// the uplinks their servers got.  An uplink whose copies reached the
+// servers of several ranks is delayed until the first of them: rank 0
+// gathers the arrivals and fills the delay histograms with the earliest
+// per uplink
+void
+NsLoraSim::ReducePartitions (void)
+{
+#ifdef NS3_MPI
+	if (ranks <= 1)
+	{
+		return;
+	}
+	double local[6] = { double (received), double (interfered), double (noMoreReceivers), double (underSensitivity),
+			averageDelay * serverReceived, double (serverReceived) };
+	double total[6];
+	MPI_Allreduce (local, total, 6, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+	received = int (total[0]);
+	interfered = int (total[1]);
+	noMoreReceivers = int (total[2]);
+	underSensitivity = int (total[3]);
+	averageDelay = total[5] > 0 ? total[4] / total[5] : 0;
+
+	int count = int (firstArrivals.size ());
+	std::vector<int> counts (ranks, 0);
+	std::vector<int> offsets (ranks, 0);
+	MPI_Gather (&count, 1, MPI_INT, &counts[0], 1, MPI_INT, 0, MPI_COMM_WORLD);
+	size_t size = 0;
+	for (uint32_t r = 0; r < ranks; r++)
+	{
+		offsets[r] = int (size);
+		size += counts[r];
+	}
+	std::vector<uint64_t> all (std::max (size, size_t (1)));
+	MPI_Gatherv (firstArrivals.empty () ? 0 : &firstArrivals[0], count, MPI_UINT64_T,
+			&all[0], &counts[0], &offsets[0], MPI_UINT64_T, 0, MPI_COMM_WORLD);
+	if (rank != 0)
+	{
+		return;
+	}
+	std::vector<size_t> order (size / 4);
+	for (size_t i = 0; i < order.size (); i++)
+	{
+		order[i] = 4 * i;
+	}
+	// By uplink, earliest arrival first
+	std::sort (order.begin (), order.end (), [&all] (size_t a, size_t b)
+	{
+		return std::lexicographical_compare (&all[a], &all[a] + 3, &all[b], &all[b] + 3);
+	});
+	for (size_t i = 0; i < order.size (); i++)
+	{
+		const uint64_t *arrival = &all[order[i]];
+		if (i > 0 && arrival[0] == all[order[i - 1]] && arrival[1] == all[order[i - 1] + 1])
+		{
+			continue;
+		}
+		latency[arrival[3] - 7].Add (arrival[2]);
+	}
+#endif
 }
 
 void
-NsLoraSim::PacketReceptionCallback (Ptr<Packet const> packet, uint32_t systemId)
+NsLoraSim::EvictStalePackets (void)
 {
-  std::map<Ptr<Packet const>, PacketStatus>::iterator it = packetTracker.find (packet);
-  (*it).second.outcomes.at (systemId - nDevices) = RECEIVED;
-  (*it).second.outcomeNumber += 1;
+  // Every gateway has reported on a packet sent more than one window ago,
+  // unless the report never comes (a lost interference report, or a
+  // reception cut short by the end of the run)
+  int counts[UNSET] = {0, 0, 0, 0};
+  Time cutoff = Simulator::Now () - trackerWindow;
+  evicted += packetTracker.Evict (cutoff.GetTimeStep (), counts);
+  received += counts[RECEIVED];
+  underSensitivity += counts[UNDER_SENSITIVITY];
+  noMoreReceivers += counts[NO_MORE_RECEIVERS];
+  interfered += counts[INTERFERED];
+
+  Simulator::Schedule (trackerWindow, &NsLoraSim::EvictStalePackets, this);
+}
 
-  // Ptr<Packet> pkt = packet->Copy ();
-  // LoraTag tag;
-  // pkt->RemovePacketTag(tag);
-  // uint16_t sendtime = tag.GetSendtime();
+void
+NsLoraSim::SetPacketOutcome (Ptr<Packet const> packet, uint32_t systemId, enum PacketOutcome outcome, bool check)
+{
+  PacketTracker::Handle h = packetTracker.Find (packet->GetUid ());
+  if (h == PacketTracker::NONE)
+    {
+      // Not an uplink started by one of our end devices
+      return;
+    }
+  if (outcome == RECEIVED)
+    {
+      RecordLatency (h);
+    }
+  packetTracker.SetOutcome (h, systemId - firstGatewayId, outcome);
+  NSLORA_TRACE (TRACE_OUTCOME, systemId, packet->GetUid (), outcome, 0);
 
-  // Remove the successfully received packet from the list of sent ones
-  // NS_LOG_INFO ("A packet was successfully received at server " << systemId << " stime: " << sendtime);
+  if (packetLog)
+    {
+      LogOutcome (h, systemId - firstGatewayId, outcome);
+    }
+  if (options.stats)
+    {
+      CountOutcome (h, systemId - firstGatewayId, outcome);
+    }
+  if (options.window > 0)
+    {
+      series.AddOutcome (packetTracker.GetSendTime (h), outcome);
+    }
 
-  CheckReceptionByAllGWsComplete (it);
+  if (check)
+    {
+      CheckReceptionByAllGWsComplete (h);
+    }
 }
 
 void
-NsLoraSim::InterferenceCallback (Ptr<Packet const> packet, uint32_t systemId)
+NsLoraSim::LogOutcome (PacketTracker::Handle h, uint32_t gateway, enum PacketOutcome outcome)
 {
-	// NS_LOG_INFO ("A packet was interferenced " << systemId);
+  uint32_t senderId = packetTracker.GetSenderId (h);
+  uint8_t sf = senderId < deviceSf.size () ? deviceSf[senderId] : 0;
+  packetLog->Write (senderId, gateway, outcome, sf,
+                    TimeStep (packetTracker.GetSendTime (h)).GetNanoSeconds ());
+}
 
-	std::map<Ptr<Packet const>, PacketStatus>::iterator it = packetTracker.find (packet);
-	it->second.outcomes.at (systemId - nDevices) = INTERFERED;
-	it->second.outcomeNumber += 1;
+void
+NsLoraSim::CountOutcome (PacketTracker::Handle h, uint32_t gateway, enum PacketOutcome outcome)
+{
+  uint32_t senderId = packetTracker.GetSenderId (h);
+  if (senderId < deviceSf.size ())
+    {
+      outcomeStats.Add (deviceSf[senderId], gateway, distanceBins[size_t (senderId) * nGateways + gateway], outcome);
+    }
 }
 
 void
-NsLoraSim::NoMoreReceiversCallback (Ptr<Packet const> packet, uint32_t systemId)
+NsLoraSim::RecordLatency (PacketTracker::Handle h)
 {
-  // NS_LOG_INFO ("A packet was lost because there were no more receivers at gateway " << systemId);
+  // The server takes the first copy of a packet; later gateways only
+  // duplicate it
+  for (int g = 0; g < nGateways; g++)
+    {
+      if (packetTracker.GetOutcome (h, g) == RECEIVED)
+        {
+          return;
+        }
+    }
+  // The delay ends when the forwarded copy reaches the server
+  uint32_t senderId = packetTracker.GetSenderId (h);
+  Delivery delivery;
+  delivery.handedOver = packetTracker.GetSendTime (h) - MicroSeconds (packetTracker.GetWait (h)).GetTimeStep ();
+  delivery.sender = senderId;
+  delivery.sendTime = packetTracker.GetSendTime (h);
+  delivery.sf = senderId < deviceSf.size () ? deviceSf[senderId] : 12;
+  pendingDeliveries.insert (std::make_pair (packetTracker.GetUid (h), delivery));
+}
 
-  std::map<Ptr<Packet const>, PacketStatus>::iterator it = packetTracker.find (packet);
-  (*it).second.outcomes.at (systemId - nDevices) = NO_MORE_RECEIVERS;
-  (*it).second.outcomeNumber += 1;
+void
+NsLoraSim::ServerReceptionCallback (Ptr<Packet const> packet)
+{
+  std::unordered_map<uint64_t, Delivery>::iterator it = pendingDeliveries.find (packet->GetUid ());
+  if (it == pendingDeliveries.end ())
+    {
+      // A later copy, or not an uplink of ours
+      return;
+    }
+  Time delay = Simulator::Now () - TimeStep (it->second.handedOver);
+  serverReceived++;
+  if (ranks > 1)
+    {
+      // Every rank sends every uplink, so the sender and the send time
+      // name it on all of them
+      uint64_t arrival[4] = { it->second.sender, uint64_t (it->second.sendTime),
+                              uint64_t (delay.GetMicroSeconds ()), it->second.sf };
+      firstArrivals.insert (firstArrivals.end (), arrival, arrival + 4);
+    }
+  else
+    {
+      latency[it->second.sf - 7].Add (delay.GetMicroSeconds ());
+    }
+  pendingDeliveries.erase (it);
+}
 
-  CheckReceptionByAllGWsComplete (it);
+void
+NsLoraSim::MacSendCallback (Ptr<Packet const> packet)
+{
+  // A send the duty cycle postpones may come through again; the first
+  // time is when the application handed it over
+  if (macSendTime.insert (std::make_pair (packet->GetUid (), Simulator::Now ().GetTimeStep ())).second)
+    {
+      handedOver++;
+    }
 }
 
 void
-NsLoraSim::UnderSensitivityCallback (Ptr<Packet const> packet, uint32_t systemId)
+NsLoraSim::MacDropCallback (Ptr<Packet const> packet)
 {
-  // NS_LOG_INFO ("A packet arrived at the gateway under sensitivity at gateway " << systemId);
+  dutyCycleDrops += macSendTime.erase (packet->GetUid ());
+}
 
-  std::map<Ptr<Packet const>, PacketStatus>::iterator it = packetTracker.find (packet);
-  (*it).second.outcomes.at (systemId - nDevices) = UNDER_SENSITIVITY;
-  (*it).second.outcomeNumber += 1;
+void
+NsLoraSim::PopulationSendCallback (Ptr<Packet const> packet, uint32_t device, Time wait)
+{
+  // The population has no MAC to trace; it reports the wait itself
+  TransmissionCallback (packet, device);
+  PacketTracker::Handle h = packetTracker.Find (packet->GetUid ());
+  if (h != PacketTracker::NONE)
+    {
+      packetTracker.SetWait (h, uint32_t (wait.GetMicroSeconds ()));
+    }
+}
+
+void
+NsLoraSim::TransmissionCallback (Ptr<Packet const> packet, uint32_t systemId)
+{
+  // NS_LOG_DEBUG ("Transmitted a packet from device " << systemId);
+  NSLORA_TRACE (TRACE_TRANSMIT, systemId, packet->GetUid (), 0, 0);
+  PacketTracker::Handle h = packetTracker.Insert (packet->GetUid (), systemId, Simulator::Now ().GetTimeStep ());
+  std::unordered_map<uint64_t, int64_t>::iterator sent = macSendTime.find (packet->GetUid ());
+  if (sent != macSendTime.end ())
+    {
+      packetTracker.SetWait (h, uint32_t ((Simulator::Now () - TimeStep (sent->second)).GetMicroSeconds ()));
+      macSendTime.erase (sent);
+    }
+  if (options.window > 0)
+    {
+      // On the air for its airtime, however long the tracker keeps it
+      const int64_t now = Simulator::Now ().GetTimeStep ();
+      while (!airEnds.empty () && airEnds.top () <= now)
+        {
+          airEnds.pop ();
+        }
+      LoraTxParameters params;
+      params.sf = systemId < deviceSf.size () ? deviceSf[systemId] : 12;
+      airEnds.push (now + LoraPhy::GetOnAirTime (ConstCast<Packet> (packet), params).GetTimeStep ());
+      series.AddTransmission (now, airEnds.size ());
+    }
+}
 
-  CheckReceptionByAllGWsComplete (it);
+// One handler for every gateway outcome, the simulation and the outcome
+// are bound at hookup
+void
+NsLoraSim::OutcomeCallback (NsLoraSim *sim, enum PacketOutcome outcome, Ptr<Packet const> packet, uint32_t systemId)
+{
+  // Another gateway may still report on an interfered packet; only the
+  // bounded tracker settles it on this report
+  sim->SetPacketOutcome (packet, systemId, outcome, outcome != INTERFERED || sim->options.boundedTracker);
 }
 
 void
@@ -310,19 +669,142 @@ NsLoraSim::CreateMap (NodeContainer eds, NodeContainer gws, NodeContainer svr, s
 	oss.clear ();
 }
 
+TopologyKey
+NsLoraSim::GetTopologyKey (void) const
+{
+	// Everything else the placement and the SF assignment depend on: the
+	// disc, the gateway layout, the loss model of Simulate, and the loss,
+	// channel and code path the SFs are computed with
+	double config[9] = { radius, double (options.hexGrid), options.gatewayDistance, double (nGateways),
+			3.76, 8.1, double (options.cacheLoss), double (options.cullChannel), double (options.bulkSf) };
+	TopologyKey key = { uint32_t (nDevices), gatewayRings, rRand, TopologyHash (config, sizeof (config)) };
+	return key;
+}
+
+std::string
+NsLoraSim::GetTopologyFile (void) const
+{
+	std::ostringstream oss;
+	oss << "dat/topo-"<< nDevices <<"-"<< rRand <<"-r-"<< nGateways <<".bin";
+	return oss.str ();
+}
+
+bool
+NsLoraSim::RestoreTopology (NodeContainer eds, NodeContainer gws)
+{
+	TopologySnapshot snapshot;
+	if (!snapshot.Load (GetTopologyFile (), GetTopologyKey ())
+		|| snapshot.GetNDevices () != eds.GetN () || snapshot.GetNGateways () != gws.GetN ())
+	{
+		return false;
+	}
+
+	const TopologyDevice *devices = snapshot.GetDevices ();
+	for (uint32_t i = 0; i < eds.GetN (); i++)
+	{
+		Ptr<Node> nd = eds.Get (i);
+		nd->GetObject<MobilityModel> ()->SetPosition (Vector (devices[i].x, devices[i].y, devices[i].z));
+		Ptr<LoraNetDevice> loraNetDevice = nd->GetDevice (0)->GetObject<LoraNetDevice> ();
+		Ptr<EndDeviceLoraMac> mac = loraNetDevice->GetMac ()->GetObject<EndDeviceLoraMac> ();
+		mac->SetDeviceAddress (LoraDeviceAddress (devices[i].address));
+		mac->SetDataRate (devices[i].dataRate);
+	}
+	const TopologyGateway *gateways = snapshot.GetGateways ();
+	for (uint32_t g = 0; g < gws.GetN (); g++)
+	{
+		gws.Get (g)->GetObject<MobilityModel> ()->SetPosition (Vector (gateways[g].x, gateways[g].y, gateways[g].z));
+	}
+	return true;
+}
+
 void
-NsLoraSim::Run (void)
+NsLoraSim::SaveTopology (NodeContainer eds, NodeContainer gws)
+{
+	std::vector<TopologyDevice> devices (eds.GetN ());
+	for (uint32_t i = 0; i < eds.GetN (); i++)
+	{
+		Ptr<Node> nd = eds.Get (i);
+		Vector pos = nd->GetObject<MobilityModel> ()->GetPosition ();
+		Ptr<LoraNetDevice> loraNetDevice = nd->GetDevice (0)->GetObject<LoraNetDevice> ();
+		Ptr<EndDeviceLoraMac> mac = loraNetDevice->GetMac ()->GetObject<EndDeviceLoraMac> ();
+		TopologyDevice d = { pos.x, pos.y, pos.z, mac->GetDeviceAddress ().Get (), mac->GetDataRate (), { 0, 0, 0 } };
+		devices[i] = d;
+	}
+	std::vector<TopologyGateway> gateways (gws.GetN ());
+	for (uint32_t g = 0; g < gws.GetN (); g++)
+	{
+		Vector pos = gws.Get (g)->GetObject<MobilityModel> ()->GetPosition ();
+		TopologyGateway gw = { pos.x, pos.y, pos.z };
+		gateways[g] = gw;
+	}
+	if (!TopologySnapshot::Save (GetTopologyFile (), GetTopologyKey (), devices, gateways))
+	{
+		NS_LOG_INFO ("cannot write " << GetTopologyFile ());
+	}
+}
+
+void
+NsLoraSim::Simulate (void)
 {
 	RngSeedManager::SetRun(rRand);
 	RngSeedManager::SetSeed(1);
 
+	profile.Clear ();
+	profile.Start ("setup");
+
+	eventProfile.Clear ();
+	packetTracker.Reset (nGateways);
+	evicted = 0;
+	latency.assign (6, LatencyHistogram ());
+	macSendTime.clear ();
+	pendingDeliveries.clear ();
+	serverReceived = 0;
+	firstArrivals.clear ();
+	handedOver = 0;
+	dutyCycleDrops = 0;
+	airEnds = std::priority_queue<int64_t, std::vector<int64_t>, std::greater<int64_t> > ();
+	if (options.window > 0)
+	{
+		series.Reset (Seconds (options.window).GetTimeStep (), Seconds (simulationTime).GetTimeStep (), Seconds (1).GetTimeStep ());
+	}
+	if (options.boundedTracker)
+	{
+		// Longest possible reception: a maximum-size SF12 frame, plus the
+		// propagation delay across the deployment
+		LoraTxParameters params;
+		params.sf = 12;
+		params.lowDataRateOptimizationEnabled = true;
+		trackerWindow = LoraPhy::GetOnAirTime (Create<Packet> (255), params) + Seconds (2 * radius / 299792458.0);
+		Simulator::Schedule (trackerWindow, &NsLoraSim::EvictStalePackets, this);
+	}
+
 	// Create a simple wireless channel
 	Ptr<LogDistancePropagationLossModel> loss = CreateObject<LogDistancePropagationLossModel> ();
 	loss->SetPathLossExponent (3.76);
 	loss->SetReference (1, 8.1);
 
+	// The topology is static, so the channel and the SF assignment can
+	// share one precomputed ED-gateway loss matrix
+	Ptr<PropagationLossModel> channelLoss = loss;
+	Ptr<CachedPropagationLossModel> cachedLoss;
+	if (options.cacheLoss)
+	{
+		cachedLoss = CreateObject<CachedPropagationLossModel> (loss);
+		channelLoss = cachedLoss;
+	}
+
 	Ptr<PropagationDelayModel> delay = CreateObject<ConstantSpeedPropagationDelayModel> ();
-	Ptr<LoraChannel> channel = CreateObject<LoraChannel> (loss, delay);
+	Ptr<LoraChannel> channel;
+	culledChannel = 0;
+	if (options.cullChannel)
+	{
+		culledChannel = CreateObject<CulledLoraChannel> (channelLoss, delay);
+		channel = culledChannel;
+	}
+	else
+	{
+		channel = CreateObject<LoraChannel> (channelLoss, delay);
+	}
 
 	// Helpers
 	// End Device mobility
@@ -334,15 +816,8 @@ NsLoraSim::Run (void)
 	mobilityEd.SetMobilityModel ("ns3::ConstantPositionMobilityModel");
 
 	// Gateway mobility
-	Ptr<ListPositionAllocator> positionAllocGw = CreateObject<ListPositionAllocator> ();
-	positionAllocGw->Add (Vector (0.0, 0.0, 0.0));
-	positionAllocGw->Add (Vector (-3250.0, 0.0, 0.0));
-	positionAllocGw->Add (Vector (3250.0, 0.0, 0.0));
-	positionAllocGw->Add (Vector (3250.0, 3250.0, 0.0));
-	positionAllocGw->Add (Vector (-3250.0, 3250.0, 0.0));
-	positionAllocGw->Add (Vector (-3250.0, -3250.0, 0.0));
-	positionAllocGw->Add (Vector (3250.0, -3250.0, 0.0));
-
+	Ptr<PositionAllocator> positionAllocGw = CreateGatewayAllocator ();
+	Ptr<HexGridPositionAllocator> hexGridGw = DynamicCast<HexGridPositionAllocator> (positionAllocGw);
 	mobilityGw.SetPositionAllocator(positionAllocGw);
 	mobilityGw.SetMobilityModel ("ns3::ConstantPositionMobilityModel");
 
@@ -361,9 +836,15 @@ NsLoraSim::Run (void)
 	// Create the LoraHelper
 	LoraHelper helper = LoraHelper ();
 
-	// Create EDs
+	// Create EDs; a compact population only needs one carrier per data rate
+	profile.Start ("nodes");
+	Ptr<CompactPopulation> population;
+	if (options.compact)
+	{
+		population = CreateObject<CompactPopulation> ();
+	}
 	NodeContainer endDevices;
-	endDevices.Create (nDevices);
+	endDevices.Create (population ? CompactPopulation::DATA_RATES : nDevices);
 	mobilityEd.Install (endDevices);
 	for (NodeContainer::Iterator i = endDevices.Begin(); i!= endDevices.End(); ++i)
 	{
@@ -375,6 +856,7 @@ NsLoraSim::Run (void)
 	}
 
 	// Create a LoraDeviceAddressGenerator
+	profile.Start ("install");
 	uint8_t nwkId = 54;
 	uint32_t nwkAddr = 1864;
 	Ptr<LoraDeviceAddressGenerator> addrGen = CreateObject<LoraDeviceAddressGenerator> (nwkId,nwkAddr);
@@ -388,11 +870,35 @@ NsLoraSim::Run (void)
 
 	// Install applications in EDs
 	Time appStopTime = Seconds (simulationTime);
-	PeriodicSenderHelper appHelper = PeriodicSenderHelper ();
-	appHelper.SetPeriod (Seconds (appPeriodSeconds));
-	ApplicationContainer appContainer = appHelper.Install (endDevices);
+	TrafficFileReader traffic;
+	Ptr<TrafficReplayer> replayer;
+	if (!options.traffic.empty () && population)
+	{
+		NS_LOG_INFO ("cannot replay " << options.traffic << " from a compact population");
+	}
+	else if (!options.traffic.empty ())
+	{
+		if (traffic.Open (options.traffic))
+		{
+			replayer = CreateObject<TrafficReplayer> ();
+			replayer->Setup (&traffic, endDevices);
+			replayer->SetWindow (Seconds (options.trafficWindow));
+		}
+		else
+		{
+			NS_LOG_INFO ("cannot replay " << options.traffic << ", using periodic senders");
+		}
+	}
+	ApplicationContainer appContainer;
+	if (replayer == 0 && population == 0)
+	{
+		PeriodicSenderHelper appHelper = PeriodicSenderHelper ();
+		appHelper.SetPeriod (Seconds (appPeriodSeconds));
+		appContainer = appHelper.Install (endDevices);
+	}
 
 	// GW setup
+	profile.Start ("nodes");
 	NodeContainer gateways;
 	gateways.Create (nGateways);
 	mobilityGw.Install (gateways);
@@ -407,14 +913,139 @@ NsLoraSim::Run (void)
 	}
 
 	// LoraNetDevices GW
+	profile.Start ("install");
 	phyHelper.SetDeviceType (LoraPhyHelper::GW);
 	macHelper.SetDeviceType (LoraMacHelper::GW);
 	helper.Install (phyHelper, macHelper, gateways);
+	firstGatewayId = gateways.Get (0)->GetId ();
 
-	// Set spreading factors up
-	macHelper.SetSpreadingFactorsUp (endDevices, gateways, channel);
+	profile.Start ("topology");
+	// The random placement above still runs, so that every random stream
+	// created afterwards gets the same stream number with or without one
+	bool restored = options.snapshot && population == 0 && RestoreTopology (endDevices, gateways);
+	if (restored)
+	{
+		NS_LOG_INFO ("restored topology from " << GetTopologyFile ());
+	}
+	PartitionGateways (gateways, channel);
+
+	if (cachedLoss && population == 0)
+	{
+		cachedLoss->Cache (endDevices, gateways);
+	}
+
+	profile.Start ("sf");
+	// Set spreading factors up, unless they came with the snapshot
+	if (population)
+	{
+		if (hexGridGw)
+		{
+			population->SetHexGrid (hexGridGw);
+		}
+		population->Place (nDevices, radius, gateways, channel);
+		population->SetCarriers (endDevices, channel);
+	}
+	else if (!restored && options.bulkSf)
+	{
+		BulkSfHelper sfHelper;
+		if (hexGridGw)
+		{
+			sfHelper.SetHexGrid (hexGridGw);
+		}
+		sfHelper.SetSpreadingFactorsUp (endDevices, gateways, channel);
+	}
+	else if (!restored)
+	{
+		macHelper.SetSpreadingFactorsUp (endDevices, gateways, channel);
+	}
+	if (options.snapshot && !restored && population == 0)
+	{
+		SaveTopology (endDevices, gateways);
+	}
+
+	profile.Start ("index");
+	deviceSf.assign (nDevices, 0);
+	for (int i = 0; population && i < nDevices; i++)
+	{
+		deviceSf[i] = 12 - population->GetDataRate (i);
+	}
+	for (NodeContainer::Iterator i = endDevices.Begin (); population == 0 && i != endDevices.End (); ++i)
+	{
+		Ptr<LoraNetDevice> loraNetDevice = (*i)->GetDevice (0)->GetObject<LoraNetDevice> ();
+		Ptr<EndDeviceLoraMac> mac = loraNetDevice->GetMac ()->GetObject<EndDeviceLoraMac> ();
+		deviceSf[(*i)->GetId ()] = 12 - mac->GetDataRate ();
+	}
+
+	distanceBins.clear ();
+	if (options.stats)
+	{
+		// Rings out to the far edge of the disc, as seen from its centre
+		uint32_t nBins = uint32_t (std::ceil (2*radius/options.distanceBin)) + 1;
+		outcomeStats.Reset (nGateways, nBins, options.distanceBin);
+		distanceBins.resize (size_t (nDevices) * nGateways);
+		for (int id = 0; id < nDevices; id++)
+		{
+			// End device nodes come first, so their ids are their rows
+			Vector pos = population ? population->GetPosition (id)
+					: endDevices.Get (id)->GetObject<MobilityModel> ()->GetPosition ();
+			for (int g = 0; g < nGateways; g++)
+			{
+				double d = CalculateDistance (pos, gateways.Get (g)->GetObject<MobilityModel> ()->GetPosition ());
+				distanceBins[size_t (id) * nGateways + g] = outcomeStats.GetBin (d);
+			}
+		}
+	}
+
+	if (culledChannel)
+	{
+		// Carriers are off the channel
+		NodeContainer receivers = population ? NodeContainer () : endDevices;
+		for (int g = 0; g < nGateways; g++)
+		{
+			if (localGateway[g])
+			{
+				receivers.Add (gateways.Get (g));
+			}
+		}
+		culledChannel->BuildIndex (receivers);
+	}
+
+	// The scheduler is tuned to the receptions per uplink, known from here
+	// on; events already scheduled move over to it
+	std::string schedulerType = GetSchedulerType (options.scheduler);
+	if (schedulerType == "ns3::BucketScheduler")
+	{
+		// An SF10 uplink stands in for the typical one.  Every PHY on the
+		// channel receives it: the gateways of this rank and the end
+		// devices, or on the culled channel those within its range
+		LoraTxParameters params;
+		params.sf = 10;
+		double receivers = localGateways;
+		if (population == 0)
+		{
+			double range = culledChannel ? culledChannel->GetCullRange (params.sf) : INFINITY;
+			receivers += nDevices * std::min (1.0, range * range / (radius * radius));
+		}
+		BucketScheduler::Tune (nDevices, uint32_t (receivers), Seconds (appPeriodSeconds), LoraPhy::GetOnAirTime (Create<Packet> (19), params));
+		if (options.bucketWidth > 0)
+		{
+			Config::SetDefault ("ns3::BucketScheduler::BucketWidth", TimeValue (Seconds (options.bucketWidth)));
+		}
+	}
+	ObjectFactory schedulerFactory;
+	if (options.eventProfile)
+	{
+		EventProfilingScheduler::Configure (&eventProfile, schedulerType);
+		schedulerFactory.SetTypeId ("ns3::EventProfilingScheduler");
+	}
+	else
+	{
+		schedulerFactory.SetTypeId (schedulerType);
+	}
+	Simulator::SetScheduler (schedulerFactory);
 
 	// NS setup
+	profile.Start ("install");
 	NodeContainer networkServers;
 	networkServers.Create (1);
 
@@ -431,13 +1062,34 @@ NsLoraSim::Run (void)
 	forwarderHelper.Install (gateways);
 
 	// Register the events
-	for (NodeContainer::Iterator j = endDevices.Begin (); j != endDevices.End (); ++j)
+	profile.Start ("traces");
+	if (population)
+	{
+		population->TraceConnectWithoutContext ("StartSending",
+												MakeCallback (&NsLoraSim::PopulationSendCallback, this));
+	}
+	for (NodeContainer::Iterator j = endDevices.Begin (); population == 0 && j != endDevices.End (); ++j)
 	{
 	Ptr<Node> node = *j;
 	Ptr<LoraNetDevice> loraNetDevice = node->GetDevice (0)->GetObject<LoraNetDevice> ();
 	Ptr<LoraPhy> phy = loraNetDevice->GetPhy ();
 	phy->TraceConnectWithoutContext ("StartSending",
 									 MakeCallback (&NsLoraSim::TransmissionCallback, this));
+	// The application hands packets to the MAC, which may hold them for
+	// the duty cycle
+	Ptr<LoraMac> mac = loraNetDevice->GetMac ();
+	mac->TraceConnectWithoutContext ("SentNewPacket",
+									 MakeCallback (&NsLoraSim::MacSendCallback, this));
+	mac->TraceConnectWithoutContext ("CannotSendBecauseDutyCycle",
+									 MakeCallback (&NsLoraSim::MacDropCallback, this));
+	}
+
+	// Forwarded copies reach the server over its point-to-point links
+	Ptr<Node> server = networkServers.Get (0);
+	for (uint32_t i = 0; i < server->GetNDevices (); i++)
+	{
+	server->GetDevice (i)->TraceConnectWithoutContext ("MacRx",
+													   MakeCallback (&NsLoraSim::ServerReceptionCallback, this));
 	}
 
 	// Install reception paths on gateways
@@ -453,33 +1105,105 @@ NsLoraSim::Run (void)
 
 	// Global callbacks (every gateway)
 	gwPhy->TraceConnectWithoutContext ("ReceivedPacket",
-									   MakeCallback (&NsLoraSim::PacketReceptionCallback, this));
+									   MakeBoundCallback (&NsLoraSim::OutcomeCallback, this, RECEIVED));
 	gwPhy->TraceConnectWithoutContext ("LostPacketBecauseInterference",
-									   MakeCallback (&NsLoraSim::InterferenceCallback, this));
+									   MakeBoundCallback (&NsLoraSim::OutcomeCallback, this, INTERFERED));
 	gwPhy->TraceConnectWithoutContext ("LostPacketBecauseNoMoreReceivers",
-									   MakeCallback (&NsLoraSim::NoMoreReceiversCallback, this));
+									   MakeBoundCallback (&NsLoraSim::OutcomeCallback, this, NO_MORE_RECEIVERS));
 	gwPhy->TraceConnectWithoutContext ("LostPacketBecauseUnderSensitivity",
-									   MakeCallback (&NsLoraSim::UnderSensitivityCallback, this));
+									   MakeBoundCallback (&NsLoraSim::OutcomeCallback, this, UNDER_SENSITIVITY));
 	}
 
-	if (printdev)
+	if (printdev && rank == 0 && population == 0)
 	{
 		std::ostringstream oss;
 		oss << "dat/"<< mode <<"/endDevices-"<< nDevices <<"-"<< rRand <<"-r-" << nGateways  << "-p"<< std::to_string(appPeriodSeconds) <<".dat";
 		CreateMap (endDevices, gateways, networkServers, oss.str());
 	}
 
+	PacketLogWriter log;
+	std::string packetLogPath;
+	if (options.packetLog)
+	{
+		std::ostringstream oss;
+		oss << "dat/"<< mode <<"/pkt-"<< nDevices <<"-"<< rRand <<"-r-" << nGateways  << "-p"<< std::to_string(appPeriodSeconds) <<".bin";
+		if (log.Open (oss.str (), nDevices, nGateways))
+		{
+			packetLog = &log;
+			packetLogPath = oss.str ();
+		}
+		else
+		{
+			NS_LOG_INFO ("cannot create " << oss.str ());
+		}
+	}
+
+	if (options.trace)
+	{
+		std::ostringstream oss;
+		oss << "dat/"<< mode <<"/trace-"<< nDevices <<"-"<< rRand <<"-r-" << nGateways  << "-p"<< std::to_string(appPeriodSeconds) <<".bin";
+		if (!TraceLog::Get ().Open (oss.str ()))
+		{
+			NS_LOG_INFO ("cannot create " << oss.str ());
+		}
+	}
+
 	// Start simulation
 	appContainer.Start (Seconds (0));
 	appContainer.Stop (appStopTime);
+	if (replayer)
+	{
+		replayer->Start (appStopTime);
+	}
+	if (population)
+	{
+		population->Start (Seconds (appPeriodSeconds), appStopTime);
+	}
 
 	Simulator::Stop (appStopTime);
+	profile.Start ("run");
+	// Nodes are numbered end devices first, then gateways, then the server
+	eventProfile.SetNodeKinds (gateways.Get (0)->GetId (), networkServers.Get (0)->GetId ());
+	eventProfile.Start ();
 	Simulator::Run ();
+	eventProfile.Stop ();
+	eventCount = Simulator::GetEventCount ();
+	profile.Start ("destroy");
 	Simulator::Destroy ();
+	TraceLog::Get ().Close ();
+	profile.Start ("results");
+
+	if (packetLog)
+	{
+		NS_LOG_INFO ("logged " << log.GetRecordCount () << " gateway outcomes");
+		if (!log.Close ())
+		{
+			NS_LOG_INFO ("cannot write " << packetLogPath << ", it is cut short");
+		}
+		packetLog = 0;
+	}
+
+	if (replayer)
+	{
+		NS_LOG_INFO ("replayed " << replayer->GetSentCount () << " uplinks, at most " << replayer->GetPeakPending () << " scheduled at once");
+	}
+	if (population)
+	{
+		NS_LOG_INFO ("population sent " << population->GetSentCount () << " uplinks, skipped " << population->GetSkippedCount () << " for the duty cycle");
+		handedOver = population->GetSentCount () + population->GetSkippedCount ();
+		dutyCycleDrops = population->GetSkippedCount ();
+	}
+
+	if (options.boundedTracker)
+	{
+		NS_LOG_INFO ("evicted " << evicted << " packets, " << packetTracker.GetSize () << " still in flight");
+	}
 
 	Ptr<SimpleNetworkServer> aps = DynamicCast<SimpleNetworkServer>(serverContainer.Get(0));
 	NS_ASSERT (aps != 0);
-	double receivedProb = double(received)/nDevices;
+	averageDelay = aps->GetAverageDelay();
+	ReducePartitions ();
+	receivedProb = double(received)/nDevices;
 	double interferedProb = double(interfered)/nDevices;
 	double noMoreReceiversProb = double(noMoreReceivers)/nDevices;
 	double underSensitivityProb = double(underSensitivity)/nDevices;
@@ -488,28 +1212,575 @@ NsLoraSim::Run (void)
 	double interferedProbGivenAboveSensitivity = double(interfered)/(nDevices - underSensitivity);
 	double noMoreReceiversProbGivenAboveSensitivity = double(noMoreReceivers)/(nDevices - underSensitivity);
 
+	LatencyHistogram delays;
+	for (size_t i = 0; i < latency.size (); i++)
+	{
+		delays.Merge (latency[i]);
+	}
+
+	std::ostringstream oss;
+	oss << rRand << ";" << nDevices << ";" << double(nDevices)/simulationTime << ";" << receivedProb << ";" << interferedProb << ";" << noMoreReceiversProb << ";" << underSensitivityProb <<
+	";" << receivedProbGivenAboveSensitivity << ";" << interferedProbGivenAboveSensitivity << ";" << noMoreReceiversProbGivenAboveSensitivity << ";" << averageDelay <<
+	";" << packetTracker.GetPeakSize () << ";" << packetTracker.GetPeakMemory () <<
+	";" << delays.GetValueAt (0.5) / 1e6 << ";" << delays.GetValueAt (0.9) / 1e6 << ";" << delays.GetValueAt (0.99) / 1e6 <<
+	";" << delays.GetValueAt (0.999) / 1e6 << ";" << delays.GetMax () / 1e6 <<
+	";" << (handedOver > 0 ? double(dutyCycleDrops)/handedOver : 0) << std::endl;
+	resultRow = oss.str ();
+	profile.Stop ();
+}
+
+// Gateway placement, shared by the simulation and the estimate
+Ptr<PositionAllocator>
+NsLoraSim::CreateGatewayAllocator (void) const
+{
+	if (options.hexGrid)
+	{
+		// By default the outer ring's cells just reach the edge of the disc
+		Ptr<HexGridPositionAllocator> hexGridGw = CreateObject<HexGridPositionAllocator> ();
+		hexGridGw->SetRings (gatewayRings);
+		hexGridGw->SetDistance (options.gatewayDistance > 0 ? options.gatewayDistance : 2*radius/((gatewayRings-1)*2+1));
+		return hexGridGw;
+	}
+	Ptr<ListPositionAllocator> positionAllocGw = CreateObject<ListPositionAllocator> ();
+	positionAllocGw->Add (Vector (0.0, 0.0, 0.0));
+	positionAllocGw->Add (Vector (-3250.0, 0.0, 0.0));
+	positionAllocGw->Add (Vector (3250.0, 0.0, 0.0));
+	positionAllocGw->Add (Vector (3250.0, 3250.0, 0.0));
+	positionAllocGw->Add (Vector (-3250.0, 3250.0, 0.0));
+	positionAllocGw->Add (Vector (-3250.0, -3250.0, 0.0));
+	positionAllocGw->Add (Vector (3250.0, -3250.0, 0.0));
+	return positionAllocGw;
+}
+
+// Outcome probabilities of this scenario from the analytical model
+Estimate
+NsLoraSim::EstimateOutcomes (uint32_t samples) const
+{
+	EstimatorParams params;
+	params.nDevices = nDevices;
+	params.radius = radius;
+	params.appPeriodSeconds = appPeriodSeconds;
+	params.samples = samples;
+	// A list allocator wraps around like it does for the gateway nodes
+	Ptr<PositionAllocator> positionAllocGw = CreateGatewayAllocator ();
+	for (int g = 0; g < nGateways; g++)
+	{
+		Vector pos = positionAllocGw->GetNext ();
+		params.gatewayX.push_back (pos.x);
+		params.gatewayY.push_back (pos.y);
+	}
+	return AlohaEstimator ().Run (params);
+}
+
+// Scale an estimate like the result row: outcome counts summed over every
+// uplink and gateway, per end device
+std::string
+NsLoraSim::GetEstimateRow (const Estimate &e) const
+{
+	double reports = nGateways * simulationTime / appPeriodSeconds;
+	std::ostringstream oss;
+	oss << rRand << ";" << nDevices << ";" << double(nDevices)/simulationTime << ";" << e.received * reports << ";" << e.interfered * reports <<
+	";" << e.noMoreReceivers * reports << ";" << e.underSensitivity * reports << ";" << e.pdr << std::endl;
+	return oss.str ();
+}
+
+// Best-gateway RX power and SF over a cells x cells raster of the disc
+bool
+NsLoraSim::WriteCoverage (uint32_t cells, std::string path) const
+{
+	CoverageParams params;
+	params.cells = cells;
+	params.radius = radius;
+	Ptr<PositionAllocator> positionAllocGw = CreateGatewayAllocator ();
+	for (int g = 0; g < nGateways; g++)
+	{
+		Vector pos = positionAllocGw->GetNext ();
+		params.gatewayX.push_back (pos.x);
+		params.gatewayY.push_back (pos.y);
+	}
+	CoverageMap map;
+	PhaseProfiler timer;
+	timer.Start ("coverage");
+	map.Compute (params);
+	timer.Stop ();
+	NS_LOG_INFO ("coverage of " << nGateways << " gateways on " << cells << "x" << cells << " cells in " << timer.GetTotalSeconds () << " s");
+	return map.Save (path);
+}
+
+std::string
+NsLoraSim::GetResultFile (std::string prefix) const
+{
+	std::ostringstream oss;
+	oss << "dat/"<< mode <<"/" << prefix << "-" << nDevices << "-" << simulationTime  << "-r-" << nGateways  << "-p" << std::to_string(appPeriodSeconds)  << ".csv";
+	return oss.str ();
+}
+
+std::string
+NsLoraSim::GetResultRow (void) const
+{
+	return resultRow;
+}
+
+double
+NsLoraSim::GetReceivedProb (void) const
+{
+	return receivedProb;
+}
+
+double
+NsLoraSim::GetAverageDelay (void) const
+{
+	return averageDelay;
+}
+
+void
+NsLoraSim::SetOptions (const SimOptions &m_options)
+{
+	options = m_options;
+}
+
+void
+NsLoraSim::SetPartition (uint32_t m_rank, uint32_t m_ranks)
+{
+	rank = m_rank;
+	ranks = m_ranks > 0 ? m_ranks : 1;
+}
+
+void
+NsLoraSim::SetAppPeriod (uint8_t m_appPeriod)
+{
+	appPeriodSeconds = m_appPeriod;
+}
+
+// Whether Simulate dumps the device map to dat/<mode>/endDevices-*.dat
+void
+NsLoraSim::SetPrintDevices (bool print)
+{
+	printdev = print;
+}
+
+const PhaseProfiler &
+NsLoraSim::GetProfile (void) const
+{
+	return profile;
+}
+
+// Seconds spent building the scenario, every phase before the run
+double
+NsLoraSim::GetSetupSeconds (void) const
+{
+	double setup = 0;
+	const std::vector<PhaseSample> &phases = profile.GetPhases ();
+	for (size_t i = 0; i < phases.size () && phases[i].name != "run"; i++)
+	{
+		setup += phases[i].seconds;
+	}
+	return setup;
+}
+
+uint64_t
+NsLoraSim::GetEventCount (void) const
+{
+	return eventCount;
+}
+
+void
+NsLoraSim::WriteProfile (void) const
+{
+	std::ostringstream oss;
+	oss << "dat/"<< mode <<"/prof-"<< nDevices <<"-"<< rRand <<"-r-" << nGateways  << "-p"<< std::to_string(appPeriodSeconds) <<".json";
 	std::ofstream fd;
+	fd.open (oss.str ());
+	WriteProfileJson (fd);
+	fd.close ();
+}
+
+void
+NsLoraSim::WriteProfileJson (std::ostream &os) const
+{
+	double runSeconds = profile.GetSeconds ("run");
+	os << "{\n  \"mode\": " << mode << ", \"nDevices\": " << nDevices << ", \"nGateways\": " << nGateways <<
+	", \"seed\": " << rRand << ", \"appPeriod\": " << int(appPeriodSeconds) << ", \"simulationTime\": " << simulationTime <<
+	",\n  \"events\": " << eventCount << ", \"eventsPerSecond\": " << (runSeconds > 0 ? eventCount/runSeconds : 0) <<
+	",\n  \"totalSeconds\": " << profile.GetTotalSeconds () << ", \"setupSeconds\": " << GetSetupSeconds () <<
+	", \"runSeconds\": " << runSeconds << ", \"peakRssKb\": " << PhaseProfiler::GetPeakRssKb () <<
+	",\n  \"phases\": ";
+	profile.WriteJson (os);
+	os << "\n}" << std::endl;
+}
+
+void
+NsLoraSim::WriteEventProfile (void) const
+{
 	std::ostringstream oss;
-	oss << "dat/"<< mode <<"/dat-" << nDevices << "-" << simulationTime  << "-r-" << nGateways  << "-p" << std::to_string(appPeriodSeconds)  << ".csv";
-	fd.open (oss.str(), std::ofstream::app);
+	oss << "dat/"<< mode <<"/events-"<< nDevices <<"-"<< rRand <<"-r-" << nGateways  << "-p"<< std::to_string(appPeriodSeconds) <<".csv";
+	std::ofstream fd;
+	fd.open (oss.str ());
+	eventProfile.Write (fd);
+	fd.close ();
+}
 
-	fd << rRand << ";" << nDevices << ";" << double(nDevices)/simulationTime << ";" << receivedProb << ";" << interferedProb << ";" << noMoreReceiversProb << ";" << underSensitivityProb <<
-	";" << receivedProbGivenAboveSensitivity << ";" << interferedProbGivenAboveSensitivity << ";" << noMoreReceiversProbGivenAboveSensitivity << ";" << aps->GetAverageDelay() << std::endl;
+void
+NsLoraSim::WriteStats (void) const
+{
+	std::ostringstream oss;
+	oss << "dat/"<< mode <<"/stats-"<< nDevices <<"-"<< rRand <<"-r-" << nGateways  << "-p"<< std::to_string(appPeriodSeconds) <<".csv";
+	std::ofstream fd;
+	fd.open (oss.str ());
+	outcomeStats.Write (fd);
+	fd.close ();
+}
 
+void
+NsLoraSim::WriteSeries (void) const
+{
+	std::ostringstream oss;
+	oss << "dat/"<< mode <<"/series-"<< nDevices <<"-"<< rRand <<"-r-" << nGateways  << "-p"<< std::to_string(appPeriodSeconds) <<".csv";
+	std::ofstream fd;
+	fd.open (oss.str ());
+	series.Write (fd);
 	fd.close ();
 }
 
+void
+NsLoraSim::WriteLatency (void) const
+{
+	std::ostringstream oss;
+	oss << "dat/"<< mode <<"/lat-"<< nDevices <<"-"<< rRand <<"-r-" << nGateways  << "-p"<< std::to_string(appPeriodSeconds) <<".bin";
+	if (!WriteHistograms (oss.str (), latency))
+	{
+		NS_LOG_INFO ("cannot write " << oss.str ());
+	}
+}
+
+// Per-run files written next to the result CSV
+void
+NsLoraSim::WriteSidecars (void) const
+{
+	if (options.profile)
+	{
+		WriteProfile ();
+	}
+	if (options.eventProfile)
+	{
+		WriteEventProfile ();
+	}
+	if (options.stats)
+	{
+		WriteStats ();
+	}
+	if (options.window > 0)
+	{
+		WriteSeries ();
+	}
+	if (options.latency)
+	{
+		WriteLatency ();
+	}
+}
+
+void
+NsLoraSim::Run (void)
+{
+	Simulate ();
+
+	profile.Start ("csv");
+	std::ofstream fd;
+	fd.open (GetResultFile (), std::ofstream::app);
+	fd << resultRow;
+	fd.close ();
+	profile.Stop ();
+
+	WriteSidecars ();
+}
+
+// Sequential replication of sweep points, see nslora-replication.h
+struct ReplicationOptions {
+	bool enabled = false;
+	// Confidence level of the intervals
+	double confidence = 0.95;
+	// Target half width of receivedProb, absolute
+	double receivedTarget = 0.01;
+	// Target half width of the average delay, relative to its mean, 0 to ignore
+	double delayTarget = 0;
+	uint32_t minReps = 3;
+	uint32_t maxReps = 20;
+};
+
+// Analytical pre-screening of sweep points, see nslora-estimator.h
+struct EstimateOptions {
+	// Estimate every point instead of simulating it
+	bool only = false;
+	// Leave points to the estimate whose contention losses, or whose PDR,
+	// fall below this share, 0 to simulate every point
+	double screen = 0;
+	// Monte-Carlo end device samples per estimate
+	uint32_t samples = 20000;
+};
+
+static SimOptions simOptions;
+static ReplicationOptions replication;
+static EstimateOptions estimation;
+// Schedulers every sweep point is timed with, empty for a normal sweep
+static std::vector<std::string> comparedSchedulers;
+// Simulate every sweep point on the plain and on the culled channel
+static bool compareCulling = false;
+
+static NsLoraSim
+MakeSim (const SweepPoint &p, uint64_t seed)
+{
+	NsLoraSim sim;
+	if (p.mode == 0)
+	{
+		sim = NsLoraSim (p.nDevices, p.rings, p.simulationTime, seed);
+	}
+	else
+	{
+		sim = NsLoraSim (p.rings, p.simulationTime, uint8_t (p.appPeriodSeconds), seed);
+	}
+	sim.SetOptions (simOptions);
+	return sim;
+}
+
+// Build and simulate one point of the sweep in main ()
+static SweepResult
+RunSweepPoint (const SweepPoint &p)
+{
+	NsLoraSim sim = MakeSim (p, p.seed);
+	NS_LOG_INFO (p.seed << "-th iteration... (" << p.nDevices << ", r" << p.rings << ", p" << p.appPeriodSeconds << ")");
+	sim.Simulate ();
+	NS_LOG_INFO ("DONE");
+	sim.WriteSidecars ();
+
+	SweepResult result;
+	result.file = sim.GetResultFile ();
+	result.row = sim.GetResultRow ();
+	return result;
+}
+
+// Simulate a sweep point with seeds p.seed, p.seed + 1, .. until the
+// confidence intervals are narrow enough, and summarize the replications
+static SweepResult
+RunReplicatedPoint (const SweepPoint &p)
+{
+	ReplicationStat receivedStat;
+	ReplicationStat delayStat;
+	NsLoraSim sim;
+	bool precise = false;
+	while (receivedStat.GetCount () < replication.maxReps)
+	{
+		uint64_t seed = p.seed + receivedStat.GetCount ();
+		sim = MakeSim (p, seed);
+		NS_LOG_INFO (seed << "-th replication... (" << p.nDevices << ", r" << p.rings << ", p" << p.appPeriodSeconds << ")");
+		sim.Simulate ();
+		sim.WriteSidecars ();
+		receivedStat.Add (sim.GetReceivedProb ());
+		delayStat.Add (sim.GetAverageDelay ());
+
+		precise = receivedStat.IsPrecise (replication.receivedTarget, false, replication.confidence)
+				&& delayStat.IsPrecise (replication.delayTarget, true, replication.confidence);
+		if (precise && receivedStat.GetCount () >= replication.minReps)
+		{
+			break;
+		}
+	}
+	NS_LOG_INFO ("DONE after " << receivedStat.GetCount () << " replications" << (precise ? "" : ", not converged"));
+
+	// nDevices, offered load, replications, converged, then mean and
+	// confidence half width of receivedProb and of the average delay
+	std::ostringstream oss;
+	oss << p.nDevices << ";" << double(p.nDevices)/p.simulationTime << ";" << receivedStat.GetCount () << ";" << precise <<
+	";" << receivedStat.GetMean () << ";" << receivedStat.GetHalfWidth (replication.confidence) <<
+	";" << delayStat.GetMean () << ";" << delayStat.GetHalfWidth (replication.confidence) << std::endl;
+
+	SweepResult result;
+	result.file = sim.GetResultFile ("ci");
+	result.row = oss.str ();
+	return result;
+}
+
+// Estimate a sweep point into dat/<mode>/est-*.csv instead of simulating it
+static SweepResult
+RunEstimatePoint (const SweepPoint &p)
+{
+	NsLoraSim sim = MakeSim (p, p.seed);
+	Estimate e = sim.EstimateOutcomes (estimation.samples);
+	NS_LOG_INFO (p.seed << "-th estimate... (" << p.nDevices << ", r" << p.rings << ", p" << p.appPeriodSeconds << "): pdr " << e.pdr);
+
+	SweepResult result;
+	result.file = sim.GetResultFile ("est");
+	result.row = sim.GetEstimateRow (e);
+	return result;
+}
+
+// Simulate a sweep point only when its estimate leaves the outcome open.
+// Without contention the outcome is set by coverage, which the estimate
+// gets right, and a saturated point has nothing left to measure; neither
+// needs any seed simulated
+static SweepResult
+RunScreenedPoint (const SweepPoint &p)
+{
+	NsLoraSim sim = MakeSim (p, p.seed);
+	Estimate e = sim.EstimateOutcomes (estimation.samples);
+	double above = 1 - e.underSensitivity;
+	double contention = above > 0 ? (e.interfered + e.noMoreReceivers) / above : 0;
+	if (contention >= estimation.screen && e.pdr >= estimation.screen)
+	{
+		return replication.enabled ? RunReplicatedPoint (p) : RunSweepPoint (p);
+	}
+	NS_LOG_INFO (p.seed << "-th point settled by the estimate (" << p.nDevices << ", r" << p.rings << ", p" << p.appPeriodSeconds <<
+			"): pdr " << e.pdr << ", contention " << contention);
+
+	SweepResult result;
+	result.file = sim.GetResultFile ("est");
+	result.row = sim.GetEstimateRow (e);
+	return result;
+}
+
+// Simulate a sweep point with each of the compared schedulers in turn
+// and report their timings into dat/<mode>/sched-*.csv.  The schedulers
+// order events alike, so the outcome columns must agree row to row
+static SweepResult
+RunSchedulerPoint (const SweepPoint &p)
+{
+	std::ostringstream oss;
+	NsLoraSim sim;
+	for (size_t i = 0; i < comparedSchedulers.size (); i++)
+	{
+		sim = MakeSim (p, p.seed);
+		SimOptions options = simOptions;
+		options.scheduler = comparedSchedulers[i];
+		sim.SetOptions (options);
+		NS_LOG_INFO (p.seed << "-th point with the " << options.scheduler << " scheduler... (" << p.nDevices << ", r" << p.rings << ", p" << p.appPeriodSeconds << ")");
+		sim.Simulate ();
+
+		// scheduler, events, setup and run seconds, events per run second,
+		// then receivedProb and the average delay
+		const PhaseProfiler &profile = sim.GetProfile ();
+		double run = profile.GetSeconds ("run");
+		double setup = sim.GetSetupSeconds ();
+		oss << options.scheduler << ";" << p.seed << ";" << sim.GetEventCount () << ";" << setup << ";" << run <<
+		";" << (run > 0 ? sim.GetEventCount () / run : 0) << ";" << sim.GetReceivedProb () << ";" << sim.GetAverageDelay () << std::endl;
+	}
+
+	SweepResult result;
+	result.file = sim.GetResultFile ("sched");
+	result.row = oss.str ();
+	return result;
+}
+
+// Simulate a sweep point on the plain channel and on the culled one and
+// put both result rows, after the channel and the run seconds, into
+// dat/<mode>/cull-*.csv.  The channel only culls end device receptions, so
+// the outcome split and the delays must agree
+static SweepResult
+RunCullingPoint (const SweepPoint &p)
+{
+	std::ostringstream oss;
+	NsLoraSim sim;
+	for (int culled = 0; culled <= 1; culled++)
+	{
+		sim = MakeSim (p, p.seed);
+		SimOptions options = simOptions;
+		options.cullChannel = culled;
+		sim.SetOptions (options);
+		NS_LOG_INFO (p.seed << "-th point on the " << (culled ? "culled" : "plain") << " channel... (" << p.nDevices << ", r" << p.rings << ", p" << p.appPeriodSeconds << ")");
+		sim.Simulate ();
+		oss << (culled ? "culled" : "plain") << ";" << sim.GetProfile ().GetSeconds ("run") << ";" << sim.GetResultRow ();
+	}
+
+	SweepResult result;
+	result.file = sim.GetResultFile ("cull");
+	result.row = oss.str ();
+	return result;
+}
+
 int main (int argc, char *argv[])
 {
 
   int verbose = 4;
   bool printdev = false;
+  unsigned jobs = 1;
+  bool pin = true;
+  bool resume = false;
+  std::string manifest;
+  uint32_t coverage = 0;
+  int coverageRings = 4;
+  bool mpi = false;
+  int mpiDevices = 100000;
+  int mpiRings = 4;
+  std::string compareSchedulers;
+  int runDevices = 0;
+  int runRings = 1;
+  int runPeriod = 10;
+  uint64_t runSeed = 1;
+  double runTime = 150.0;
 
   CommandLine cmd;
   cmd.AddValue ("verbose", "Whether to print output [1=ALL,2=DEBUG,3=INFO]", verbose);
-  cmd.AddValue ("printdev", "Print devices' location or not", printdev);
+  cmd.AddValue ("printdev", "Print devices' location or not with --runDevices; sweeps always do", printdev);
+  cmd.AddValue ("jobs", "Worker processes for the sweep [0=one per core]", jobs);
+  cmd.AddValue ("pin", "Pin each sweep worker to its own core", pin);
+  cmd.AddValue ("resume", "Skip the sweep points recorded as done in the manifest and append their kept rows", resume);
+  cmd.AddValue ("manifest", "Manifest of completed sweep points [default dat/sweep.manifest, dat/ci.manifest with replicate]", manifest);
+  cmd.AddValue ("packetLog", "Write a binary per-packet outcome log per run", simOptions.packetLog);
+  cmd.AddValue ("cullChannel", "Skip channel deliveries to end devices out of reach", simOptions.cullChannel);
+  cmd.AddValue ("cacheLoss", "Precompute the ED-gateway path loss matrix", simOptions.cacheLoss);
+  cmd.AddValue ("bulkSf", "Assign spreading factors with the threaded bulk path", simOptions.bulkSf);
+  cmd.AddValue ("hexGrid", "Place gateways on hexagonal rings", simOptions.hexGrid);
+  cmd.AddValue ("gatewayDistance", "Hex grid inter-site distance [0=fit the disc]", simOptions.gatewayDistance);
+  cmd.AddValue ("replicate", "Replicate each point until its confidence interval is narrow enough", replication.enabled);
+  cmd.AddValue ("confidence", "Confidence level of the replication intervals", replication.confidence);
+  cmd.AddValue ("ciTarget", "Target half width of receivedProb", replication.receivedTarget);
+  cmd.AddValue ("ciDelayTarget", "Target half width of the average delay relative to its mean [0=ignore]", replication.delayTarget);
+  cmd.AddValue ("minReps", "Replications before the intervals are checked", replication.minReps);
+  cmd.AddValue ("maxReps", "Replications after which a point is given up", replication.maxReps);
+  cmd.AddValue ("estimate", "Estimate every point analytically instead of simulating it", estimation.only);
+  cmd.AddValue ("screen", "Estimate points first and simulate only those with contention losses and PDR above this share [0=off]", estimation.screen);
+  cmd.AddValue ("estimateSamples", "Monte-Carlo end device samples per estimate", estimation.samples);
+  cmd.AddValue ("coverage", "Write a coverage raster of this many cells per side instead of sweeping [0=off]", coverage);
+  cmd.AddValue ("coverageRings", "Gateway rings of the coverage raster", coverageRings);
+  cmd.AddValue ("mpi", "Simulate one scenario with its gateways sharded across the MPI ranks, every rank running all end devices as a compact population", mpi);
+  cmd.AddValue ("mpiDevices", "End devices of the MPI scenario", mpiDevices);
+  cmd.AddValue ("mpiRings", "Gateway rings of the MPI scenario", mpiRings);
+  cmd.AddValue ("runDevices", "Simulate one scenario of this many end devices and print its profile as JSON instead of sweeping [0=sweep]", runDevices);
+  cmd.AddValue ("runRings", "Gateway rings of the single scenario", runRings);
+  cmd.AddValue ("runPeriod", "Application period of the single scenario [s]", runPeriod);
+  cmd.AddValue ("runSeed", "Seed of the single scenario", runSeed);
+  cmd.AddValue ("runTime", "Simulated time of the single scenario [s]", runTime);
+  cmd.AddValue ("snapshot", "Reuse placement and SF assignment across runs with the same topology", simOptions.snapshot);
+  cmd.AddValue ("profile", "Write per-phase wall-clock and memory use of every run", simOptions.profile);
+  cmd.AddValue ("eventProfile", "Count and time the executed events by type and simulated second", simOptions.eventProfile);
+  cmd.AddValue ("trace", "Record transmissions and outcomes of every run to a binary trace", simOptions.trace);
+  cmd.AddValue ("stats", "Count outcomes by SF, gateway and ED-gateway distance", simOptions.stats);
+  cmd.AddValue ("distanceBin", "Width of the distance rings of the outcome counts [m]", simOptions.distanceBin);
+  cmd.AddValue ("window", "Width of the time series windows [s, 0=none]", simOptions.window);
+  cmd.AddValue ("latency", "Write the per-SF delay histograms of every run", simOptions.latency);
+  cmd.AddValue ("traffic", "Replay the uplinks of a binary traffic file instead of the periodic senders", simOptions.traffic);
+  cmd.AddValue ("trafficWindow", "How far ahead replayed uplinks are scheduled [s]", simOptions.trafficWindow);
+  cmd.AddValue ("compact", "Keep the end devices in a compact population instead of one node each", simOptions.compact);
+  cmd.AddValue ("scheduler", "Event scheduler [map, heap, list, calendar, bucket or an ns-3 type name]", simOptions.scheduler);
+  cmd.AddValue ("bucketWidth", "Bucket width of the bucket scheduler [s, 0=tune to the load]", simOptions.bucketWidth);
+  cmd.AddValue ("compareSchedulers", "Time every point with each of these comma-separated schedulers instead of sweeping", compareSchedulers);
+  cmd.AddValue ("compareCulling", "Simulate every point on the plain and on the culled channel instead of sweeping", compareCulling);
+  cmd.AddValue ("boundedTracker", "Finalize every packet and evict stale tracker entries", simOptions.boundedTracker);
   cmd.Parse (argc, argv);
 
+  std::istringstream schedulers (compareSchedulers);
+  for (std::string name; std::getline (schedulers, name, ',');)
+  {
+	  if (!name.empty ())
+	  {
+		  comparedSchedulers.push_back (name);
+	  }
+  }
+
+  if (simOptions.trace && !NSLORA_TRACE_COMPILED)
+  {
+	  std::cerr << "tracing is compiled out, build with -DNSLORA_TRACE_ENABLE" << std::endl;
+	  simOptions.trace = false;
+  }
+
   // Logging
   if (verbose == 1)
   {
@@ -535,42 +1806,171 @@ int main (int argc, char *argv[])
 	  LogComponentEnable ("PointToPointNetDevice", LOG_LEVEL_INFO);
   }
   LogComponentEnable ("NsLoraSim", LOG_LEVEL_INFO);
-  LogComponentEnableAll (LOG_PREFIX_FUNC);
-  LogComponentEnableAll (LOG_PREFIX_NODE);
-  LogComponentEnableAll (LOG_PREFIX_TIME);
+  // Prefixes cost a context and time lookup per message, only pay for
+  // them when the stack is logging
+  if (verbose < 4)
+  {
+	  LogComponentEnableAll (LOG_PREFIX_FUNC);
+	  LogComponentEnableAll (LOG_PREFIX_NODE);
+	  LogComponentEnableAll (LOG_PREFIX_TIME);
+  }
+
+  if (mpi)
+  {
+#ifdef NS3_MPI
+	  // One scenario, not a sweep: forking workers under MPI is not safe.
+	  // Every rank holds every end device, as a row of a compact population
+	  MpiInterface::Enable (&argc, &argv);
+	  simOptions.compact = true;
+	  uint32_t rank = MpiInterface::GetSystemId ();
+	  uint32_t ranks = MpiInterface::GetSize ();
+	  NsLoraSim sim (mpiDevices, mpiRings, 150.0, 1);
+	  if (ranks > uint32_t (3*mpiRings*mpiRings-3*mpiRings+1))
+	  {
+		  std::cerr << "more ranks than gateways" << std::endl;
+		  MpiInterface::Disable ();
+		  return 1;
+	  }
+	  if (rank > 0)
+	  {
+		  // Only rank 0 writes files
+		  simOptions.packetLog = false;
+		  simOptions.trace = false;
+		  simOptions.profile = false;
+		  simOptions.eventProfile = false;
+		  simOptions.stats = false;
+		  simOptions.window = 0;
+		  simOptions.latency = false;
+	  }
+	  sim.SetOptions (simOptions);
+	  sim.SetPartition (rank, ranks);
+	  sim.Simulate ();
+	  if (rank == 0)
+	  {
+		  std::ofstream fd;
+		  fd.open (sim.GetResultFile (), std::ofstream::app);
+		  fd << sim.GetResultRow ();
+		  fd.close ();
+		  sim.WriteSidecars ();
+	  }
+	  MpiInterface::Disable ();
+	  return 0;
+#else
+	  std::cerr << "MPI is not available, build ns-3 with --enable-mpi" << std::endl;
+	  return 1;
+#endif
+  }
+
+  if (runDevices > 0)
+  {
+	  // The results stay out of the sweep's CSV files; nslora-bench reads
+	  // the profile from stdout
+	  NsLoraSim sim (runDevices, runRings, runTime, runSeed);
+	  sim.SetAppPeriod (uint8_t (runPeriod));
+	  sim.SetPrintDevices (printdev);
+	  sim.SetOptions (simOptions);
+	  sim.Simulate ();
+	  sim.WriteSidecars ();
+	  sim.WriteProfileJson (std::cout);
+	  return 0;
+  }
+
+  if (coverage > 0)
+  {
+	  NsLoraSim sim (100, coverageRings, 150.0, 1);
+	  sim.SetOptions (simOptions);
+	  std::ostringstream oss;
+	  oss << "dat/coverage-r" << coverageRings << (simOptions.hexGrid ? "-hex" : "") << ".bin";
+	  if (!sim.WriteCoverage (coverage, oss.str ()))
+	  {
+		  std::cerr << "cannot write " << oss.str () << std::endl;
+		  return 1;
+	  }
+	  return 0;
+  }
+
+  // Sweep points are handed out to the workers in this order and their
+  // rows are appended in this order as well
+  // With replication each point is one configuration, simulated from its
+  // seed onwards as many times as it takes
+  SweepRunner::RunFunction run = replication.enabled ? &RunReplicatedPoint : &RunSweepPoint;
+  if (!comparedSchedulers.empty ())
+  {
+	  run = &RunSchedulerPoint;
+  }
+  else if (compareCulling)
+  {
+	  run = &RunCullingPoint;
+  }
+  else if (estimation.only)
+  {
+	  run = &RunEstimatePoint;
+  }
+  else if (estimation.screen > 0)
+  {
+	  run = &RunScreenedPoint;
+  }
+  SweepRunner sweep (run, jobs, pin);
+  if (manifest.empty ())
+  {
+	  manifest = !comparedSchedulers.empty () ? "dat/sched.manifest" : compareCulling ? "dat/cull.manifest"
+			  : estimation.only ? "dat/est.manifest"
+			  : replication.enabled ? "dat/ci.manifest" : "dat/sweep.manifest";
+  }
+  sweep.SetManifest (manifest, resume);
+
+  if (compareCulling)
+  {
+	  // Compare under loads well beyond the sweep's too, where the reception
+	  // paths fill up
+	  static const int loads[3] = { 2000, 5000, 10000 };
+	  for (int j=0; j<3; j++)
+	  {
+		  for (int k=1; k<=4; k++)
+		  {
+			  SweepPoint p = {0, loads[j], k, 10, 150.0, 1};
+			  sweep.Add (p);
+		  }
+	  }
+  }
 
   // m_ndevice, m_rings, m_simulationTime, m_rand
-  NsLoraSim sim1;
-  NS_LOG_INFO ("vary gateways..");
   // ndevice increase
-  for (int j=1; j<=5; j++)
+  for (int j=1; !compareCulling && j<=5; j++)
   {
       // rRand
 	  for (int i=1; i<=3; i++)
 	  {
+		  if (replication.enabled && i > 1)
+		  {
+			  break;
+		  }
 		  for (int k=1; k<=4; k++)
 		  {
-			  sim1 = NsLoraSim (150*j, k, 150.0, i);
-			  NS_LOG_INFO (i << "-th iteration... (" << 150*j << ", r"<< k <<")");
-			  sim1.Run ();
-			  NS_LOG_INFO ("DONE");
+			  SweepPoint p = {0, 150*j, k, 10, 150.0, uint64_t (i)};
+			  sweep.Add (p);
 		  }
 	  }
   }
-  NS_LOG_INFO ("vary datarate..");
   // m_rings, m_simulationTime, m_appPeriod, m_rand
-  for (int j=1; j<=5; j++)
+  for (int j=1; !compareCulling && j<=5; j++)
   {
 	  // rRand
 	  for (int k=1; k<=3; k++)
 	  {
-		  sim1 = NsLoraSim (k, 150.0, 10*j, k);
-		  NS_LOG_INFO (k << "-th iteration... (" << 5*j << ", r"<< k <<")");
-		  sim1.Run ();
-		  NS_LOG_INFO ("DONE");
+		  SweepPoint p = {1, 100, k, 10*j, 150.0, uint64_t (k)};
+		  sweep.Add (p);
 	  }
   }
 
+  NS_LOG_INFO ("running " << sweep.GetPoints ().size () << " points..");
+  unsigned failed = sweep.Run ();
+  if (failed > 0)
+  {
+	  NS_LOG_INFO (failed << " points failed");
+	  return 1;
+  }
+
 //  sim1 = NsLoraSim (250, 2, 7500, 60, 1);
 //  sim1.Run ();
 //  sim1 = NsLoraSim (250, 1, 7500, 60, 1);
@@ -0,0 +1,126 @@
+/*
+ * nslora-stats.h
+ *
+ * Gateway outcome counters by spreading factor, gateway and ED-gateway
+ * distance.
+ *
+ * Every outcome a gateway reports is counted three times: in the row of
+ * the sender's spreading factor, in the row of the gateway, and in the row
+ * of the distance ring the sender lies in as seen from that gateway.  The
+ * rows are UNSET counters wide and live in three flat arrays, so counting
+ * an outcome is three indexed increments.  The distance ring of every
+ * ED-gateway pair is precomputed by the caller, as the topology is static.
+ */
+
+#ifndef NSLORA_STATS_H
+#define NSLORA_STATS_H
+
+#include "nslora-packet-tracker.h"
+
+#include <stdint.h>
+#include <ostream>
+#include <vector>
+
+namespace nslora {
+
+class OutcomeStats
+{
+public:
+  OutcomeStats ();
+
+  /**
+   * Clear the counters.
+   *
+   * \param nGateways number of gateways
+   * \param nBins number of distance rings
+   * \param binWidth width of a distance ring, m
+   */
+  void Reset (uint32_t nGateways, uint32_t nBins, double binWidth);
+
+  /* The distance ring a distance falls in, the last one collects the rest */
+  uint8_t GetBin (double distance) const;
+
+  void Add (uint8_t sf, uint32_t gateway, uint8_t bin, enum PacketOutcome outcome);
+
+  /* Write the per-SF, per-gateway and per-distance tables, ;-separated */
+  void Write (std::ostream &os) const;
+
+private:
+  static const uint32_t SF_ROWS = 13;   //!< indexed by SF, rows 7..12 are used
+
+  void WriteTable (std::ostream &os, const char *key, const std::vector<uint64_t> &counts,
+                   uint32_t first, double scale) const;
+
+  std::vector<uint64_t> m_sf;
+  std::vector<uint64_t> m_gateway;
+  std::vector<uint64_t> m_distance;
+  uint32_t m_nBins;
+  double m_binWidth;
+};
+
+inline
+OutcomeStats::OutcomeStats ()
+  : m_nBins (1),
+    m_binWidth (1)
+{
+  Reset (0, 1, 1);
+}
+
+inline void
+OutcomeStats::Reset (uint32_t nGateways, uint32_t nBins, double binWidth)
+{
+  m_nBins = nBins < 1 ? 1 : nBins > 256 ? 256 : nBins;
+  m_binWidth = binWidth;
+  m_sf.assign (SF_ROWS * UNSET, 0);
+  m_gateway.assign (size_t (nGateways) * UNSET, 0);
+  m_distance.assign (size_t (m_nBins) * UNSET, 0);
+}
+
+inline uint8_t
+OutcomeStats::GetBin (double distance) const
+{
+  double bin = distance / m_binWidth;
+  return bin < m_nBins - 1 ? uint8_t (bin) : uint8_t (m_nBins - 1);
+}
+
+inline void
+OutcomeStats::Add (uint8_t sf, uint32_t gateway, uint8_t bin, enum PacketOutcome outcome)
+{
+  m_sf[(sf < SF_ROWS ? sf : 0) * UNSET + outcome]++;
+  m_gateway[size_t (gateway) * UNSET + outcome]++;
+  m_distance[size_t (bin) * UNSET + outcome]++;
+}
+
+inline void
+OutcomeStats::WriteTable (std::ostream &os, const char *key, const std::vector<uint64_t> &counts,
+                          uint32_t first, double scale) const
+{
+  os << key << ";received;interfered;noMoreReceivers;underSensitivity;pdr" << std::endl;
+  for (size_t row = first; row < counts.size () / UNSET; row++)
+    {
+      const uint64_t *c = &counts[row * UNSET];
+      uint64_t total = 0;
+      os << row * scale;
+      for (int o = 0; o < UNSET; o++)
+        {
+          os << ";" << c[o];
+          total += c[o];
+        }
+      os << ";" << (total ? double (c[RECEIVED]) / total : 0.0) << std::endl;
+    }
+}
+
+inline void
+OutcomeStats::Write (std::ostream &os) const
+{
+  WriteTable (os, "sf", m_sf, 7, 1);
+  os << std::endl;
+  WriteTable (os, "gateway", m_gateway, 0, 1);
+  os << std::endl;
+  // Keyed by the inner edge of the ring
+  WriteTable (os, "distance", m_distance, 0, m_binWidth);
+}
+
+} // namespace nslora
+
+#endif /* NSLORA_STATS_H */
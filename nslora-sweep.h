@@ -0,0 +1,564 @@
+/*
+ * nslora-sweep.h
+ *
+ * Process-parallel runner for NsLoraSim parameter sweeps.
+ *
+ * The ns-3 Simulator is a process-wide singleton, so sweep points are run
+ * in forked worker processes.  Workers pull point indices from a shared
+ * counter and leave their CSV row in a shared result slot; the parent
+ * appends the rows to their files in sweep order, so the output is the
+ * same as a serial run regardless of the number of workers.
+ *
+ * With a manifest, every point is recorded in it with a single appending
+ * write as soon as it finishes, and its row kept in a file of its own in
+ * the directory <manifest>.d until it has been appended to its result
+ * file.  A resumed sweep skips the points listed in the manifest and
+ * appends the rows still kept in sweep order with the new ones, so a
+ * killed sweep loses at most the points that were running and duplicates
+ * at most the row appended just before the kill.
+ */
+
+#ifndef NSLORA_SWEEP_H
+#define NSLORA_SWEEP_H
+
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <set>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sched.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace nslora {
+
+/**
+ * One point of the sweep.  mode selects the NsLoraSim constructor
+ * (0 = vary devices and gateways, 1 = vary the application period).
+ */
+struct SweepPoint
+{
+  int mode;
+  int nDevices;
+  int rings;
+  int appPeriodSeconds;
+  double simulationTime;
+  uint64_t seed;
+};
+
+/**
+ * The outcome of a sweep point: the CSV file the row belongs to and the
+ * row itself, including the trailing newline.
+ */
+struct SweepResult
+{
+  std::string file;
+  std::string row;
+};
+
+class SweepRunner
+{
+public:
+  typedef std::function<SweepResult (const SweepPoint &)> RunFunction;
+
+  /**
+   * \param run the function simulating one point
+   * \param jobs the number of worker processes, 0 for one per usable core
+   * \param pin whether to pin each worker to its own core
+   */
+  SweepRunner (RunFunction run, unsigned jobs = 1, bool pin = true);
+
+  void Add (const SweepPoint &point);
+  const std::vector<SweepPoint> &GetPoints (void) const;
+
+  /**
+   * Record completed points in the manifest at path and keep their rows in
+   * path.d until they are appended.  If resume is set the points already
+   * recorded there are skipped, otherwise the manifest is started afresh.
+   */
+  void SetManifest (const std::string &path, bool resume);
+
+  /**
+   * Run every point and append its row to its result file.
+   *
+   * \return the number of points that did not produce a result
+   */
+  unsigned Run (void);
+
+private:
+  /* Size of a result slot; file name and row must fit together. */
+  static const size_t SLOT_BYTES = 8192;
+
+  enum SlotState
+  {
+    SLOT_PENDING = 0,
+    SLOT_DONE,
+    SLOT_FAILED
+  };
+
+  struct Slot
+  {
+    std::atomic<uint32_t> state;
+    uint32_t fileLength;
+    uint32_t rowLength;
+    char data[SLOT_BYTES];
+  };
+
+  struct Shared
+  {
+    std::atomic<uint32_t> next;
+    Slot slots[1];
+  };
+
+  /* m_slot of a point already appended, and of one whose row is kept */
+  static const int32_t POINT_APPENDED = -1;
+  static const int32_t POINT_KEPT = -2;
+
+  unsigned RunSerial (void);
+  unsigned RunForked (unsigned jobs);
+  void Worker (Shared *shared, int cpu);
+  void Append (const SweepPoint &point, const SweepResult &result);
+  void ReportMissing (size_t index) const;
+  std::vector<int> GetUsableCpus (void) const;
+
+  static std::string GetKey (const SweepPoint &point);
+  void OpenManifest (void);
+  std::string GetKeptPath (const SweepPoint &point) const;
+  /* Keep the row of a finished point and record it in the manifest */
+  void Keep (const SweepPoint &point, const SweepResult &result);
+  bool ReadKept (const SweepPoint &point, SweepResult &result) const;
+
+  RunFunction m_run;
+  unsigned m_jobs;
+  bool m_pin;
+  std::vector<SweepPoint> m_points;
+  std::vector<SweepPoint> m_todo;       //!< the points this Run simulates
+  std::vector<int32_t> m_slot;          //!< index in m_todo by point, or POINT_*
+
+  std::string m_manifestPath;
+  bool m_resume;
+  int m_manifest;                       //!< descriptor of the manifest, -1 if none
+};
+
+inline
+SweepRunner::SweepRunner (RunFunction run, unsigned jobs, bool pin)
+  : m_run (run),
+    m_jobs (jobs),
+    m_pin (pin),
+    m_resume (false),
+    m_manifest (-1)
+{
+}
+
+inline void
+SweepRunner::Add (const SweepPoint &point)
+{
+  m_points.push_back (point);
+}
+
+inline const std::vector<SweepPoint> &
+SweepRunner::GetPoints (void) const
+{
+  return m_points;
+}
+
+inline void
+SweepRunner::SetManifest (const std::string &path, bool resume)
+{
+  m_manifestPath = path;
+  m_resume = resume;
+}
+
+inline std::string
+SweepRunner::GetKey (const SweepPoint &point)
+{
+  char key[128];
+  snprintf (key, sizeof (key), "%d;%d;%d;%d;%.17g;%llu", point.mode, point.nDevices, point.rings,
+            point.appPeriodSeconds, point.simulationTime, (unsigned long long) point.seed);
+  return key;
+}
+
+inline std::string
+SweepRunner::GetKeptPath (const SweepPoint &point) const
+{
+  return m_manifestPath + ".d/" + GetKey (point);
+}
+
+inline void
+SweepRunner::OpenManifest (void)
+{
+  m_todo.clear ();
+  m_slot.assign (m_points.size (), int32_t (POINT_APPENDED));
+  if (m_manifestPath.empty ())
+    {
+      for (size_t i = 0; i < m_points.size (); i++)
+        {
+          m_slot[i] = m_todo.size ();
+          m_todo.push_back (m_points[i]);
+        }
+      return;
+    }
+
+  std::set<std::string> done;
+  if (m_resume)
+    {
+      std::ifstream in (m_manifestPath.c_str ());
+      std::string line;
+      // A line cut short by a kill has no newline and is not a key
+      while (std::getline (in, line) && !in.eof ())
+        {
+          done.insert (line);
+        }
+    }
+  mkdir ((m_manifestPath + ".d").c_str (), 0755);
+  size_t kept = 0;
+  for (size_t i = 0; i < m_points.size (); i++)
+    {
+      std::string path = GetKeptPath (m_points[i]);
+      if (done.count (GetKey (m_points[i])) == 0)
+        {
+          // Whatever is kept for it is left over from another sweep
+          unlink (path.c_str ());
+          m_slot[i] = m_todo.size ();
+          m_todo.push_back (m_points[i]);
+        }
+      else if (access (path.c_str (), F_OK) == 0)
+        {
+          m_slot[i] = POINT_KEPT;
+          kept++;
+        }
+    }
+  if (m_todo.size () < m_points.size ())
+    {
+      std::clog << "sweep: " << m_points.size () - m_todo.size () << " of " << m_points.size ()
+                << " points already done, " << kept << " of them still to be appended" << std::endl;
+    }
+
+  int flags = O_WRONLY | O_CREAT | O_APPEND | (m_resume ? 0 : O_TRUNC);
+  m_manifest = open (m_manifestPath.c_str (), flags, 0644);
+  if (m_manifest < 0)
+    {
+      std::cerr << "sweep: cannot open manifest " << m_manifestPath << std::endl;
+    }
+}
+
+inline void
+SweepRunner::Keep (const SweepPoint &point, const SweepResult &result)
+{
+  if (m_manifest < 0)
+    {
+      return;
+    }
+  // Under a temporary name first, so a kept row is always whole
+  std::string path = GetKeptPath (point);
+  std::ostringstream tmp;
+  tmp << path << ".tmp" << getpid ();
+  std::ofstream fd (tmp.str ().c_str (), std::ofstream::trunc);
+  fd << result.file << "\n" << result.row;
+  fd.close ();
+  if (!fd || rename (tmp.str ().c_str (), path.c_str ()) != 0)
+    {
+      std::cerr << "sweep: cannot keep the row of a point in " << path << std::endl;
+      unlink (tmp.str ().c_str ());
+      return;
+    }
+
+  // One write of a short line to an O_APPEND file lands whole
+  std::string line = GetKey (point) + "\n";
+  if (write (m_manifest, line.data (), line.size ()) != ssize_t (line.size ()))
+    {
+      std::cerr << "sweep: cannot record point in " << m_manifestPath << std::endl;
+    }
+}
+
+inline bool
+SweepRunner::ReadKept (const SweepPoint &point, SweepResult &result) const
+{
+  std::ifstream in (GetKeptPath (point).c_str ());
+  if (!std::getline (in, result.file) || in.eof ())
+    {
+      return false;
+    }
+  std::ostringstream row;
+  row << in.rdbuf ();
+  result.row = row.str ();
+  return true;
+}
+
+inline unsigned
+SweepRunner::Run (void)
+{
+  OpenManifest ();
+  unsigned jobs = m_jobs;
+  if (jobs == 0)
+    {
+      jobs = GetUsableCpus ().size ();
+    }
+  if (jobs > m_todo.size ())
+    {
+      jobs = m_todo.size ();
+    }
+  unsigned failed = jobs <= 1 ? RunSerial () : RunForked (jobs);
+  if (m_manifest >= 0)
+    {
+      close (m_manifest);
+      m_manifest = -1;
+    }
+  return failed;
+}
+
+inline unsigned
+SweepRunner::RunSerial (void)
+{
+  unsigned failed = 0;
+  for (size_t i = 0; i < m_points.size (); i++)
+    {
+      SweepResult result;
+      if (m_slot[i] == POINT_APPENDED)
+        {
+          continue;
+        }
+      else if (m_slot[i] == POINT_KEPT)
+        {
+          if (!ReadKept (m_points[i], result))
+            {
+              ReportMissing (i);
+              failed++;
+              continue;
+            }
+        }
+      else
+        {
+          result = m_run (m_points[i]);
+          Keep (m_points[i], result);
+        }
+      Append (m_points[i], result);
+    }
+  return failed;
+}
+
+inline unsigned
+SweepRunner::RunForked (unsigned jobs)
+{
+  size_t bytes = sizeof (Shared) + (m_todo.size () - 1) * sizeof (Slot);
+  void *mem = mmap (0, bytes, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (mem == MAP_FAILED)
+    {
+      std::cerr << "sweep: cannot map shared work queue, running serially" << std::endl;
+      return RunSerial ();
+    }
+  Shared *shared = static_cast<Shared *> (mem);
+  new (&shared->next) std::atomic<uint32_t> (0);
+  for (size_t i = 0; i < m_todo.size (); i++)
+    {
+      new (&shared->slots[i].state) std::atomic<uint32_t> (SLOT_PENDING);
+    }
+
+  std::vector<int> cpus = GetUsableCpus ();
+  std::vector<pid_t> workers;
+
+  // Anything still buffered would otherwise be written once per worker
+  std::cout.flush ();
+  std::clog.flush ();
+  for (unsigned w = 0; w < jobs; w++)
+    {
+      pid_t pid = fork ();
+      if (pid == 0)
+        {
+          Worker (shared, m_pin ? cpus[w % cpus.size ()] : -1);
+          std::cout.flush ();
+          std::clog.flush ();
+          _exit (0);
+        }
+      if (pid < 0)
+        {
+          std::cerr << "sweep: fork failed after " << w << " workers" << std::endl;
+          break;
+        }
+      workers.push_back (pid);
+    }
+  if (workers.empty ())
+    {
+      munmap (mem, bytes);
+      return RunSerial ();
+    }
+
+  // The workers keep the rows of their points as they finish them; append
+  // the rows in sweep order while the workers are running
+  size_t merged = 0;
+  unsigned failed = 0;
+  size_t alive = workers.size ();
+  while (merged < m_points.size ())
+    {
+      while (merged < m_points.size ())
+        {
+          SweepResult result;
+          bool ok;
+          if (m_slot[merged] == POINT_APPENDED)
+            {
+              merged++;
+              continue;
+            }
+          else if (m_slot[merged] == POINT_KEPT)
+            {
+              ok = ReadKept (m_points[merged], result);
+            }
+          else
+            {
+              Slot &slot = shared->slots[m_slot[merged]];
+              uint32_t state = slot.state.load (std::memory_order_acquire);
+              if (state == SLOT_PENDING && alive > 0)
+                {
+                  break;
+                }
+              ok = state == SLOT_DONE;
+              if (ok)
+                {
+                  result.file.assign (slot.data, slot.fileLength);
+                  result.row.assign (slot.data + slot.fileLength, slot.rowLength);
+                }
+              else if (state == SLOT_FAILED && m_manifest >= 0)
+                {
+                  // Too long for its slot, but kept
+                  ok = ReadKept (m_points[merged], result);
+                }
+            }
+          if (ok)
+            {
+              Append (m_points[merged], result);
+            }
+          else
+            {
+              ReportMissing (merged);
+              failed++;
+            }
+          merged++;
+        }
+      if (merged == m_points.size ())
+        {
+          break;
+        }
+      int status;
+      pid_t pid = waitpid (-1, &status, alive > 0 ? WNOHANG : 0);
+      if (pid > 0)
+        {
+          if (!WIFEXITED (status) || WEXITSTATUS (status) != 0)
+            {
+              std::cerr << "sweep: worker " << pid << " died" << std::endl;
+            }
+          alive--;
+        }
+      else if (pid == 0)
+        {
+          usleep (50000);
+        }
+      else
+        {
+          alive = 0;
+        }
+    }
+
+  while (alive > 0 && waitpid (-1, 0, 0) > 0)
+    {
+      alive--;
+    }
+  munmap (mem, bytes);
+  return failed;
+}
+
+inline void
+SweepRunner::Worker (Shared *shared, int cpu)
+{
+  if (cpu >= 0)
+    {
+      cpu_set_t set;
+      CPU_ZERO (&set);
+      CPU_SET (cpu, &set);
+      sched_setaffinity (0, sizeof (set), &set);
+    }
+
+  for (;;)
+    {
+      uint32_t i = shared->next.fetch_add (1);
+      if (i >= m_todo.size ())
+        {
+          return;
+        }
+      Slot &slot = shared->slots[i];
+      SweepResult result = m_run (m_todo[i]);
+      Keep (m_todo[i], result);
+      if (result.file.size () + result.row.size () > SLOT_BYTES)
+        {
+          std::cerr << "sweep: result of point " << i << " does not fit its slot" << std::endl;
+          slot.state.store (SLOT_FAILED, std::memory_order_release);
+          continue;
+        }
+      slot.fileLength = result.file.size ();
+      slot.rowLength = result.row.size ();
+      std::memcpy (slot.data, result.file.data (), result.file.size ());
+      std::memcpy (slot.data + result.file.size (), result.row.data (), result.row.size ());
+      slot.state.store (SLOT_DONE, std::memory_order_release);
+    }
+}
+
+inline void
+SweepRunner::Append (const SweepPoint &point, const SweepResult &result)
+{
+  std::ofstream fd;
+  fd.open (result.file.c_str (), std::ofstream::app);
+  fd << result.row;
+  fd.close ();
+
+  if (m_manifest >= 0 && fd)
+    {
+      unlink (GetKeptPath (point).c_str ());
+    }
+}
+
+inline void
+SweepRunner::ReportMissing (size_t index) const
+{
+  const SweepPoint &p = m_points[index];
+  std::cerr << "sweep: no result for point " << index << " (mode " << p.mode
+            << ", " << p.nDevices << " devices, r" << p.rings
+            << ", p" << p.appPeriodSeconds << ", seed " << p.seed << ")" << std::endl;
+}
+
+inline std::vector<int>
+SweepRunner::GetUsableCpus (void) const
+{
+  std::vector<int> cpus;
+  cpu_set_t set;
+  CPU_ZERO (&set);
+  if (sched_getaffinity (0, sizeof (set), &set) == 0)
+    {
+      for (int c = 0; c < CPU_SETSIZE; c++)
+        {
+          if (CPU_ISSET (c, &set))
+            {
+              cpus.push_back (c);
+            }
+        }
+    }
+  if (cpus.empty ())
+    {
+      cpus.push_back (0);
+    }
+  return cpus;
+}
+
+} // namespace nslora
+
+#endif /* NSLORA_SWEEP_H */
@@ -0,0 +1,129 @@
+/*
+ * nslora-timeseries.h
+ *
+ * Windowed time series of the uplink load and outcomes of a run.
+ *
+ * Simulated time is cut into windows of fixed width.  A window counts the
+ * uplinks started in it, the gateway outcomes of those uplinks, and the
+ * largest number of uplinks on the air, counting the new one, at a
+ * transmission in it.
+ * Outcomes are charged to the window the uplink was sent in, so the PDR of
+ * a window is that of its own traffic however late the reports arrive.
+ * The state is one fixed-size row per window.
+ */
+
+#ifndef NSLORA_TIMESERIES_H
+#define NSLORA_TIMESERIES_H
+
+#include "nslora-packet-tracker.h"
+
+#include <stdint.h>
+#include <ostream>
+#include <vector>
+
+namespace nslora {
+
+class WindowedSeries
+{
+public:
+  WindowedSeries ();
+
+  /**
+   * Clear the series.
+   *
+   * \param width window width, in time steps
+   * \param duration expected length of the run, in time steps
+   * \param stepsPerSecond time steps per second, to print window starts
+   */
+  void Reset (int64_t width, int64_t duration, double stepsPerSecond);
+
+  void AddTransmission (int64_t time, uint32_t inFlight);
+  void AddOutcome (int64_t sendTime, enum PacketOutcome outcome, uint32_t count = 1);
+
+  /**
+   * Write one row per window: its start in seconds, transmissions, outcome
+   * counts, PDR and interference rate of its reports, and peak in-flight
+   * uplinks.
+   */
+  void Write (std::ostream &os) const;
+
+private:
+  struct Window
+  {
+    uint64_t transmitted;
+    uint64_t outcomes[UNSET];
+    uint32_t peakInFlight;
+  };
+
+  Window &GetWindow (int64_t time);
+
+  std::vector<Window> m_windows;
+  int64_t m_width;
+  double m_stepsPerSecond;
+};
+
+inline
+WindowedSeries::WindowedSeries ()
+  : m_width (1),
+    m_stepsPerSecond (1)
+{
+}
+
+inline void
+WindowedSeries::Reset (int64_t width, int64_t duration, double stepsPerSecond)
+{
+  m_width = width > 0 ? width : 1;
+  m_stepsPerSecond = stepsPerSecond;
+  Window zero = { 0, { 0, 0, 0, 0 }, 0 };
+  m_windows.assign (duration / m_width + 1, zero);
+}
+
+inline WindowedSeries::Window &
+WindowedSeries::GetWindow (int64_t time)
+{
+  size_t w = time > 0 ? size_t (time / m_width) : 0;
+  if (w >= m_windows.size ())
+    {
+      Window zero = { 0, { 0, 0, 0, 0 }, 0 };
+      m_windows.resize (w + 1, zero);
+    }
+  return m_windows[w];
+}
+
+inline void
+WindowedSeries::AddTransmission (int64_t time, uint32_t inFlight)
+{
+  Window &w = GetWindow (time);
+  w.transmitted++;
+  w.peakInFlight = inFlight > w.peakInFlight ? inFlight : w.peakInFlight;
+}
+
+inline void
+WindowedSeries::AddOutcome (int64_t sendTime, enum PacketOutcome outcome, uint32_t count)
+{
+  GetWindow (sendTime).outcomes[outcome] += count;
+}
+
+inline void
+WindowedSeries::Write (std::ostream &os) const
+{
+  os << "time;transmitted;received;interfered;noMoreReceivers;underSensitivity;pdr;interferenceRate;peakInFlight" << std::endl;
+  for (size_t i = 0; i < m_windows.size (); i++)
+    {
+      const Window &w = m_windows[i];
+      uint64_t total = 0;
+      os << i * m_width / m_stepsPerSecond << ";" << w.transmitted;
+      for (int o = 0; o < UNSET; o++)
+        {
+          os << ";" << w.outcomes[o];
+          total += w.outcomes[o];
+        }
+      os << ";" << (total ? double (w.outcomes[RECEIVED]) / total : 0.0)
+         << ";" << (total ? double (w.outcomes[INTERFERED]) / total : 0.0)
+         << ";" << w.peakInFlight << std::endl;
+    }
+}
+
+} // namespace nslora
+
+#endif /* NSLORA_TIMESERIES_H */
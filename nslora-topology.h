@@ -0,0 +1,265 @@
+/*
+ * nslora-topology.h
+ *
+ * Binary snapshot of a built topology: end device positions, device
+ * addresses and assigned data rates, and gateway positions.
+ *
+ * Placement and SF assignment only depend on the number of devices, the
+ * gateway layout and the placement seed, so sweep points that differ in
+ * traffic only can restore them from a snapshot instead of rerunning
+ * SetSpreadingFactorsUp.  The file is mapped read-only:
+ *
+ *   header     TopologyHeader (64 bytes)
+ *   devices    TopologyDevice[nDevices]   (32 bytes each)
+ *   gateways   TopologyGateway[nGateways] (24 bytes each)
+ *
+ * The header carries the key the snapshot was built for, a hash of the
+ * remaining scenario parameters and a checksum of the records; a snapshot
+ * whose key, parameters or checksum do not match is ignored.  Values are
+ * in host byte order.
+ */
+
+#ifndef NSLORA_TOPOLOGY_H
+#define NSLORA_TOPOLOGY_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace nslora {
+
+/* What a snapshot is valid for */
+struct TopologyKey
+{
+  uint32_t nDevices;
+  uint32_t rings;
+  uint64_t seed;
+  uint64_t config;              //!< hash of any other parameter the topology depends on
+};
+
+struct TopologyHeader
+{
+  char magic[8];
+  uint32_t version;
+  uint32_t nDevices;
+  uint32_t nGateways;
+  uint32_t rings;
+  uint64_t seed;
+  uint64_t config;
+  uint64_t checksum;            //!< TopologyHash of the records
+  uint64_t reserved[2];
+};
+
+struct TopologyDevice
+{
+  double x;
+  double y;
+  double z;
+  uint32_t address;
+  uint8_t dataRate;
+  uint8_t reserved[3];
+};
+
+struct TopologyGateway
+{
+  double x;
+  double y;
+  double z;
+};
+
+static const char TOPOLOGY_MAGIC[8] = { 'N', 'S', 'L', 'T', 'O', 'P', 'O', 'L' };
+static const uint32_t TOPOLOGY_VERSION = 1;
+
+/* FNV-1a, to chain over several buffers pass the previous result as h */
+inline uint64_t
+TopologyHash (const void *data, size_t size, uint64_t h = 14695981039346656037ULL)
+{
+  const uint8_t *p = static_cast<const uint8_t *> (data);
+  for (size_t i = 0; i < size; i++)
+    {
+      h ^= p[i];
+      h *= 1099511628211ULL;
+    }
+  return h;
+}
+
+class TopologySnapshot
+{
+public:
+  TopologySnapshot ();
+  ~TopologySnapshot ();
+
+  /**
+   * Map a snapshot read-only.
+   *
+   * \return false if the file is missing, truncated, built for another
+   * key or fails its checksum
+   */
+  bool Load (const std::string &path, const TopologyKey &key);
+  void Close (void);
+
+  uint32_t GetNDevices (void) const;
+  uint32_t GetNGateways (void) const;
+  const TopologyDevice *GetDevices (void) const;
+  const TopologyGateway *GetGateways (void) const;
+
+  /**
+   * Write a snapshot.  The file is written under a temporary name and
+   * renamed, so concurrent sweep workers never see a partial one.
+   *
+   * \return false if the file cannot be written
+   */
+  static bool Save (const std::string &path, const TopologyKey &key,
+                    const std::vector<TopologyDevice> &devices,
+                    const std::vector<TopologyGateway> &gateways);
+
+private:
+  TopologySnapshot (const TopologySnapshot &);
+  TopologySnapshot &operator= (const TopologySnapshot &);
+
+  const uint8_t *m_data;
+  size_t m_size;
+  TopologyHeader m_header;
+};
+
+inline
+TopologySnapshot::TopologySnapshot ()
+  : m_data (0),
+    m_size (0)
+{
+  memset (&m_header, 0, sizeof (m_header));
+}
+
+inline
+TopologySnapshot::~TopologySnapshot ()
+{
+  Close ();
+}
+
+inline bool
+TopologySnapshot::Load (const std::string &path, const TopologyKey &key)
+{
+  Close ();
+  int fd = open (path.c_str (), O_RDONLY);
+  if (fd < 0)
+    {
+      return false;
+    }
+  struct stat st;
+  if (fstat (fd, &st) != 0 || size_t (st.st_size) < sizeof (TopologyHeader))
+    {
+      close (fd);
+      return false;
+    }
+  void *data = mmap (0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close (fd);
+  if (data == MAP_FAILED)
+    {
+      return false;
+    }
+  m_data = static_cast<const uint8_t *> (data);
+  m_size = st.st_size;
+
+  memcpy (&m_header, m_data, sizeof (m_header));
+  size_t records = size_t (m_header.nDevices) * sizeof (TopologyDevice)
+    + size_t (m_header.nGateways) * sizeof (TopologyGateway);
+  if (memcmp (m_header.magic, TOPOLOGY_MAGIC, sizeof (m_header.magic)) != 0
+      || m_header.version != TOPOLOGY_VERSION
+      || m_header.nDevices != key.nDevices
+      || m_header.rings != key.rings
+      || m_header.seed != key.seed
+      || m_header.config != key.config
+      || m_size != sizeof (TopologyHeader) + records
+      || TopologyHash (m_data + sizeof (TopologyHeader), records) != m_header.checksum)
+    {
+      Close ();
+      return false;
+    }
+  return true;
+}
+
+inline void
+TopologySnapshot::Close (void)
+{
+  if (m_data != 0)
+    {
+      munmap (const_cast<uint8_t *> (m_data), m_size);
+      m_data = 0;
+      m_size = 0;
+    }
+  memset (&m_header, 0, sizeof (m_header));
+}
+
+inline uint32_t
+TopologySnapshot::GetNDevices (void) const
+{
+  return m_header.nDevices;
+}
+
+inline uint32_t
+TopologySnapshot::GetNGateways (void) const
+{
+  return m_header.nGateways;
+}
+
+inline const TopologyDevice *
+TopologySnapshot::GetDevices (void) const
+{
+  return reinterpret_cast<const TopologyDevice *> (m_data + sizeof (TopologyHeader));
+}
+
+inline const TopologyGateway *
+TopologySnapshot::GetGateways (void) const
+{
+  return reinterpret_cast<const TopologyGateway *> (m_data + sizeof (TopologyHeader)
+                                                     + size_t (m_header.nDevices) * sizeof (TopologyDevice));
+}
+
+inline bool
+TopologySnapshot::Save (const std::string &path, const TopologyKey &key,
+                        const std::vector<TopologyDevice> &devices,
+                        const std::vector<TopologyGateway> &gateways)
+{
+  TopologyHeader header;
+  memset (&header, 0, sizeof (header));
+  memcpy (header.magic, TOPOLOGY_MAGIC, sizeof (header.magic));
+  header.version = TOPOLOGY_VERSION;
+  header.nDevices = devices.size ();
+  header.nGateways = gateways.size ();
+  header.rings = key.rings;
+  header.seed = key.seed;
+  header.config = key.config;
+  uint64_t h = TopologyHash (devices.data (), devices.size () * sizeof (TopologyDevice));
+  header.checksum = TopologyHash (gateways.data (), gateways.size () * sizeof (TopologyGateway), h);
+
+  char suffix[32];
+  snprintf (suffix, sizeof (suffix), ".%ld.tmp", long (getpid ()));
+  std::string tmp = path + suffix;
+  FILE *file = fopen (tmp.c_str (), "wb");
+  if (file == 0)
+    {
+      return false;
+    }
+  bool ok = fwrite (&header, sizeof (header), 1, file) == 1
+    && fwrite (devices.data (), sizeof (TopologyDevice), devices.size (), file) == devices.size ()
+    && fwrite (gateways.data (), sizeof (TopologyGateway), gateways.size (), file) == gateways.size ();
+  ok = fclose (file) == 0 && ok;
+  if (!ok || rename (tmp.c_str (), path.c_str ()) != 0)
+    {
+      unlink (tmp.c_str ());
+      return false;
+    }
+  return true;
+}
+
+} // namespace nslora
+
+#endif /* NSLORA_TOPOLOGY_H */
@@ -0,0 +1,388 @@
+/*
+ * nslora-trace-log.h
+ *
+ * Event tracing for the scenario drivers.
+ *
+ * NSLORA_TRACE records a fixed-size binary record of a simulation event.
+ * It is compiled in when ns-3 logging is (debug builds) or when
+ * NSLORA_TRACE_ENABLE is defined, and expands to nothing otherwise, so
+ * optimized builds pay nothing for it.  When compiled in it costs a branch
+ * until a TraceLog is opened.
+ *
+ * Records go to a single-producer single-consumer ring buffer; a
+ * background thread drains it into the trace file, so the simulation
+ * thread never formats text or waits on I/O.  If the writer falls a whole
+ * ring behind, the simulation waits for it rather than dropping records.
+ *
+ *   file header   TraceLogHeader (32 bytes)
+ *   records       TraceRecord (24 bytes each) until the end of the file
+ *
+ * Values are in host byte order.  nslora-log-reader prints a trace file as
+ * text.
+ *
+ * The header itself does not depend on ns-3, so readers can use it; code
+ * using NSLORA_TRACE must include ns3/simulator.h.
+ */
+
+#ifndef NSLORA_TRACE_LOG_H
+#define NSLORA_TRACE_LOG_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#if defined (NS3_LOG_ENABLE) || defined (NSLORA_TRACE_ENABLE)
+#define NSLORA_TRACE_COMPILED 1
+#define NSLORA_TRACE(event, node, uid, outcome, arg)                    \
+  do                                                                    \
+    {                                                                   \
+      if (nslora::TraceLog::Get ().IsOpen ())                           \
+        {                                                               \
+          nslora::TraceLog::Get ().Record (ns3::Simulator::Now ().GetNanoSeconds (), \
+                                           event, node, uid, outcome, arg); \
+        }                                                               \
+    }                                                                   \
+  while (false)
+#else
+#define NSLORA_TRACE_COMPILED 0
+#define NSLORA_TRACE(event, node, uid, outcome, arg) do { } while (false)
+#endif
+
+namespace nslora {
+
+enum TraceEvent
+{
+  TRACE_TRANSMIT = 0,           //!< an end device started an uplink
+  TRACE_OUTCOME,                //!< a gateway reported an outcome on an uplink
+  TRACE_EVENTS
+};
+
+struct TraceLogHeader
+{
+  char magic[8];
+  uint32_t version;
+  uint32_t recordSize;
+  uint64_t reserved[2];
+};
+
+struct TraceRecord
+{
+  int64_t time;                 //!< nanoseconds
+  uint64_t uid;                 //!< packet uid
+  uint32_t node;                //!< node id of the device the event happened at
+  uint8_t event;                //!< TraceEvent
+  uint8_t outcome;              //!< PacketOutcome of a TRACE_OUTCOME
+  uint16_t arg;                 //!< event specific, the tagged send time of a reception
+};
+
+static const char TRACE_LOG_MAGIC[8] = { 'N', 'S', 'L', 'T', 'R', 'A', 'C', 'E' };
+static const uint32_t TRACE_LOG_VERSION = 1;
+
+class TraceLog
+{
+public:
+  /* The log NSLORA_TRACE records to */
+  static TraceLog &Get (void);
+
+  TraceLog ();
+  ~TraceLog ();
+
+  /**
+   * Create the trace file and start the writer thread.  Must not be
+   * called before a fork whose child records to the log.
+   *
+   * \param capacity ring size in records, rounded up to a power of two
+   * \return false if the file cannot be created
+   */
+  bool Open (const std::string &path, size_t capacity = 1 << 16);
+  /* Write out every record and stop the writer thread */
+  void Close (void);
+  bool IsOpen (void) const;
+
+  void Record (int64_t time, uint8_t event, uint32_t node, uint64_t uid, uint8_t outcome, uint16_t arg);
+
+  uint64_t GetRecordCount (void) const;
+  /* Number of times a full ring made the simulation wait */
+  uint64_t GetStalls (void) const;
+
+private:
+  TraceLog (const TraceLog &);
+  TraceLog &operator= (const TraceLog &);
+
+  void Writer (void);
+  /* Write the records in [tail, head) and return head */
+  uint64_t Drain (uint64_t tail, uint64_t head);
+
+  FILE *m_file;
+  std::vector<TraceRecord> m_ring;
+  uint64_t m_mask;
+  std::thread m_writer;
+  bool m_open;
+  uint64_t m_stalls;
+
+  // Producer and consumer positions on separate cache lines
+  alignas (64) std::atomic<uint64_t> m_head;
+  alignas (64) std::atomic<uint64_t> m_tail;
+  alignas (64) std::atomic<bool> m_stop;
+};
+
+class TraceLogReader
+{
+public:
+  TraceLogReader ();
+  ~TraceLogReader ();
+
+  /**
+   * Map a trace file read-only.
+   *
+   * \return false if the file cannot be mapped or is not a trace
+   */
+  bool Open (const std::string &path);
+  void Close (void);
+
+  size_t GetRecordCount (void) const;
+  const TraceRecord *GetRecords (void) const;
+
+private:
+  TraceLogReader (const TraceLogReader &);
+  TraceLogReader &operator= (const TraceLogReader &);
+
+  const uint8_t *m_data;
+  size_t m_size;
+};
+
+inline TraceLog &
+TraceLog::Get (void)
+{
+  static TraceLog log;
+  return log;
+}
+
+inline
+TraceLog::TraceLog ()
+  : m_file (0),
+    m_mask (0),
+    m_open (false),
+    m_stalls (0),
+    m_head (0),
+    m_tail (0),
+    m_stop (false)
+{
+}
+
+inline
+TraceLog::~TraceLog ()
+{
+  Close ();
+}
+
+inline bool
+TraceLog::Open (const std::string &path, size_t capacity)
+{
+  Close ();
+  m_file = fopen (path.c_str (), "wb");
+  if (m_file == 0)
+    {
+      return false;
+    }
+  TraceLogHeader header;
+  memset (&header, 0, sizeof (header));
+  memcpy (header.magic, TRACE_LOG_MAGIC, sizeof (header.magic));
+  header.version = TRACE_LOG_VERSION;
+  header.recordSize = sizeof (TraceRecord);
+  fwrite (&header, sizeof (header), 1, m_file);
+
+  size_t size = 1024;
+  while (size < capacity)
+    {
+      size *= 2;
+    }
+  m_ring.resize (size);
+  m_mask = size - 1;
+  m_head.store (0);
+  m_tail.store (0);
+  m_stop.store (false);
+  m_stalls = 0;
+  m_writer = std::thread (&TraceLog::Writer, this);
+  m_open = true;
+  return true;
+}
+
+inline void
+TraceLog::Close (void)
+{
+  if (!m_open)
+    {
+      return;
+    }
+  m_open = false;
+  m_stop.store (true, std::memory_order_release);
+  m_writer.join ();
+  fclose (m_file);
+  m_file = 0;
+}
+
+inline bool
+TraceLog::IsOpen (void) const
+{
+  return m_open;
+}
+
+inline void
+TraceLog::Record (int64_t time, uint8_t event, uint32_t node, uint64_t uid, uint8_t outcome, uint16_t arg)
+{
+  uint64_t head = m_head.load (std::memory_order_relaxed);
+  if (head - m_tail.load (std::memory_order_acquire) > m_mask)
+    {
+      m_stalls++;
+      while (head - m_tail.load (std::memory_order_acquire) > m_mask)
+        {
+          std::this_thread::yield ();
+        }
+    }
+  TraceRecord &r = m_ring[head & m_mask];
+  r.time = time;
+  r.uid = uid;
+  r.node = node;
+  r.event = event;
+  r.outcome = outcome;
+  r.arg = arg;
+  m_head.store (head + 1, std::memory_order_release);
+}
+
+inline uint64_t
+TraceLog::Drain (uint64_t tail, uint64_t head)
+{
+  while (tail != head)
+    {
+      // Up to the end of the ring, then from its start
+      uint64_t start = tail & m_mask;
+      uint64_t count = std::min<uint64_t> (head - tail, m_ring.size () - start);
+      fwrite (&m_ring[start], sizeof (TraceRecord), count, m_file);
+      tail += count;
+      m_tail.store (tail, std::memory_order_release);
+    }
+  return tail;
+}
+
+inline void
+TraceLog::Writer (void)
+{
+  uint64_t tail = m_tail.load (std::memory_order_relaxed);
+  for (;;)
+    {
+      bool stop = m_stop.load (std::memory_order_acquire);
+      uint64_t head = m_head.load (std::memory_order_acquire);
+      if (head == tail)
+        {
+          if (stop)
+            {
+              return;
+            }
+          std::this_thread::sleep_for (std::chrono::microseconds (200));
+          continue;
+        }
+      tail = Drain (tail, head);
+    }
+}
+
+inline uint64_t
+TraceLog::GetRecordCount (void) const
+{
+  return m_head.load ();
+}
+
+inline uint64_t
+TraceLog::GetStalls (void) const
+{
+  return m_stalls;
+}
+
+inline
+TraceLogReader::TraceLogReader ()
+  : m_data (0),
+    m_size (0)
+{
+}
+
+inline
+TraceLogReader::~TraceLogReader ()
+{
+  Close ();
+}
+
+inline bool
+TraceLogReader::Open (const std::string &path)
+{
+  Close ();
+  int fd = open (path.c_str (), O_RDONLY);
+  if (fd < 0)
+    {
+      return false;
+    }
+  struct stat st;
+  if (fstat (fd, &st) != 0 || size_t (st.st_size) < sizeof (TraceLogHeader))
+    {
+      close (fd);
+      return false;
+    }
+  void *data = mmap (0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close (fd);
+  if (data == MAP_FAILED)
+    {
+      return false;
+    }
+  madvise (data, st.st_size, MADV_SEQUENTIAL);
+  m_data = static_cast<const uint8_t *> (data);
+  m_size = st.st_size;
+
+  TraceLogHeader header;
+  memcpy (&header, m_data, sizeof (header));
+  if (memcmp (header.magic, TRACE_LOG_MAGIC, sizeof (header.magic)) != 0
+      || header.version != TRACE_LOG_VERSION
+      || header.recordSize != sizeof (TraceRecord))
+    {
+      Close ();
+      return false;
+    }
+  return true;
+}
+
+inline void
+TraceLogReader::Close (void)
+{
+  if (m_data != 0)
+    {
+      munmap (const_cast<uint8_t *> (m_data), m_size);
+      m_data = 0;
+      m_size = 0;
+    }
+}
+
+inline size_t
+TraceLogReader::GetRecordCount (void) const
+{
+  return m_data ? (m_size - sizeof (TraceLogHeader)) / sizeof (TraceRecord) : 0;
+}
+
+inline const TraceRecord *
+TraceLogReader::GetRecords (void) const
+{
+  return reinterpret_cast<const TraceRecord *> (m_data + sizeof (TraceLogHeader));
+}
+
+} // namespace nslora
+
+#endif /* NSLORA_TRACE_LOG_H */
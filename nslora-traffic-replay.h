@@ -0,0 +1,174 @@
+/*
+ * nslora-traffic-replay.h
+ *
+ * Replays the uplinks of a traffic file (nslora-traffic.h) from the end
+ * devices of a simulation, in place of one PeriodicSender per device.
+ *
+ * Sends are scheduled a window at a time: every window the replayer
+ * schedules the records due before the end of the next one and moves its
+ * cursor past them.  The number of pending events is bounded by the
+ * busiest window rather than by the size of the trace or the number of
+ * devices, and replayed pages of the file are released as the cursor
+ * advances.
+ */
+
+#ifndef NSLORA_TRAFFIC_REPLAY_H
+#define NSLORA_TRAFFIC_REPLAY_H
+
+#include "ns3/object.h"
+#include "ns3/lora-mac.h"
+#include "ns3/lora-net-device.h"
+#include "ns3/node-container.h"
+#include "ns3/packet.h"
+#include "ns3/simulator.h"
+
+#include "nslora-traffic.h"
+
+#include <stdint.h>
+#include <algorithm>
+#include <vector>
+
+namespace ns3 {
+
+class TrafficReplayer : public Object
+{
+public:
+  static TypeId GetTypeId (void);
+
+  TrafficReplayer ();
+
+  /**
+   * Replay the records of reader, which must stay open until the
+   * simulation ends.  Record device i is sent by end device i modulo the
+   * number of devices, so a trace can drive a smaller deployment.
+   */
+  void Setup (nslora::TrafficFileReader *reader, NodeContainer endDevices);
+
+  /* How far ahead of the simulation sends are scheduled, 1 s by default */
+  void SetWindow (Time window);
+
+  /* Start replaying now, up to the records due at stop */
+  void Start (Time stop);
+
+  uint64_t GetSentCount (void) const;
+  /* Largest number of sends scheduled at once */
+  uint32_t GetPeakPending (void) const;
+
+private:
+  void Refill (void);
+  void Send (uint32_t device, uint16_t size);
+
+  nslora::TrafficFileReader *m_reader;
+  std::vector<Ptr<LoraMac> > m_macs;
+  std::vector<uint32_t> m_nodeIds;
+  size_t m_next;                //!< first record not yet scheduled
+  Time m_window;
+  Time m_stop;
+  uint64_t m_sent;
+  uint32_t m_pending;
+  uint32_t m_peakPending;
+};
+
+NS_OBJECT_ENSURE_REGISTERED (TrafficReplayer);
+
+inline TypeId
+TrafficReplayer::GetTypeId (void)
+{
+  static TypeId tid = TypeId ("ns3::TrafficReplayer")
+    .SetParent<Object> ()
+    .SetGroupName ("lorawan")
+    .AddConstructor<TrafficReplayer> ();
+  return tid;
+}
+
+inline
+TrafficReplayer::TrafficReplayer ()
+  : m_reader (0),
+    m_next (0),
+    m_window (Seconds (1)),
+    m_sent (0),
+    m_pending (0),
+    m_peakPending (0)
+{
+}
+
+inline void
+TrafficReplayer::Setup (nslora::TrafficFileReader *reader, NodeContainer endDevices)
+{
+  m_reader = reader;
+  m_macs.clear ();
+  m_nodeIds.clear ();
+  for (NodeContainer::Iterator i = endDevices.Begin (); i != endDevices.End (); ++i)
+    {
+      Ptr<LoraNetDevice> loraNetDevice = (*i)->GetDevice (0)->GetObject<LoraNetDevice> ();
+      NS_ASSERT (loraNetDevice != 0);
+      m_macs.push_back (loraNetDevice->GetMac ());
+      m_nodeIds.push_back ((*i)->GetId ());
+    }
+}
+
+inline void
+TrafficReplayer::SetWindow (Time window)
+{
+  m_window = window;
+}
+
+inline void
+TrafficReplayer::Start (Time stop)
+{
+  m_stop = stop;
+  m_next = 0;
+  if (m_reader != 0 && !m_macs.empty ())
+    {
+      Simulator::ScheduleNow (&TrafficReplayer::Refill, this);
+    }
+}
+
+inline void
+TrafficReplayer::Refill (void)
+{
+  const nslora::TrafficRecord *r = m_reader->GetRecords ();
+  const size_t n = m_reader->GetRecordCount ();
+  const int64_t now = Simulator::Now ().GetNanoSeconds ();
+  const int64_t horizon = std::min ((Simulator::Now () + m_window).GetNanoSeconds (), m_stop.GetNanoSeconds ());
+  for (; m_next < n && r[m_next].time < horizon; m_next++)
+    {
+      // A record out of order is sent late rather than in the past
+      Time delay = NanoSeconds (std::max<int64_t> (r[m_next].time - now, 0));
+      uint32_t device = r[m_next].device % m_macs.size ();
+      Simulator::ScheduleWithContext (m_nodeIds[device], delay, &TrafficReplayer::Send, this,
+                                      device, r[m_next].size);
+      m_pending++;
+    }
+  m_peakPending = std::max (m_peakPending, m_pending);
+  m_reader->Release (m_next);
+
+  if (m_next < n && r[m_next].time < m_stop.GetNanoSeconds ())
+    {
+      Simulator::Schedule (m_window, &TrafficReplayer::Refill, this);
+    }
+}
+
+inline void
+TrafficReplayer::Send (uint32_t device, uint16_t size)
+{
+  m_pending--;
+  m_sent++;
+  m_macs[device]->Send (Create<Packet> (size));
+}
+
+inline uint64_t
+TrafficReplayer::GetSentCount (void) const
+{
+  return m_sent;
+}
+
+inline uint32_t
+TrafficReplayer::GetPeakPending (void) const
+{
+  return m_peakPending;
+}
+
+} // namespace ns3
+
+#endif /* NSLORA_TRAFFIC_REPLAY_H */
@@ -0,0 +1,251 @@
+/*
+ * nslora-traffic.h
+ *
+ * Binary uplink traffic file: which end device sends how many bytes when.
+ *
+ *   file header   TrafficHeader (32 bytes)
+ *   records       TrafficRecord (16 bytes each), by send time
+ *
+ * The file is mapped read-only and read front to back, so replaying it
+ * touches each page once; TrafficFileReader::Release hands the pages
+ * already replayed back to the kernel, so a day of traffic costs a
+ * constant amount of memory.  Values are in host byte order.
+ * nslora-traffic-replay.h replays a traffic file in a simulation.
+ */
+
+#ifndef NSLORA_TRAFFIC_H
+#define NSLORA_TRAFFIC_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace nslora {
+
+struct TrafficHeader
+{
+  char magic[8];
+  uint32_t version;
+  uint32_t recordSize;
+  uint32_t nDevices;            //!< devices the traffic was generated for
+  uint32_t reserved[3];
+};
+
+struct TrafficRecord
+{
+  int64_t time;                 //!< send time, nanoseconds
+  uint32_t device;              //!< end device index
+  uint16_t size;                //!< application payload, bytes
+  uint16_t reserved;
+};
+
+static const char TRAFFIC_MAGIC[8] = { 'N', 'S', 'L', 'T', 'R', 'A', 'F', 'F' };
+static const uint32_t TRAFFIC_VERSION = 1;
+
+class TrafficFileWriter
+{
+public:
+  TrafficFileWriter ();
+  ~TrafficFileWriter ();
+
+  /* \return false if the file cannot be created */
+  bool Open (const std::string &path, uint32_t nDevices);
+  void Close (void);
+
+  /* Records must be written by send time */
+  void Write (int64_t time, uint32_t device, uint16_t size);
+
+private:
+  TrafficFileWriter (const TrafficFileWriter &);
+  TrafficFileWriter &operator= (const TrafficFileWriter &);
+
+  FILE *m_file;
+};
+
+class TrafficFileReader
+{
+public:
+  TrafficFileReader ();
+  ~TrafficFileReader ();
+
+  /**
+   * Map a traffic file read-only.
+   *
+   * \return false if the file cannot be mapped or is not a traffic file
+   */
+  bool Open (const std::string &path);
+  void Close (void);
+
+  const TrafficHeader &GetHeader (void) const;
+  size_t GetRecordCount (void) const;
+  const TrafficRecord *GetRecords (void) const;
+
+  /* Drop the mapped pages holding records before first from memory */
+  void Release (size_t first);
+
+private:
+  TrafficFileReader (const TrafficFileReader &);
+  TrafficFileReader &operator= (const TrafficFileReader &);
+
+  const uint8_t *m_data;
+  size_t m_size;
+  size_t m_released;            //!< bytes already handed back
+  TrafficHeader m_header;
+};
+
+inline
+TrafficFileWriter::TrafficFileWriter ()
+  : m_file (0)
+{
+}
+
+inline
+TrafficFileWriter::~TrafficFileWriter ()
+{
+  Close ();
+}
+
+inline bool
+TrafficFileWriter::Open (const std::string &path, uint32_t nDevices)
+{
+  Close ();
+  m_file = fopen (path.c_str (), "wb");
+  if (m_file == 0)
+    {
+      return false;
+    }
+  TrafficHeader header;
+  memset (&header, 0, sizeof (header));
+  memcpy (header.magic, TRAFFIC_MAGIC, sizeof (header.magic));
+  header.version = TRAFFIC_VERSION;
+  header.recordSize = sizeof (TrafficRecord);
+  header.nDevices = nDevices;
+  fwrite (&header, sizeof (header), 1, m_file);
+  return true;
+}
+
+inline void
+TrafficFileWriter::Close (void)
+{
+  if (m_file != 0)
+    {
+      fclose (m_file);
+      m_file = 0;
+    }
+}
+
+inline void
+TrafficFileWriter::Write (int64_t time, uint32_t device, uint16_t size)
+{
+  TrafficRecord r;
+  r.time = time;
+  r.device = device;
+  r.size = size;
+  r.reserved = 0;
+  fwrite (&r, sizeof (r), 1, m_file);
+}
+
+inline
+TrafficFileReader::TrafficFileReader ()
+  : m_data (0),
+    m_size (0),
+    m_released (0)
+{
+  memset (&m_header, 0, sizeof (m_header));
+}
+
+inline
+TrafficFileReader::~TrafficFileReader ()
+{
+  Close ();
+}
+
+inline bool
+TrafficFileReader::Open (const std::string &path)
+{
+  Close ();
+  int fd = open (path.c_str (), O_RDONLY);
+  if (fd < 0)
+    {
+      return false;
+    }
+  struct stat st;
+  if (fstat (fd, &st) != 0 || size_t (st.st_size) < sizeof (TrafficHeader))
+    {
+      close (fd);
+      return false;
+    }
+  void *data = mmap (0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close (fd);
+  if (data == MAP_FAILED)
+    {
+      return false;
+    }
+  madvise (data, st.st_size, MADV_SEQUENTIAL);
+  m_data = static_cast<const uint8_t *> (data);
+  m_size = st.st_size;
+  m_released = 0;
+
+  memcpy (&m_header, m_data, sizeof (m_header));
+  if (memcmp (m_header.magic, TRAFFIC_MAGIC, sizeof (m_header.magic)) != 0
+      || m_header.version != TRAFFIC_VERSION
+      || m_header.recordSize != sizeof (TrafficRecord))
+    {
+      Close ();
+      return false;
+    }
+  return true;
+}
+
+inline void
+TrafficFileReader::Close (void)
+{
+  if (m_data != 0)
+    {
+      munmap (const_cast<uint8_t *> (m_data), m_size);
+      m_data = 0;
+      m_size = 0;
+    }
+}
+
+inline const TrafficHeader &
+TrafficFileReader::GetHeader (void) const
+{
+  return m_header;
+}
+
+inline size_t
+TrafficFileReader::GetRecordCount (void) const
+{
+  return m_data ? (m_size - sizeof (TrafficHeader)) / sizeof (TrafficRecord) : 0;
+}
+
+inline const TrafficRecord *
+TrafficFileReader::GetRecords (void) const
+{
+  return reinterpret_cast<const TrafficRecord *> (m_data + sizeof (TrafficHeader));
+}
+
+inline void
+TrafficFileReader::Release (size_t first)
+{
+  // Whole pages only, and never the one holding the next record
+  size_t page = sysconf (_SC_PAGESIZE);
+  size_t end = (sizeof (TrafficHeader) + first * sizeof (TrafficRecord)) / page * page;
+  if (m_data != 0 && end > m_released)
+    {
+      madvise (const_cast<uint8_t *> (m_data) + m_released, end - m_released, MADV_DONTNEED);
+      m_released = end;
+    }
+}
+
+} // namespace nslora
+
+#endif /* NSLORA_TRAFFIC_H */